@@ -3,6 +3,7 @@
 #include "audio_element.h"
 #include "a2dp_stream.h"
 #include "io.h"
+#include "pool.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/ringbuf.h"
@@ -46,8 +47,21 @@ typedef struct {
 } a2dp_stream_t;
 
 
+// Event parameters are copied into fixed blocks, one for every message
+// that can be queued plus the one being handled
+#define A2DP_MSG_QUEUE_LEN 10
+#define A2DP_PARAM_SIZE _max3(sizeof(esp_a2d_cb_param_t), \
+        sizeof(esp_avrc_ct_cb_param_t), sizeof(esp_avrc_tg_cb_param_t))
+#define A2DP_TEXT_SIZE 128  // Max length of metadata text, incl. '\0'
+#define _max(a, b) ((a) > (b) ? (a) : (b))
+#define _max3(a, b, c) _max(_max(a, b), c)
+
+POOL_DEFINE(s_param_pool, A2DP_PARAM_SIZE, A2DP_MSG_QUEUE_LEN + 1);
+POOL_DEFINE(s_text_pool, A2DP_TEXT_SIZE, 4);
+
 static QueueHandle_t   gs_msg_queue;
 static io_t            *gs_output;
+static audio_element_t *gs_element;
 
 
 /**
@@ -129,6 +143,8 @@ static inline bool send_msg(msg_t *msg) {
         return false;
     }
 
+    // Wake up the element task to handle the message
+    audio_element_notify(gs_element, AEL_BIT_EVENT);
     return true;
 }
 
@@ -139,13 +155,16 @@ static bool work_dispatch(evt_hdl_fn_t func, uint16_t event, void *param, int pa
     msg_t msg;
     msg.event = event;
     msg.func = func;
+    msg.param = NULL;
 
     if (param_len == 0) {
         return send_msg(&msg);
-    } else if (param && param_len > 0) {
-        if ((msg.param = malloc(param_len)) != NULL) {
+    } else if (param && param_len > 0 && param_len <= A2DP_PARAM_SIZE) {
+        if ((msg.param = pool_alloc(&s_param_pool)) != NULL) {
             memcpy(msg.param, param, param_len);
-            return send_msg(&msg);
+            if (send_msg(&msg))
+                return true;
+            pool_free(&s_param_pool, msg.param);
         }
     }
 
@@ -371,7 +390,7 @@ static void bt_hdl_rc_ct_evt(audio_element_t *el, uint16_t event,
         {
             ESP_LOGI(TAG, "AVRC Metadata RSP: attr id 0x%x, %s",
                     rc->meta_rsp.attr_id, rc->meta_rsp.attr_text);
-            free(rc->meta_rsp.attr_text);
+            pool_free(&s_text_pool, rc->meta_rsp.attr_text);
             break;
         }
 
@@ -467,6 +486,23 @@ static void bt_a2d_data_cb(const uint8_t *data, uint32_t len) {
 static void bt_rc_ct_cb(esp_avrc_ct_cb_event_t event,
         esp_avrc_ct_cb_param_t *param) {
     // NOTE: Possibly handle some events here, so they are handled more quickly? 
+    if (event == ESP_AVRC_CT_METADATA_RSP_EVT) {
+        // The text is owned by the bt stack, copy it for the handler. It is
+        // cut off at A2DP_TEXT_SIZE.
+        esp_avrc_ct_cb_param_t rc = *param;
+        int len = rc.meta_rsp.attr_length < A2DP_TEXT_SIZE ?
+            rc.meta_rsp.attr_length : A2DP_TEXT_SIZE - 1;
+        char *text = pool_alloc(&s_text_pool);
+        if (!text)
+            return;
+        memcpy(text, rc.meta_rsp.attr_text, len);
+        text[len] = '\0';
+        rc.meta_rsp.attr_text = (uint8_t *)text;
+
+        if (!work_dispatch(bt_hdl_rc_ct_evt, event, &rc, sizeof(rc)))
+            pool_free(&s_text_pool, text);
+        return;
+    }
     work_dispatch(bt_hdl_rc_ct_evt, event, param,
             sizeof(esp_avrc_ct_cb_param_t));
 }
@@ -518,6 +554,7 @@ static esp_err_t _a2dp_open(audio_element_t *el, void* pv) {
     // queue and the output buffer
     gs_msg_queue = stream->msg_queue;
     gs_output = el->output;
+    gs_element = el;
     
     // Set the device name
     ESP_LOGI(TAG, "[%s] Setting device name to %s", el->tag, device_name);
@@ -568,6 +605,7 @@ static esp_err_t _a2dp_open(audio_element_t *el, void* pv) {
 static esp_err_t _a2dp_close(audio_element_t *el) {
     gs_msg_queue = NULL;
     gs_output = NULL;
+    gs_element = NULL;
 
     // Deinit a2dp and avrcp
     ESP_ERROR_CHECK(esp_avrc_ct_deinit());
@@ -593,14 +631,16 @@ static esp_err_t _a2dp_destroy(audio_element_t *el) {
 }
 
 /* This process function does not actually process audio data, instead it
- * checks for bluetooth events, and executes linked functions.
+ * handles the bluetooth events queued by the callbacks, and executes linked
+ * functions. The task is notified for every queued event.
  * The audio data is read into the output buffer through a a2dp callback func.
  */
 static size_t _a2dp_process(audio_element_t *el) {
     static msg_t msg;
+    size_t handled = 0;
     /* static a2dp_stream_t *stream = el->data; */
 
-    if (xQueueReceive(gs_msg_queue, &msg, pdMS_TO_TICKS(100)) == pdTRUE) {
+    while (xQueueReceive(gs_msg_queue, &msg, 0) == pdTRUE) {
         ESP_LOGD(TAG, "[%s] Received a msg to handle. Event: 0x%x", el->tag,
                 msg.event);
 
@@ -608,9 +648,10 @@ static size_t _a2dp_process(audio_element_t *el) {
             msg.func(el, msg.event, msg.param);
         
         if (msg.param)
-            free(msg.param);
+            pool_free(&s_param_pool, msg.param);
+        handled++;
     }
-    return 0;
+    return handled;
 }
 
 audio_element_t *a2dp_stream_init(audio_element_cfg_t cfg, audio_stream_type_t type) {
@@ -621,7 +662,12 @@ audio_element_t *a2dp_stream_init(audio_element_cfg_t cfg, audio_stream_type_t t
         return NULL;
     }
 
-    stream->msg_queue = xQueueCreate(10, sizeof(msg_t));
+    stream->msg_queue = xQueueCreate(A2DP_MSG_QUEUE_LEN, sizeof(msg_t));
+    if (!stream->msg_queue) {
+        ESP_LOGE(TAG, "Could not create message queue!");
+        free(stream);
+        return NULL;
+    }
 
     // Configure audio_element_t
     cfg.open = _a2dp_open;
@@ -634,16 +680,25 @@ audio_element_t *a2dp_stream_init(audio_element_cfg_t cfg, audio_stream_type_t t
     stream->type = type;
     if (type == AEL_STREAM_WRITER) {
         ESP_LOGE(TAG, "AEL_STREAM_WRITER Not implemented.");
+        vQueueDelete(stream->msg_queue);
+        free(stream);
         return NULL;
     }
 
     // Input is not used, as the output RB is being written by a cb
     cfg.input = IO_UNUSED;
     // Output is implicitly created with default rb read and write cb functions
+    // and stays blocking, the element task never writes it. The callback is
+    // its only writer. With an SPSC ring the info changes of the element
+    // task go exactly after the data the callback committed.
+    cfg.out_external = true;
+    cfg.out_rb_backend = IO_BACKEND_SPSC;
 
     audio_element_t *el = audio_element_init(&cfg);
     if (!el) {
-        ESP_LOGE(TAG, "[%s] could not init audio element.", el->tag);
+        ESP_LOGE(TAG, "[%s] could not init audio element.", cfg.tag);
+        vQueueDelete(stream->msg_queue);
+        free(stream);
         return NULL;
     }
     el->data = stream;
@@ -0,0 +1,208 @@
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+
+#include "asrc.h"
+#include "audio_element.h"
+#include "block_conv.h"
+#include "io.h"
+#include "polyphase.h"
+
+#include <stdatomic.h>
+
+#include "esp_log.h"
+
+static const char TAG[] = "ASRC";
+
+#define ASRC_AVERAGE_S 0.25f    // Of the fill, twice: bursts of the source
+                                // must not modulate the ratio
+
+typedef struct {
+    block_conv_t bc;
+    polyphase_t pp;
+    asrc_cfg_t cfg;
+    bool     running;               // The input held the target once
+    size_t   waiting;               // Frames between input and sink
+    size_t   queued;                // Frames in the output, after a block
+    size_t   out_fill;              // Frames in the output, before a block
+    float    smooth;                // 'waiting', averaged
+    float    average;               // 'smooth', averaged again
+    float    integral;              // Of the error, in s * s
+    float    correction;            // Of the ratio, 1e-6 is 1 ppm
+    atomic_int ppb;                 // 'correction' for asrc_get_ppm
+    atomic_int latency_us;          // 'average' for asrc_get_latency
+} asrc_t;
+
+
+// Set up the converter for a new input format, the output keeps it
+static bool _asrc_format(audio_element_t *el, audio_element_info_t *out) {
+    asrc_t *as = el->data;
+    esp_err_t ret;
+
+    as->running = false;
+
+    // The correction is kept, the clocks did not change
+    ret = polyphase_init_adaptive(&as->pp, out->sample_rate, out->channels,
+            as->cfg.quality);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "[%s] Cannot convert %d Hz, %d channels: %s, passing "
+                "it on as is", el->tag, out->sample_rate, out->channels,
+                esp_err_to_name(ret));
+        return false;
+    }
+    polyphase_set_ratio(&as->pp, POLYPHASE_ONE
+            + (int64_t)(as->correction * POLYPHASE_ONE));
+    return true;
+}
+
+
+/**
+ * Steer the ratio, with 'waiting' frames on their way to the sink. These
+ * integrate the difference of the two clocks, so a PI loop on them settles
+ * without a steady error. Its gains put a double pole at kp / 2, that is
+ * 1 / settle_s: critically damped.
+ *
+ * The count jumps with every burst of the source, and every block taken by
+ * the sink. The average is over the time of the sink, the 'played' frames
+ * since the last call: the count is only sampled when this element runs,
+ * and how often that is must not move the average.
+ */
+static void _asrc_steer(asrc_t *as, size_t waiting, size_t played) {
+    float rate = as->bc.info.sample_rate,
+          dt = played / rate,
+          kp = 2000.f / as->cfg.settle_ms,
+          ki = kp * kp / 4.f,
+          max = as->cfg.max_ppm * 1e-6f,
+          weight = dt < ASRC_AVERAGE_S ? dt / ASRC_AVERAGE_S : 1.f,
+          error,
+          correction;
+
+    // The last count held until now
+    as->smooth += (as->waiting - as->smooth) * weight;
+    as->average += (as->smooth - as->average) * weight;
+    as->waiting = waiting;
+    error = (as->average - rate * as->cfg.target_ms / 1000.f) / rate;
+
+    // No winding up while at the limit
+    correction = kp * error + ki * (as->integral + error * dt);
+    if (correction > -max && correction < max)
+        as->integral += error * dt;
+    correction = kp * error + ki * as->integral;
+    as->correction = correction > max ? max
+        : correction < -max ? -max : correction;
+
+    polyphase_set_ratio(&as->pp, POLYPHASE_ONE
+            + (int64_t)(as->correction * POLYPHASE_ONE));
+    atomic_store_explicit(&as->ppb, as->correction * 1e9f,
+            memory_order_relaxed);
+    atomic_store_explicit(&as->latency_us, as->average * 1e6f / rate,
+            memory_order_relaxed);
+}
+
+
+// Start once the input holds the target, the loop takes it from there
+static bool _asrc_ready(audio_element_t *el, size_t frame_bytes) {
+    asrc_t *as = el->data;
+    size_t fill = io_fill(el->input) / frame_bytes;
+
+    as->out_fill = io_fill(el->output) / frame_bytes;
+    if (as->running)
+        return true;
+    if (fill < (size_t)as->bc.info.sample_rate * as->cfg.target_ms / 1000)
+        return false;
+
+    ESP_LOGD(TAG, "[%s] Running at %d frames, %.2f ppm", el->tag, fill,
+            as->correction * 1e6f);
+    as->running = true;
+    as->waiting = fill + as->out_fill;
+    as->queued = as->out_fill;
+    as->smooth = as->average = as->waiting;
+    return true;
+}
+
+
+static size_t _asrc_frames_needed(audio_element_t *el, size_t out_frames) {
+    asrc_t *as = el->data;
+    return polyphase_frames_needed(&as->pp, out_frames);
+}
+
+
+static size_t _asrc_convert(audio_element_t *el, const int32_t *in,
+        size_t in_frames, size_t *used, int32_t *out, size_t out_frames) {
+    asrc_t *as = el->data;
+    return polyphase_process(&as->pp, in, in_frames, used, out, out_frames);
+}
+
+
+// Steer on all that waits for the sink, in the input, the history and the
+// output. Whatever left the output since the last block was played.
+static void _asrc_converted(audio_element_t *el, size_t frames,
+        size_t frame_bytes) {
+    asrc_t *as = el->data;
+    size_t fill;
+
+    if (!frames) {
+        // Ran dry, fill up to the target again
+        ESP_LOGW(TAG, "[%s] Input ran dry", el->tag);
+        as->running = false;
+        return;
+    }
+
+    fill = io_fill(el->input) / frame_bytes
+        + (as->pp.fill > as->pp.pos ? as->pp.fill - as->pp.pos : 0);
+    _asrc_steer(as, fill + as->out_fill + frames,
+            as->queued > as->out_fill ? as->queued - as->out_fill : 0);
+    as->queued = as->out_fill + frames;
+}
+
+
+static void _asrc_deinit(audio_element_t *el) {
+    asrc_t *as = el->data;
+    polyphase_deinit(&as->pp);
+}
+
+
+static const block_conv_ops_t s_asrc_ops = {
+    .format = _asrc_format,
+    .frames_needed = _asrc_frames_needed,
+    .process = _asrc_convert,
+    .deinit = _asrc_deinit,
+    .ready = _asrc_ready,
+    .converted = _asrc_converted,
+};
+
+
+audio_element_t *asrc_init(audio_element_cfg_t cfg, asrc_cfg_t asrc_cfg) {
+    if (asrc_cfg.target_ms < 0 || asrc_cfg.max_ppm < 0
+            || asrc_cfg.settle_ms <= 0) {
+        ESP_LOGE(TAG, "Invalid configuration");
+        return NULL;
+    }
+
+    asrc_t *as = calloc(1, sizeof(asrc_t));
+    if (!as) {
+        ESP_LOGE(TAG, "Could not allocate memory!");
+        return NULL;
+    }
+    as->cfg = asrc_cfg;
+    atomic_init(&as->ppb, 0);
+    atomic_init(&as->latency_us, 0);
+
+    cfg.tag = "asrc";
+
+    audio_element_t *el = block_conv_init(&cfg, &s_asrc_ops, &as->bc);
+    if (!el)
+        free(as);
+    return el;
+}
+
+
+float asrc_get_ppm(audio_element_t *el) {
+    asrc_t *as = el->data;
+    return atomic_load_explicit(&as->ppb, memory_order_relaxed) / 1000.f;
+}
+
+
+float asrc_get_latency(audio_element_t *el) {
+    asrc_t *as = el->data;
+    return atomic_load_explicit(&as->latency_us, memory_order_relaxed)
+        / 1000.f;
+}
@@ -0,0 +1,81 @@
+/**
+ * Asynchronous sample rate converter: absorbs the drift between the clock
+ * of a source and that of the sink.
+ *
+ * A source like a2dp delivers at the rate of the phone's clock, i2s takes
+ * samples at the rate of the ESP32's. Even a few ppm apart, the ring in
+ * between slowly fills or drains, until it over- or underruns. The asrc
+ * reads that ring and converts its input at a ratio close to 1 (see
+ * polyphase_init_adaptive), steered by a PI loop so `target_ms` of audio
+ * waits between the source and the sink (in that ring, the converter and
+ * its own output) indefinitely. The ring only has to be large enough for
+ * the target and the burstiness of the source, not for drift.
+ *
+ * Run it in the same task as the sink (e.g. in its pipeline), so it is
+ * paced by the sink's clock. It waits until the ring holds the target
+ * before it starts, and again after the ring ran dry. The output has the
+ * format of the input.
+ */
+
+#ifndef ASRC_H
+#define ASRC_H
+
+#include "audio_element.h"
+#include "polyphase.h"
+
+typedef struct asrc_cfg {
+    int     target_ms;      // Audio to keep on its way to the sink, more
+                            // than the longest burst of the source
+    int     max_ppm;        // Max correction of the ratio
+    int     settle_ms;      // Time constant of the control loop
+    polyphase_quality_t quality;
+} asrc_cfg_t;
+
+#define DEFAULT_ASRC_CFG() {        \
+    .target_ms = 20,                \
+    .max_ppm = 500,                 \
+    .settle_ms = 5000,              \
+    .quality = POLYPHASE_MEDIUM,    \
+}
+
+
+/**
+ * Initialize the asrc
+ *
+ * The open, process and destroy fields of `cfg` are set by the asrc.
+ * `buf_len` is the max number of bytes read from the input per process
+ * call.
+ *
+ * @param cfg       A configured `audio_element_cfg_t` struct, linked to the
+ *                  element whose clock drifts
+ * @param asrc_cfg  Target and control loop
+ *
+ * @return
+ *      - audio_element_t if successful
+ *      - NULL otherwise
+ */
+audio_element_t *asrc_init(audio_element_cfg_t cfg, asrc_cfg_t asrc_cfg);
+
+/**
+ * Current correction of the ratio. Positive when the source runs fast, and
+ * more input is taken per output frame. Can be called from any task.
+ *
+ * @param el    Pointer to the asrc
+ *
+ * @return
+ *      - Correction in ppm
+ */
+float asrc_get_ppm(audio_element_t *el);
+
+/**
+ * Audio on its way to the sink, averaged over about half a second of it.
+ * Can be called from any task.
+ *
+ * @param el    Pointer to the asrc
+ *
+ * @return
+ *      - Latency in ms
+ */
+float asrc_get_latency(audio_element_t *el);
+
+#endif
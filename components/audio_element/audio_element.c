@@ -1,9 +1,14 @@
 #define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
 
 #include "audio_element.h"
+#include "hist.h"
+#include "io_trace.h"
+#include "pool.h"
 
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "string.h"
 
 #include "freertos/FreeRTOS.h"
@@ -13,11 +18,7 @@
 
 #define DEFAULT_TICKS_TO_WAIT pdMS_TO_TICKS(500)
 #define DEFAULT_MSG_QUEUE_LENGTH 16
-
-enum notification_bit {
-    AEL_BIT_STATUS_CHANGED = 1,  // Set but unused for now
-};
-
+#define STATS_TASK_STACK 3072
 
 const char *audio_element_status_str[] = {
     "PLAYING", "PAUSED", "WAITING", "STOPPED"
@@ -25,115 +26,177 @@ const char *audio_element_status_str[] = {
 
 static const char TAG[] = "AEL";
 
+// All elements, used to dump the stats of all of them
+static audio_element_t *s_elements = NULL;
+static SemaphoreHandle_t s_elements_lock = NULL;
+
+POOL_DEFINE(s_element_pool, sizeof(audio_element_t), AEL_MAX_ELEMENTS);
+static void _info_marker(io_t *io, const void *data);
+
+_Static_assert(sizeof(audio_element_info_t) <= IO_MARKER_SIZE,
+        "audio_element_info_t does not fit in an io_t marker");
+
+POOL_DEFINE(s_info_pool, sizeof(audio_element_info_shared_t),
+        MAX_RING_BUFFERS);
+// Serializes the writers of every info, see _info_publish
+static portMUX_TYPE s_info_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t s_stats_timer = NULL;
+static TaskHandle_t s_stats_task = NULL;
+
 
 static size_t _default_process(audio_element_t *el) {
     ESP_LOGV(TAG, "[%s] Default process running", el->tag);
-    audio_element_info_t *input_info = el->input->user_data;
+    size_t len = el->buf_len;
+    size_t bytes;
+    char *data;
 
-    /*
-    if (input_info->changed) {
+    // Pass a new input info on to the output, e.g. through a tee
+    if (audio_element_info_changed(el->input, el->input_gen)) {
         ESP_LOGD(TAG, "[%s] input info changed, updating output info",
                 el->tag);
-        audio_element_set_info(el->output, audio_element_get_info(el->input));
-        input_info->changed = false;
+        audio_element_info_t info = audio_element_get_info(el->input);
+        audio_element_set_info(el->output, info);
+        el->input_gen = info.gen;
     }
-    */
 
-    size_t bytes_read = el->input->read(el->input, el->buf, el->buf_len, el);
-    if (bytes_read > 0) {
-        return el->output->write(el->output, el->buf, bytes_read, el);
+    if (!el->input->rb) {
+        // Input is a read callback, let it fill the output region in place
+        data = io_acquire_write(el->output, &len);
+        if (!data)
+            return 0;
+        bytes = el->input->read(el->input, data, len, el);
+        return io_commit_write(el->output, bytes, el);
     }
-    return 0;
+
+    // Input is a ringbuffer, hand the borrowed region straight to the output
+    data = io_acquire_read(el->input, &len, el);
+    if (!data)
+        return 0;
+    bytes = el->output->write(el->output, data, len, el);
+    io_release_read(el->input, len);
+    return bytes;
 }
 
 
-static void audio_element_destroy(audio_element_t *el) {
-    audio_element_info_t *info;
+// Destroy an io_t created by audio_element_io_create, and its info
+static void audio_element_io_destroy(io_t *io) {
+    // A tap shares the info of the io_t it taps
+    if (io->user_data && !io->source)
+        pool_free(&s_info_pool, io->user_data);
+    io->user_data = NULL;
+    io_destroy(io);
+}
+
 
+static void audio_element_destroy(audio_element_t *el) {
     if (el->destroy)
         el->destroy(el);
 
-    free(el->buf);
+    // Remove from the list of elements. A linked io_t is destroyed by its
+    // writer or its reader, whichever goes last. A tap is private to its
+    // reader.
+    bool input_used = false, output_used = false;
+    xSemaphoreTake(s_elements_lock, portMAX_DELAY);
+    for (audio_element_t **it = &s_elements; *it; it = &(*it)->next) {
+        if (*it == el) {
+            *it = el->next;
+            break;
+        }
+    }
+    for (audio_element_t *it = s_elements; it; it = it->next) {
+        if (el->input != IO_UNUSED && !el->input->source
+                && it->output == el->input)
+            input_used = true;
+        if (audio_element_reads_from(it, el->output))
+            output_used = true;
+    }
+    xSemaphoreGive(s_elements_lock);
 
-    info = el->input->user_data;
-    vSemaphoreDelete(info->lock);
-    io_destroy(el->input);
+    if (el->input != IO_UNUSED && !input_used)
+        audio_element_io_destroy(el->input);
 
-    info = el->output->user_data;
-    vSemaphoreDelete(info->lock);
-    io_destroy(el->output);
+    if (el->output != IO_UNUSED && !output_used)
+        audio_element_io_destroy(el->output);
 
-    free(el);
+    pool_free(&s_element_pool, el);
     el = NULL;
 }
 
 
-static io_t *audio_element_io_create(io_cb read, io_cb write, int size) {
-    io_t *buf = io_create(read, write, size);
+static io_t *audio_element_io_create(io_backend_t backend, io_cb read,
+        io_cb write, int size) {
+    io_t *buf = io_create_backend(backend, read, write, size);
     if (!buf) {
         return NULL;
     }
     
-    buf->user_data = calloc(1, sizeof(audio_element_info_t));
+    buf->user_data = pool_calloc(&s_info_pool);
     if (!buf->user_data) {
+        io_destroy(buf);
         return NULL;
     }
 
-    // Create mutex, and set info to default values
-    audio_element_info_t *info = buf->user_data;
-    info->lock = xSemaphoreCreateMutex();
+    // New infos are passed in-band with the data
+    buf->on_marker = _info_marker;
+
+    // Set info to default values
+    audio_element_info_shared_t *info = buf->user_data;
     // TODO: Make some more general way of setting these defaults
-    info->sample_rate = 44100;
-    info->channels = 2;
-    info->bits = 16;
+    atomic_init(&info->gen, 0);
+    atomic_init(&info->sample_rate, 44100);
+    atomic_init(&info->channels, 2);
+    atomic_init(&info->bits, 16);
 
     return buf;
 }
 
 
-void audio_element_task(void *pv) {
-    audio_element_t *el = (audio_element_t*) pv;
-    int process_res;
-    BaseType_t notify_res;
-    uint32_t notification = 0;
-
-    el->status = AEL_STATUS_PLAYING;
-    el->task_running = true;
-    while (el->task_running) {
+static void _count_process(audio_element_t *el, uint32_t time,
+        int process_res) {
+    audio_element_counters_t *c = &el->counters;
 
-        // Check for notification
-        notify_res = xTaskNotifyWait(pdFALSE, ULONG_MAX, &notification, 0);
-        if (notify_res == pdTRUE) {
-            ESP_LOGD(TAG, "[%s] Notification received! 0x%x", el->tag,
-                    notification);
+    hist_add(c->process_time_hist, AEL_STATS_HIST_BUCKETS, time);
 
-            // TODO: Change status
-        }
+    c->process_count++;
+    c->process_time_total += time;
+    if (time < c->process_time_min)
+        c->process_time_min = time;
+    if (time > c->process_time_max)
+        c->process_time_max = time;
+    if (process_res > 0)
+        c->bytes_processed += process_res;
+}
 
 
-        // Process audio data
-        if (el->is_open) {
-            process_res = el->process(el);
-            if (process_res < 0) {
-                // Some error, print debug info
-                // -2 is when no data was written (e.g. buffer full)
-                switch (process_res) {
-                    case IO_WRITE_ERROR:
-                        ESP_LOGW(TAG, "[%s] Could not write to output",
-                                el->tag);
-                        break;
-                    default:
-                    ESP_LOGW(TAG, "[%s] Process returned error: %d, %s",
-                            el->tag, process_res,
-                            esp_err_to_name(process_res));
-                }
-            }
-        } else {
-            ESP_LOGD(TAG, "[%s] Not yet open", el->tag);
-            vTaskDelay(pdMS_TO_TICKS(1000));
+int audio_element_run(audio_element_t *el) {
+    int process_res;
+    int64_t start;
+
+    if (!el->is_open)
+        return 0;
+
+    start = esp_timer_get_time();
+    process_res = el->process(el);
+    _count_process(el, esp_timer_get_time() - start, process_res);
+    if (process_res < 0) {
+        // Some error, print debug info
+        // -2 is when no data was written (e.g. buffer full)
+        switch (process_res) {
+            case IO_WRITE_ERROR:
+                ESP_LOGW(TAG, "[%s] Could not write to output",
+                        el->tag);
+                break;
+            default:
+            ESP_LOGW(TAG, "[%s] Process returned error: %d, %s",
+                    el->tag, process_res,
+                    esp_err_to_name(process_res));
         }
     }
+    return process_res;
+}
 
+
+void audio_element_deinit(audio_element_t *el) {
     ESP_LOGD(TAG, "[%s] Closing", el->tag);
     if (el->is_open && el->close) {
         el->close(el);
@@ -141,29 +204,85 @@ void audio_element_task(void *pv) {
     el->is_open = false;
 
     audio_element_destroy(el);
+}
+
+
+// The extra inputs of an element can change while it runs, see inputs_lock
+static void _inputs_lock(audio_element_t *el) {
+    if (el->inputs_lock)
+        xSemaphoreTake(el->inputs_lock, portMAX_DELAY);
+}
+
+static void _inputs_unlock(audio_element_t *el) {
+    if (el->inputs_lock)
+        xSemaphoreGive(el->inputs_lock);
+}
+
+
+void audio_element_attach(audio_element_t *el, TaskHandle_t task) {
+    el->task_handle = task;
+
+    // The task waits for notifications instead of blocking on its io_t's
+    if (el->input != IO_UNUSED) {
+        el->input->reader = task;
+        el->input->nonblocking = true;
+    }
+    _inputs_lock(el);
+    for (size_t i = 0; i < el->input_count; i++) {
+        if (el->inputs[i]) {
+            el->inputs[i]->reader = task;
+            el->inputs[i]->nonblocking = true;
+        }
+    }
+    _inputs_unlock(el);
+    // Whoever writes an external output blocks on it as before
+    if (el->output != IO_UNUSED && !el->out_external) {
+        el->output->writer = task;
+        el->output->nonblocking = true;
+    }
+}
+
+
+void audio_element_task(void *pv) {
+    audio_element_t *el = (audio_element_t*) pv;
+    uint32_t notification = 0;
+
+    audio_element_attach(el, xTaskGetCurrentTaskHandle());
+
+    el->status = AEL_STATUS_PLAYING;
+    el->task_running = true;
+    while (el->task_running) {
+
+        // Process audio data, as long as there is something to do
+        if (!el->is_open) {
+            ESP_LOGD(TAG, "[%s] Not yet open", el->tag);
+        } else if (audio_element_run(el) > 0) {
+            continue;
+        }
+
+        // Sleep until data, space or a control notification arrives
+        xTaskNotifyWait(pdFALSE, ULONG_MAX, &notification, portMAX_DELAY);
+        ESP_LOGV(TAG, "[%s] Notification received! 0x%x", el->tag,
+                notification);
+
+        // TODO: Change status
+    }
 
     ESP_LOGI(TAG, "[%s] task deleted. Max mem usage: %d", el->tag,
             uxTaskGetStackHighWaterMark(NULL));
+    audio_element_dump_stats(el);
+    audio_element_deinit(el);
     vTaskDelete(NULL);
 }
 
 
 audio_element_t *audio_element_init(audio_element_cfg_t *config) {
-    audio_element_t *el = calloc(1, sizeof(audio_element_t));
+    audio_element_t *el = pool_calloc(&s_element_pool);
     if (el == NULL) {
         ESP_LOGE(TAG, "Could not allocate memory for element");
         return NULL;
     }
 
-    // Allocate memory for working buffer, if needed
-    if (config->buf_len) {
-        el->buf = malloc(config->buf_len);
-        if (el->buf == NULL) {
-            ESP_LOGE(TAG, "[%s] Could not allocate memory for internal buffer",
-                    config->tag);
-            return NULL;
-        }
-    }
     el->buf_len = config->buf_len;
 
     // Set callback functions
@@ -181,9 +300,11 @@ audio_element_t *audio_element_init(audio_element_cfg_t *config) {
     if (config->input)
         el->input = config->input;
     else {
-        el->input = audio_element_io_create(config->read, config->write, 0);
+        el->input = audio_element_io_create(IO_BACKEND_RINGBUF,
+                config->read, config->write, 0);
         if (!el->input) {
             ESP_LOGE(TAG, "[%s] Could not create input buffer", config->tag);
+            pool_free(&s_element_pool, el);
             return NULL;
         }
     }
@@ -193,25 +314,67 @@ audio_element_t *audio_element_init(audio_element_cfg_t *config) {
     if (config->output)
         el->output = config->output;
     else {
-        el->output = audio_element_io_create(config->read, config->write,
-                config->out_rb_size);
+        el->output = audio_element_io_create(config->out_rb_backend,
+                config->read, config->write, config->out_rb_size);
         if (!el->output) {
             ESP_LOGE(TAG, "[%s] Could not create output buffer", config->tag);
+            if (!config->input)
+                audio_element_io_destroy(el->input);
+            pool_free(&s_element_pool, el);
             return NULL;
         }
     }
+    el->out_external = config->out_external;
 
     el->tag = config->tag;
     el->status = AEL_STATUS_STOPPED;
+
+    el->counters.process_time_min = UINT32_MAX;
+    el->counters.start_time = esp_timer_get_time();
+
+    // Add to the list of elements
+    if (!s_elements_lock)
+        s_elements_lock = xSemaphoreCreateMutex();
+    xSemaphoreTake(s_elements_lock, portMAX_DELAY);
+    el->next = s_elements;
+    s_elements = el;
+    xSemaphoreGive(s_elements_lock);
     
+    el->is_open = false;
+
     // Create task if needed
-    if (config->task_stack > 0) {
-        xTaskCreate(audio_element_task, config->tag, config->task_stack, el,
-                configMAX_PRIORITIES, &el->task_handle);
+    if (config->task_stack > 0)
+        audio_element_start_task(el, config->task_stack);
+    return el;
+}
+
+
+esp_err_t audio_element_start_task(audio_element_t *el, int task_stack) {
+    if (xTaskCreate(audio_element_task, el->tag, task_stack, el,
+                configMAX_PRIORITIES, &el->task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "[%s] Could not create task", el->tag);
+        return ESP_ERR_NO_MEM;
     }
+    return ESP_OK;
+}
 
-    el->is_open = false;
-    return el;
+
+bool audio_element_reads_from(audio_element_t *el, io_t *io) {
+    bool found = false;
+
+    if (io == IO_UNUSED)
+        return false;
+    // A tap reads from the io_t it taps
+    if (el->input == io
+            || (el->input != IO_UNUSED && el->input->source == io))
+        return true;
+    _inputs_lock(el);
+    for (size_t i = 0; i < el->input_count && !found; i++) {
+        found = el->inputs[i] == io
+            || (el->inputs[i] && el->inputs[i]->source == io);
+    }
+    _inputs_unlock(el);
+    return found;
 }
 
 
@@ -227,7 +390,17 @@ void audio_element_cfg_clear(audio_element_cfg_t *cfg) {
 }
 
 
+esp_err_t audio_element_open(audio_element_t *el, void *pv) {
+    esp_err_t ret = el->open(el, pv);
+    if (ret == ESP_OK)
+        audio_element_notify(el, AEL_BIT_OPENED);
+    return ret;
+}
+
+
 esp_err_t audio_element_notify(audio_element_t *el, int bits) {
+    if (!el->task_handle)
+        return ESP_FAIL;
     if (xTaskNotify(el->task_handle, bits, eSetBits) == pdTRUE) {
         return ESP_OK;
     }
@@ -235,6 +408,145 @@ esp_err_t audio_element_notify(audio_element_t *el, int bits) {
 }
 
 
+void audio_element_get_stats(audio_element_t *el,
+        audio_element_stats_t *stats, const audio_element_stats_t *prev) {
+    audio_element_counters_t *c = &el->counters;
+    int64_t elapsed;
+    size_t i;
+
+    memset(stats, 0, sizeof(audio_element_stats_t));
+    stats->time = esp_timer_get_time();
+
+    stats->process_count = c->process_count;
+    if (c->process_count) {
+        stats->process_time_min = c->process_time_min;
+        stats->process_time_avg = c->process_time_total / c->process_count;
+        stats->process_time_p99 = hist_p99(c->process_time_hist,
+                AEL_STATS_HIST_BUCKETS, c->process_count,
+                c->process_time_max);
+        stats->process_time_max = c->process_time_max;
+    }
+
+    // Inputs
+    if (el->input != IO_UNUSED) {
+        stats->bytes_in += el->input->bytes_read;
+        stats->underruns += el->input->underruns;
+        stats->in_fill += io_fill(el->input);
+    }
+    // Only with the lock held is an extra input sure to stay until it has
+    // been read
+    _inputs_lock(el);
+    for (i = 0; i < el->input_count; i++) {
+        io_t *input = el->inputs[i];
+        if (!input)
+            continue;
+        stats->bytes_in += input->bytes_read;
+        stats->underruns += input->underruns;
+        stats->in_fill += io_fill(input);
+    }
+    _inputs_unlock(el);
+
+    // Output, sinks only have their process results
+    if (el->output != IO_UNUSED) {
+        stats->bytes_out = el->output->bytes_written;
+        stats->overruns = el->output->overruns;
+        stats->out_fill = io_fill(el->output);
+        stats->out_size = el->output->size;
+    } else {
+        stats->bytes_out = c->bytes_processed;
+    }
+
+    elapsed = stats->time - (prev ? prev->time : c->start_time);
+    if (elapsed > 0) {
+        stats->rate_in = (uint64_t)(stats->bytes_in
+                - (prev ? prev->bytes_in : 0)) * 1000000 / elapsed;
+        stats->rate_out = (uint64_t)(stats->bytes_out
+                - (prev ? prev->bytes_out : 0)) * 1000000 / elapsed;
+    }
+
+    if (el->task_handle)
+        stats->stack_free = uxTaskGetStackHighWaterMark(el->task_handle);
+    stats->heap_free = esp_get_free_heap_size();
+    stats->heap_min_free = esp_get_minimum_free_heap_size();
+}
+
+
+static void _log_stats(audio_element_t *el, const audio_element_stats_t *st) {
+    ESP_LOGI(TAG, "[%s] process: %u calls, us min/avg/p99/max "
+            "%u/%u/%u/%u", el->tag, st->process_count, st->process_time_min,
+            st->process_time_avg, st->process_time_p99,
+            st->process_time_max);
+    ESP_LOGI(TAG, "[%s] in: %u B, %u B/s, %u underruns, fill %u | "
+            "out: %u B, %u B/s, %u overruns, fill %u/%u", el->tag,
+            st->bytes_in, st->rate_in, st->underruns, st->in_fill,
+            st->bytes_out, st->rate_out, st->overruns, st->out_fill,
+            st->out_size);
+    ESP_LOGI(TAG, "[%s] stack free: %u, heap free: %u (min %u)", el->tag,
+            st->stack_free, st->heap_free, st->heap_min_free);
+}
+
+
+void audio_element_dump_stats(audio_element_t *el) {
+    audio_element_stats_t st;
+    audio_element_get_stats(el, &st, NULL);
+    _log_stats(el, &st);
+}
+
+
+// Dumps the stats when the timer says so, each element's rates since its
+// previous dump
+static void _stats_task(void *pv) {
+    audio_element_stats_t st;
+
+    while (1) {
+        xTaskNotifyWait(pdFALSE, ULONG_MAX, NULL, portMAX_DELAY);
+        xSemaphoreTake(s_elements_lock, portMAX_DELAY);
+        for (audio_element_t *el = s_elements; el; el = el->next) {
+            audio_element_get_stats(el, &st,
+                    el->stats_prev.time ? &el->stats_prev : NULL);
+            _log_stats(el, &st);
+            el->stats_prev = st;
+        }
+        xSemaphoreGive(s_elements_lock);
+        io_trace_dump();
+        pool_dump_stats();
+    }
+}
+
+
+// Runs in the esp_timer task, which must not be kept busy
+static void _stats_timer_cb(void *pv) {
+    xTaskNotify(s_stats_task, 1, eSetBits);
+}
+
+
+esp_err_t audio_element_stats_start(int period_ms) {
+    if (!s_stats_task && xTaskCreate(_stats_task, "ael_stats",
+                STATS_TASK_STACK, NULL, tskIDLE_PRIORITY + 1, &s_stats_task)
+            != pdPASS) {
+        ESP_LOGE(TAG, "Could not create stats task");
+        return ESP_FAIL;
+    }
+
+    if (s_stats_timer) {
+        esp_timer_stop(s_stats_timer);
+    } else {
+        const esp_timer_create_args_t args = {
+            .callback = _stats_timer_cb,
+            .name = "ael_stats",
+        };
+        if (esp_timer_create(&args, &s_stats_timer) != ESP_OK) {
+            ESP_LOGE(TAG, "Could not create stats timer");
+            return ESP_FAIL;
+        }
+    }
+
+    if (period_ms <= 0 || !s_elements_lock)
+        return ESP_OK;
+    return esp_timer_start_periodic(s_stats_timer, period_ms * 1000ULL);
+}
+
+
 // TODO: Implement this
 void audio_element_change_status(audio_element_t *el,
         audio_element_status_t status) {
@@ -246,27 +558,71 @@ void audio_element_change_status(audio_element_t *el,
 }
 
 
+// Make a new info visible to the readers of 'io' right away
+static void _info_publish(io_t *io, const audio_element_info_t *new_info) {
+    audio_element_info_shared_t *info = io->user_data;
+    unsigned int gen;
+
+    // The writers take turns, and no task can preempt one while gen is odd,
+    // so a reader never spins on a writer that is not running
+    portENTER_CRITICAL(&s_info_lock);
+    gen = atomic_load_explicit(&info->gen, memory_order_relaxed);
+    atomic_store_explicit(&info->gen, gen + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    atomic_store_explicit(&info->sample_rate, new_info->sample_rate,
+            memory_order_relaxed);
+    atomic_store_explicit(&info->channels, new_info->channels,
+            memory_order_relaxed);
+    atomic_store_explicit(&info->bits, new_info->bits, memory_order_relaxed);
+
+    // Even again, publishes the new values
+    atomic_store_explicit(&info->gen, gen + 2, memory_order_release);
+    portEXIT_CRITICAL(&s_info_lock);
+}
+
+
+// The reader of 'io' got to the position of a new info
+static void _info_marker(io_t *io, const void *data) {
+    _info_publish(io, data);
+}
+
+
 void audio_element_set_info(io_t *io, audio_element_info_t new_info) {
     ESP_LOGD(TAG, "Setting a new info");
-    audio_element_info_t *info = io->user_data;
-
-    xSemaphoreTake(info->lock, portMAX_DELAY);
-    info->sample_rate = new_info.sample_rate;
-    info->channels = new_info.changed;
-    info->bits = new_info.bits;
-    info->changed = true;
-    xSemaphoreGive(info->lock);
+
+    // The data already in the io_t keeps the old info, the new one applies
+    // from the current write position on. Without byte positions (or with
+    // too many changes pending) it applies right away.
+    esp_err_t ret = io_mark(io, &new_info, sizeof(new_info));
+    if (ret != ESP_OK) {
+        if (ret == ESP_ERR_NO_MEM)
+            ESP_LOGW(TAG, "Too many info changes pending, applying now");
+        _info_publish(io, &new_info);
+    }
 }
 
 
 audio_element_info_t audio_element_get_info(io_t *io) {
     ESP_LOGD(TAG, "Getting info from io_t");
-    audio_element_info_t *info = io->user_data;
+    audio_element_info_shared_t *info = io->user_data;
     audio_element_info_t out_info;
-
-    xSemaphoreTake(info->lock, portMAX_DELAY);
-    memcpy(&out_info, info, sizeof(audio_element_info_t));
-    xSemaphoreGive(info->lock);
-
+    unsigned int gen;
+
+    // Retry if a writer got in between, on another core: it is done in a
+    // few stores
+    do {
+        gen = atomic_load_explicit(&info->gen, memory_order_acquire);
+        out_info.sample_rate = atomic_load_explicit(&info->sample_rate,
+                memory_order_relaxed);
+        out_info.channels = atomic_load_explicit(&info->channels,
+                memory_order_relaxed);
+        out_info.bits = atomic_load_explicit(&info->bits,
+                memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((gen & 1)
+            || gen != atomic_load_explicit(&info->gen, memory_order_relaxed));
+
+    out_info.gen = gen;
     return out_info;
 }
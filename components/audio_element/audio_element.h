@@ -10,16 +10,26 @@
 
 #include "io.h"
 
+#include <stdatomic.h>
+
 #include "esp_err.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "freertos/ringbuf.h"
 
-#define MAX_RING_BUFFERS 8
+#define MAX_RING_BUFFERS 8  // Max io_t's with an info struct, all elements
+#define AEL_MAX_ELEMENTS 8
 
 typedef struct audio_element audio_element_t;
 
+// Task notification bits, next to IO_BIT_DATA and IO_BIT_SPACE
+enum notification_bit {
+    AEL_BIT_STATUS_CHANGED = 1,  // Set but unused for now
+    AEL_BIT_OPENED = 2,          // Element was opened
+    AEL_BIT_EVENT = 4,           // Element specific event (e.g. bt callback)
+};
+
 typedef enum {
     AEL_STREAM_NONE,    // Task does no fancy things (e.g. throughput / buffer)
     AEL_STREAM_READER,  // Task reads data from source, and writes to rb
@@ -45,10 +55,12 @@ typedef size_t (*el_stream_cb)(audio_element_t*, char*, size_t);
  * This struct is passed through the chain from input stream to output stream,
  * except with a AEL that modifies specific fields. Such a AEL stores the 
  * previous info struct, and passes a new one.
+ *
+ * This is a snapshot, see audio_element_get_info. `gen` is the generation
+ * of the info it was taken from.
  */
 typedef struct audio_element_info {
-    xSemaphoreHandle lock;
-    bool    changed;
+    uint32_t gen;
     int     sample_rate;
     int     channels;
     int     bits;  // bits per sample
@@ -60,6 +72,19 @@ typedef struct audio_element_info {
     /* char    *uri; */
 } audio_element_info_t;
 
+/**
+ * The info of an io_t as stored in its user_data, shared by its writer and
+ * reader(s). Read without locks: `gen` is odd while an update is in
+ * progress, and is incremented by two for every update. Updates are made
+ * in a critical section, so `gen` is odd for a few stores only.
+ */
+typedef struct audio_element_info_shared {
+    atomic_uint gen;
+    atomic_int  sample_rate;
+    atomic_int  channels;
+    atomic_int  bits;
+} audio_element_info_shared_t;
+
 #define DEFAULT_AUDIO_ELEMENT_INFO() {  \
     .sample_rate = 44100,               \
     .channels = 2,                      \
@@ -81,9 +106,13 @@ typedef struct audio_element_cfg {
     audio_element_info_t *info;     // optional; set by link func
 
     int             out_rb_size;    // optional; set by user
-    int             buf_len;        // optional; set by user
+    io_backend_t    out_rb_backend; // optional; IO_BACKEND_RINGBUF default
+    int             buf_len;        // optional; max bytes per process call
+    bool            out_external;   // optional; output written outside the
+                                    // element, e.g. by a callback
 
-    int             task_stack;     // optional (0 if no thread needed)
+    int             task_stack;     // optional (0 if no thread needed, or
+                                    // when run inline by a pipeline)
 
     char            *tag;
 } audio_element_cfg_t;
@@ -97,6 +126,45 @@ typedef struct audio_element_cfg {
 }
 #define DEFAULT_OUT_RB_SIZE 2048
 
+#define AEL_STATS_HIST_BUCKETS 16  // Bucket n holds [2^n, 2^(n+1)) us
+
+/**
+ * Raw counters, updated by the task running the element
+ */
+typedef struct audio_element_counters {
+    uint32_t    process_count;
+    uint64_t    process_time_total;     // us
+    uint32_t    process_time_min;
+    uint32_t    process_time_max;
+    uint32_t    process_time_hist[AEL_STATS_HIST_BUCKETS];
+    uint32_t    bytes_processed;        // Sum of positive process results
+    int64_t     start_time;             // When the element was made, us
+} audio_element_counters_t;
+
+/**
+ * Statistics of an element, see audio_element_get_stats
+ */
+typedef struct audio_element_stats {
+    uint32_t    process_count;
+    uint32_t    process_time_min;   // Duration of a process call, in us
+    uint32_t    process_time_avg;
+    uint32_t    process_time_p99;   // Upper bound of the histogram bucket
+    uint32_t    process_time_max;
+    uint32_t    bytes_in;           // Totals wrap around at 4 GiB
+    uint32_t    bytes_out;
+    uint32_t    rate_in;            // Bytes/s, see audio_element_get_stats
+    uint32_t    rate_out;
+    uint32_t    underruns;          // Reads that found the input(s) empty
+    uint32_t    overruns;           // Writes that found the output full
+    size_t      in_fill;            // Bytes waiting in the input(s)
+    size_t      out_fill;           // Bytes waiting in the output
+    size_t      out_size;           // Size of the output ring, 0 if none
+    uint32_t    stack_free;         // Min free stack of the task, ever
+    uint32_t    heap_free;          // Free heap, system wide
+    uint32_t    heap_min_free;      // Min free heap, system wide, ever
+    int64_t     time;               // When taken, us
+} audio_element_stats_t;
+
 /**
  * Audio element, used for anything having to do with audio data
  */
@@ -110,20 +178,29 @@ struct audio_element {
     // Input/Output ringbuffer/callback function
     io_t            *input;
     io_t            *output;
+    bool            out_external;   // Output not written by the element task
+    io_t            **inputs;       // Extra inputs, e.g. used by the mixer
+    size_t          input_count;
+    SemaphoreHandle_t inputs_lock;  // Held while 'inputs' change, or NULL
+    uint32_t        input_gen;      // Info generation of the input, as seen
 
     // Task information
     char            *tag;
     TaskHandle_t    task_handle;
     bool            task_running;
+    bool            is_inline;      // Processed by a pipeline task
     QueueHandle_t   msg_queue;
     audio_element_status_t status;
 
     bool            is_open;
 
     // Data stored
-    char            *buf;
-    int             buf_len;
+    int             buf_len;        // Max bytes handled per process call
     void            *data;
+
+    audio_element_counters_t counters;
+    audio_element_stats_t stats_prev; // Of the previous periodic dump
+    audio_element_t *next;          // List of all elements, for the stats
 };
 
 
@@ -138,6 +215,62 @@ struct audio_element {
  */
 audio_element_t *audio_element_init(audio_element_cfg_t *config);
 
+/**
+ * Run the process callback of an element once, if it is open.
+ *
+ * This is what the element task does in a loop. Elements without their own
+ * task (e.g. run by a pipeline) are driven through this function.
+ *
+ * @param el    Pointer to audio element
+ *
+ * @return
+ *      - Return value of the process callback
+ *      - 0 if the element is not open
+ */
+int audio_element_run(audio_element_t *el);
+
+/**
+ * Set the task that processes the element. Its io_t's are made nonblocking
+ * and will notify this task when data or space becomes available.
+ *
+ * Called by the element task and the pipeline task, on themselves.
+ *
+ * @param el    Pointer to audio element
+ * @param task  Handle of the task running the element
+ */
+void audio_element_attach(audio_element_t *el, TaskHandle_t task);
+
+/**
+ * Start the task of an element, for one set up with `task_stack` = 0 that
+ * needs its own task after all. audio_element_init does this itself when
+ * `task_stack` > 0. Once the task runs, the element is the task's.
+ *
+ * @param el            Pointer to audio element
+ * @param task_stack    Stack size of the task
+ *
+ * @return
+ *      - ESP_OK if successful
+ *      - ESP_ERR_NO_MEM if the task could not be created
+ */
+esp_err_t audio_element_start_task(audio_element_t *el, int task_stack);
+
+/**
+ * Close and destroy an element. Only to be used for elements without their
+ * own task, those do this themselves when stopped.
+ *
+ * @param el    Pointer to audio element
+ */
+void audio_element_deinit(audio_element_t *el);
+
+/**
+ * Check whether an element reads from a given io_t, either through its
+ * input or through one of its extra inputs.
+ *
+ * @param el    Pointer to audio element
+ * @param io    Pointer to io_t
+ */
+bool audio_element_reads_from(audio_element_t *el, io_t *io);
+
 /**
  * Helper function to link an AEL to a new AEL by setting its config.
  *
@@ -158,6 +291,21 @@ void audio_element_cfg_link(audio_element_t *from, audio_element_cfg_t *to);
 void audio_element_cfg_clear(audio_element_cfg_t *cfg);
 
 
+/**
+ * Open an element and wake up its task.
+ *
+ * Use this instead of calling el->open directly, an element task that is
+ * not open sleeps until it is notified.
+ *
+ * @param el    Pointer to audio element
+ * @param pv    Passed to the open callback (e.g. uri or device name)
+ *
+ * @return
+ *      - Return value of the open callback
+ */
+esp_err_t audio_element_open(audio_element_t *el, void *pv);
+
+
 /**
  * Send notification to the task
  *
@@ -171,11 +319,74 @@ void audio_element_cfg_clear(audio_element_cfg_t *cfg);
 esp_err_t audio_element_notify(audio_element_t *el, int bits);
 
 
+/**
+ * Get the statistics of an element. Can be called from any task.
+ *
+ * The rates are calculated over the time since `prev`, or since the element
+ * was made if it is NULL. Callers keep their own snapshots, so they never
+ * disturb each other's rates.
+ *
+ * @param el    Pointer to audio element
+ * @param stats Filled with the statistics
+ * @param prev  An earlier snapshot of the same element, or NULL
+ */
+void audio_element_get_stats(audio_element_t *el,
+        audio_element_stats_t *stats, const audio_element_stats_t *prev);
+
+/**
+ * Log the statistics of an element, with the rates since it was made
+ *
+ * @param el    Pointer to audio element
+ */
+void audio_element_dump_stats(audio_element_t *el);
+
+/**
+ * Periodically log the statistics of all elements, the latencies of the
+ * path traced with io_trace_start, if any, and the usage of the pools. The
+ * rates are those since the previous dump. The logging is done by a task of
+ * low priority, the timer only wakes it.
+ *
+ * @param period_ms Time between two dumps, 0 to stop
+ *
+ * @return
+ *      - ESP_OK if succesful
+ *      - ESP_FAIL otherwise
+ */
+esp_err_t audio_element_stats_start(int period_ms);
+
+
 void audio_element_change_status(audio_element_t *el,
         audio_element_status_t status);
 
+/**
+ * Publish a new info for the data in an io_t. Never blocks, the readers
+ * pick it up with their next audio_element_info_changed check.
+ *
+ * @param io        Pointer to io_t created by an element
+ * @param new_info  New info, its `gen` is ignored
+ */
 void audio_element_set_info(io_t *io, audio_element_info_t new_info);
 
+/**
+ * Take a consistent snapshot of the info of an io_t
+ *
+ * @param io        Pointer to io_t created by an element
+ *
+ * @return
+ *      - Snapshot, keep its `gen` for audio_element_info_changed
+ */
 audio_element_info_t audio_element_get_info(io_t *io);
 
+/**
+ * Check whether the info of an io_t changed since a snapshot was taken.
+ * Cheap enough to call for every block of data, it is a single atomic load.
+ *
+ * @param io        Pointer to io_t created by an element
+ * @param gen       `gen` of the last snapshot
+ */
+static inline bool audio_element_info_changed(io_t *io, uint32_t gen) {
+    audio_element_info_shared_t *info = io->user_data;
+    return atomic_load_explicit(&info->gen, memory_order_relaxed) != gen;
+}
+
 #endif
@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bcast_ring.h"
+
+
+static inline size_t _min(size_t a, size_t b) {
+    return a < b ? a : b;
+}
+
+static inline bool _active(bcast_reader_t *rd) {
+    return atomic_load_explicit(&rd->state, memory_order_acquire)
+        == BCAST_READER_ACTIVE;
+}
+
+// Split 'len' bytes starting at (masked) index 'pos' into two regions
+static void _regions(bcast_ring_t *ring, size_t pos, size_t len,
+        spsc_region_t regions[2]) {
+    size_t first = _min(len, ring->size - pos);
+
+    regions[0].data = ring->buf + pos;
+    regions[0].len = first;
+    regions[1].data = ring->buf;
+    regions[1].len = len - first;
+}
+
+// Free space as seen by a single reader
+static inline size_t _free(bcast_ring_t *ring, bcast_reader_t *rd,
+        size_t head) {
+    size_t tail = atomic_load_explicit(&rd->tail, memory_order_acquire);
+    return ring->size - (head - tail);
+}
+
+bcast_ring_t *bcast_ring_create(size_t size) {
+    size_t pow2 = 1;
+    while (pow2 < size)
+        pow2 <<= 1;
+
+    bcast_ring_t *ring = calloc(1, sizeof(bcast_ring_t));
+    if (!ring)
+        return NULL;
+
+    ring->buf = malloc(pow2);
+    if (!ring->buf) {
+        free(ring);
+        return NULL;
+    }
+    ring->size = pow2;
+    ring->mask = pow2 - 1;
+    atomic_init(&ring->head, 0);
+    for (int i = 0; i < BCAST_MAX_READERS; i++) {
+        atomic_init(&ring->readers[i].tail, 0);
+        atomic_init(&ring->readers[i].state, BCAST_READER_FREE);
+        atomic_init(&ring->readers[i].dropped, 0);
+    }
+
+    return ring;
+}
+
+void bcast_ring_destroy(bcast_ring_t *ring) {
+    free(ring->buf);
+    free(ring);
+}
+
+int bcast_ring_add_reader(bcast_ring_t *ring, bcast_lag_t policy,
+        void *user_data) {
+    for (int i = 0; i < BCAST_MAX_READERS; i++) {
+        bcast_reader_t *rd = &ring->readers[i];
+        int state = BCAST_READER_FREE;
+
+        // Claim the slot, it is only seen by the producer once active
+        if (!atomic_compare_exchange_strong(&rd->state, &state,
+                    BCAST_READER_DISCONNECTED))
+            continue;
+
+        rd->policy = policy;
+        rd->user_data = user_data;
+        bcast_ring_reconnect(ring, i);
+        return i;
+    }
+    return -1;
+}
+
+void bcast_ring_remove_reader(bcast_ring_t *ring, int reader) {
+    bcast_reader_t *rd = &ring->readers[reader];
+
+    atomic_store_explicit(&rd->state, BCAST_READER_DISCONNECTED,
+            memory_order_release);
+    rd->user_data = NULL;
+    atomic_store_explicit(&rd->state, BCAST_READER_FREE,
+            memory_order_release);
+}
+
+void bcast_ring_reconnect(bcast_ring_t *ring, int reader) {
+    bcast_reader_t *rd = &ring->readers[reader];
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    atomic_store_explicit(&rd->tail, head, memory_order_relaxed);
+    atomic_store_explicit(&rd->state, BCAST_READER_ACTIVE,
+            memory_order_release);
+}
+
+bool bcast_ring_connected(bcast_ring_t *ring, int reader) {
+    return _active(&ring->readers[reader]);
+}
+
+size_t bcast_ring_fill(bcast_ring_t *ring, int reader) {
+    bcast_reader_t *rd = &ring->readers[reader];
+    if (!_active(rd))
+        return 0;
+
+    // Tail first, head can only have moved further by the time it is loaded.
+    // The tail may be skipped ahead meanwhile, never report more than fits.
+    size_t tail = atomic_load_explicit(&rd->tail, memory_order_acquire);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    return _min(head - tail, ring->size);
+}
+
+size_t bcast_ring_space(bcast_ring_t *ring) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t space = ring->size;
+
+    for (int i = 0; i < BCAST_MAX_READERS; i++) {
+        bcast_reader_t *rd = &ring->readers[i];
+        if (_active(rd) && rd->policy == BCAST_LAG_BLOCK)
+            space = _min(space, _free(ring, rd, head));
+    }
+    return space;
+}
+
+size_t bcast_ring_write_regions(bcast_ring_t *ring, spsc_region_t regions[2],
+        size_t len) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    bcast_reader_t *rd;
+    size_t tail, min_tail;
+    int i;
+
+    // Blocking readers limit what can be written
+    len = _min(len, bcast_ring_space(ring));
+    min_tail = head + len - ring->size;
+
+    // Get the others out of the way of those 'len' bytes
+    for (i = 0; i < BCAST_MAX_READERS; i++) {
+        rd = &ring->readers[i];
+        if (!_active(rd) || rd->policy == BCAST_LAG_BLOCK)
+            continue;
+
+        tail = atomic_load_explicit(&rd->tail, memory_order_acquire);
+        while ((ptrdiff_t)(min_tail - tail) > 0) {
+            if (rd->policy == BCAST_LAG_DISCONNECT) {
+                atomic_store_explicit(&rd->state, BCAST_READER_DISCONNECTED,
+                        memory_order_release);
+                break;
+            }
+            // Races with the reader releasing, retry with its new tail
+            if (atomic_compare_exchange_weak_explicit(&rd->tail, &tail,
+                        min_tail, memory_order_acq_rel,
+                        memory_order_acquire)) {
+                atomic_fetch_add_explicit(&rd->dropped, min_tail - tail,
+                        memory_order_relaxed);
+                break;
+            }
+        }
+    }
+
+    _regions(ring, head & ring->mask, len, regions);
+    return len;
+}
+
+void bcast_ring_commit(bcast_ring_t *ring, size_t len) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + len, memory_order_release);
+}
+
+size_t bcast_ring_read_regions(bcast_ring_t *ring, int reader,
+        spsc_region_t regions[2]) {
+    bcast_reader_t *rd = &ring->readers[reader];
+    size_t head, fill;
+
+    if (!_active(rd))
+        return 0;
+
+    rd->pos = atomic_load_explicit(&rd->tail, memory_order_acquire);
+    head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    fill = _min(head - rd->pos, ring->size);
+
+    _regions(ring, rd->pos & ring->mask, fill, regions);
+    return fill;
+}
+
+bool bcast_ring_release(bcast_ring_t *ring, int reader, size_t len) {
+    bcast_reader_t *rd = &ring->readers[reader];
+    size_t tail = rd->pos;
+
+    // Fails if the producer skipped this reader ahead meanwhile
+    if (!atomic_compare_exchange_strong_explicit(&rd->tail, &tail,
+                tail + len, memory_order_release, memory_order_relaxed))
+        return false;
+    rd->pos += len;
+    return true;
+}
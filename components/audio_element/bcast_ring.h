@@ -0,0 +1,163 @@
+/**
+ * Lock-free broadcast byte ring: one producer, up to BCAST_MAX_READERS
+ * consumers, each with their own read cursor.
+ *
+ * All readers see the same bytes, the data is stored only once. Space is
+ * only freed when every reader is done with it, so by default the slowest
+ * reader paces the producer. What happens to a reader that falls behind is
+ * set per reader:
+ *  - BCAST_LAG_BLOCK: the producer waits for it
+ *  - BCAST_LAG_DROP: its oldest unread bytes are skipped
+ *  - BCAST_LAG_DISCONNECT: it is disconnected until bcast_ring_reconnect
+ *
+ * A reader that is skipped or disconnected while it holds a region may see
+ * that region being overwritten. This only happens to a reader that was
+ * already too late, and its release is then ignored.
+ *
+ * Like spsc_ring, this only depends on C11 atomics.
+ */
+
+#ifndef BCAST_RING_H
+#define BCAST_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "spsc_ring.h"
+
+#define BCAST_MAX_READERS 4
+
+typedef enum {
+    BCAST_LAG_BLOCK,
+    BCAST_LAG_DROP,
+    BCAST_LAG_DISCONNECT,
+} bcast_lag_t;
+
+typedef enum {
+    BCAST_READER_FREE,
+    BCAST_READER_ACTIVE,
+    BCAST_READER_DISCONNECTED,
+} bcast_reader_state_t;
+
+typedef struct {
+    atomic_size_t   tail;       // Moved by the reader, and by the producer
+                                // when it skips bytes for this reader
+    atomic_int      state;      // bcast_reader_state_t
+    bcast_lag_t     policy;
+    atomic_uint     dropped;    // Bytes skipped, wraps around
+    size_t          pos;        // Reader only: tail as last read
+    void            *user_data;
+} bcast_reader_t;
+
+typedef struct {
+    char            *buf;
+    size_t          size;   // Power of two
+    size_t          mask;
+    atomic_size_t   head;   // Written by the producer only
+    bcast_reader_t  readers[BCAST_MAX_READERS];
+} bcast_ring_t;
+
+
+/**
+ * Create a new ring without readers. The size is rounded up to the next
+ * power of two.
+ *
+ * @param size Minimal size of the ring in bytes
+ *
+ * @return
+ *      - bcast_ring_t pointer
+ *      - NULL if out of memory
+ */
+bcast_ring_t *bcast_ring_create(size_t size);
+
+/**
+ * Destroy and free a ring
+ *
+ * @param ring Pointer to ring
+ */
+void bcast_ring_destroy(bcast_ring_t *ring);
+
+/**
+ * Add a reader. It starts reading at the current write position.
+ *
+ * @param ring Pointer to ring
+ * @param policy What to do when this reader falls behind
+ * @param user_data Stored in the reader, e.g. to notify it
+ *
+ * @return
+ *      - Index of the reader
+ *      - -1 if there are already BCAST_MAX_READERS readers
+ */
+int bcast_ring_add_reader(bcast_ring_t *ring, bcast_lag_t policy,
+        void *user_data);
+
+/**
+ * Remove a reader, its slot can be used by a new reader afterwards
+ */
+void bcast_ring_remove_reader(bcast_ring_t *ring, int reader);
+
+/**
+ * Reader: reconnect a disconnected reader at the current write position.
+ * Has to be called by the reader itself, or while it is not reading.
+ */
+void bcast_ring_reconnect(bcast_ring_t *ring, int reader);
+
+/**
+ * Reader: whether the reader is connected
+ */
+bool bcast_ring_connected(bcast_ring_t *ring, int reader);
+
+/**
+ * Number of bytes that can be read by a reader, 0 if disconnected
+ */
+size_t bcast_ring_fill(bcast_ring_t *ring, int reader);
+
+/**
+ * Number of bytes that can be written without skipping any bytes of, or
+ * disconnecting, a lagging reader. Only BCAST_LAG_BLOCK readers limit the
+ * space returned.
+ */
+size_t bcast_ring_space(bcast_ring_t *ring);
+
+/**
+ * Producer: get up to `len` bytes of free space as two regions.
+ *
+ * Readers that are not BCAST_LAG_BLOCK and are in the way of these `len`
+ * bytes are skipped ahead or disconnected.
+ *
+ * @param ring Pointer to ring
+ * @param regions Filled with the free regions
+ * @param len Number of bytes the producer is going to write
+ *
+ * @return Total number of bytes in the regions, at most `len`
+ */
+size_t bcast_ring_write_regions(bcast_ring_t *ring, spsc_region_t regions[2],
+        size_t len);
+
+/**
+ * Producer: publish `len` bytes written to the regions
+ */
+void bcast_ring_commit(bcast_ring_t *ring, size_t len);
+
+/**
+ * Reader: get the bytes it has not read yet as two regions.
+ *
+ * @return Total number of readable bytes, 0 if disconnected
+ */
+size_t bcast_ring_read_regions(bcast_ring_t *ring, int reader,
+        spsc_region_t regions[2]);
+
+/**
+ * Reader: mark `len` bytes of the regions as read. May be called more than
+ * once per bcast_ring_read_regions.
+ *
+ * @return
+ *      - true if successful
+ *      - false if the reader was skipped ahead or reconnected since it got
+ *        the regions, they are stale then
+ */
+bool bcast_ring_release(bcast_ring_t *ring, int reader, size_t len);
+
+#endif
@@ -0,0 +1,398 @@
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+
+#include "bitdepth.h"
+#include "audio_element.h"
+#include "block_conv.h"
+#include "io.h"
+#include "mix.h"
+
+#include <string.h>
+
+#include "esp_log.h"
+
+static const char TAG[] = "BITDEPTH";
+
+enum {
+    FMT_U8,
+    FMT_S16,
+    FMT_S24,
+    FMT_S24P,
+    FMT_S32,
+    FMT_COUNT
+};
+
+typedef struct bitdepth bitdepth_t;
+
+// Requantize 'n' samples at 32 bit scale, the state is in 'bd'
+typedef void (*bitdepth_fn)(void *dst, const int32_t *src, size_t n,
+        bitdepth_t *bd);
+
+struct bitdepth {
+    bitdepth_cfg_t cfg;
+    audio_element_info_t info;      // Of the input
+    bool     configured;            // For the format in 'info'
+    bool     bypass;                // Input in the output format already
+    int      in_fmt;
+    int      out_fmt;
+    size_t   in_bytes;              // Per sample
+    size_t   out_bytes;
+    bitdepth_fn requantize;
+
+    // Requantizer state, carried over between blocks
+    int      channels;
+    int      chan;                  // Of the next sample
+    uint32_t seed;                  // Of the dither
+    int32_t  e1[BITDEPTH_MAX_CHANNELS];     // Last error, 32 bit scale
+    int32_t  e2[BITDEPTH_MAX_CHANNELS];     // The one before
+
+    // A sample split by the wrap of a ring, see _bitdepth_load
+    uint8_t  carry[4];
+    size_t   carry_len;
+
+    int32_t  buf[BITDEPTH_BUF_LEN];
+};
+
+
+static int _format(int bits, bool packed) {
+    switch (bits) {
+        case 8:     return FMT_U8;
+        case 16:    return FMT_S16;
+        case 24:    return packed ? FMT_S24P : FMT_S24;
+        case 32:    return FMT_S32;
+        default:    return -1;
+    }
+}
+
+static const size_t s_bytes[FMT_COUNT] = { 1, 2, 4, 3, 4 };
+static const int s_depth[FMT_COUNT] = { 8, 16, 24, 24, 32 };
+
+
+// Bits dropped from the 32 bit scale, and half of the output's LSB there
+#define SHIFT_u8    24
+#define SHIFT_s16   16
+#define SHIFT_s24   8
+#define SHIFT_s24p  8
+#define SHIFT_s32   0
+#define HALF(out)   (SHIFT_##out ? 1ll << (SHIFT_##out - 1) : 0)
+
+#define STORE_u8(d, i, q)   ((uint8_t *)(d))[i] =                          \
+        _clamp(q, INT8_MIN, INT8_MAX) + 128
+#define STORE_s16(d, i, q)  ((int16_t *)(d))[i] =                          \
+        _clamp(q, INT16_MIN, INT16_MAX)
+#define STORE_s24(d, i, q)  ((int32_t *)(d))[i] =                          \
+        _clamp(q, -(1 << 23), (1 << 23) - 1)
+#define STORE_s24p(d, i, q) _st_s24p((uint8_t *)(d) + (i) * 3,              \
+        _clamp(q, -(1 << 23), (1 << 23) - 1))
+#define STORE_s32(d, i, q)  ((int32_t *)(d))[i] = (q)
+
+// TPDF: the sum of two uniform values of +-LSB / 2, from an LCG. Its high
+// bits are good enough for dither.
+#define DITHER_off(seed, shift) 0
+#define DITHER_on(seed, shift)  (_uniform(&(seed), shift)                   \
+        + _uniform(&(seed), shift))
+
+// The error feedback, and its update. The noise transfer function is
+// 1 - z^-1 (first) or 1 - 2z^-1 + z^-2 (second order).
+#define FEEDBACK_none(bd, c)    0
+#define FEEDBACK_first(bd, c)   (int64_t)(bd)->e1[c]
+#define FEEDBACK_second(bd, c)  (2 * (int64_t)(bd)->e1[c] - (bd)->e2[c])
+#define SHAPE_none(bd, c, e)
+#define SHAPE_first(bd, c, e)   (bd)->e1[c] = (e)
+#define SHAPE_second(bd, c, e)  ((bd)->e2[c] = (bd)->e1[c], (bd)->e1[c] = (e))
+
+static inline int32_t _clamp(int64_t x, int32_t lo, int32_t hi) {
+    return x < lo ? lo : x > hi ? hi : x;
+}
+
+static inline void _st_s24p(uint8_t *p, int32_t x) {
+    p[0] = x;
+    p[1] = x >> 8;
+    p[2] = x >> 16;
+}
+
+static inline int64_t _uniform(uint32_t *seed, int shift) {
+    *seed = *seed * 1664525u + 1013904223u;
+    return (int32_t)*seed >> (32 - shift);
+}
+
+/**
+ * The error of a sample is what the output differs from its input, after
+ * the feedback of earlier errors. It is fed back unclamped: what clipping
+ * takes off is no quantization noise, and must not build up.
+ */
+#define REQUANTIZE_KERNEL(out, shape, dither)                               \
+static void _requantize_##out##_##shape##_##dither(void *dst,                \
+        const int32_t *src, size_t n, bitdepth_t *bd) {                     \
+    uint32_t seed = bd->seed;                                               \
+    int c = bd->chan;                                                       \
+    for (size_t i = 0; i < n; i++) {                                        \
+        int64_t w = src[i] - FEEDBACK_##shape(bd, c);                       \
+        int64_t q = (w + DITHER_##dither(seed, SHIFT_##out) + HALF(out))    \
+            >> SHIFT_##out;                                                 \
+        SHAPE_##shape(bd, c, (int32_t)(q * (1ll << SHIFT_##out) - w));      \
+        STORE_##out(dst, i, q);                                             \
+        if (++c == bd->channels)                                            \
+            c = 0;                                                          \
+    }                                                                       \
+    bd->seed = seed;                                                        \
+    bd->chan = c;                                                           \
+}
+
+#define REQUANTIZE_KERNELS(out)                                             \
+    REQUANTIZE_KERNEL(out, none, off)                                       \
+    REQUANTIZE_KERNEL(out, none, on)                                        \
+    REQUANTIZE_KERNEL(out, first, off)                                      \
+    REQUANTIZE_KERNEL(out, first, on)                                       \
+    REQUANTIZE_KERNEL(out, second, off)                                     \
+    REQUANTIZE_KERNEL(out, second, on)
+
+REQUANTIZE_KERNELS(u8)
+REQUANTIZE_KERNELS(s16)
+REQUANTIZE_KERNELS(s24)
+REQUANTIZE_KERNELS(s24p)
+
+// 32 bits out is never less than in, a copy
+static void _requantize_s32(void *dst, const int32_t *src, size_t n,
+        bitdepth_t *bd) {
+    memcpy(dst, src, n * sizeof(int32_t));
+    bd->chan = (bd->chan + n) % bd->channels;
+}
+
+#define REQUANTIZE_ROW(out) {                                               \
+    { _requantize_##out##_none_off, _requantize_##out##_none_on },          \
+    { _requantize_##out##_first_off, _requantize_##out##_first_on },        \
+    { _requantize_##out##_second_off, _requantize_##out##_second_on },      \
+}
+
+// [output][shaping][dither]
+static const bitdepth_fn s_requantize[FMT_COUNT][3][2] = {
+    [FMT_U8] =      REQUANTIZE_ROW(u8),
+    [FMT_S16] =     REQUANTIZE_ROW(s16),
+    [FMT_S24] =     REQUANTIZE_ROW(s24),
+    [FMT_S24P] =    REQUANTIZE_ROW(s24p),
+    [FMT_S32] = {
+        { _requantize_s32, _requantize_s32 },
+        { _requantize_s32, _requantize_s32 },
+        { _requantize_s32, _requantize_s32 },
+    },
+};
+
+
+// 'n' input samples to 32 bit scale, added to the zeroed 'acc'
+static void _bitdepth_convert(bitdepth_t *bd, int32_t *acc, const void *src,
+        size_t n) {
+    const uint8_t *p = src;
+
+    if (bd->in_fmt != FMT_S24P) {
+        mix_add(acc, src, n, bd->info.bits, 32, MIX_UNITY, MIX_UNITY);
+        return;
+    }
+    for (size_t i = 0; i < n; i++, p += 3) {
+        acc[i] = (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16
+                | (uint32_t)p[2] << 24);
+    }
+}
+
+
+// Set up the kernel for a new input format, and tell the next element
+static void _bitdepth_format(audio_element_t *el) {
+    bitdepth_t *bd = el->data;
+    audio_element_info_t out_info;
+    int shaping;
+    bool reduce;
+
+    bd->info = audio_element_get_info(el->input);
+    el->input_gen = bd->info.gen;
+    bd->configured = true;
+    out_info = bd->info;
+    out_info.bits = bd->cfg.bits;
+
+    bd->in_fmt = _format(bd->info.bits, bd->cfg.in_packed);
+    bd->bypass = bd->in_fmt == bd->out_fmt;
+    if (bd->in_fmt < 0 || bd->info.channels < 1
+            || bd->info.channels > BITDEPTH_MAX_CHANNELS) {
+        ESP_LOGW(TAG, "[%s] Cannot convert %d bits, %d channels, passing it "
+                "on as is", el->tag, bd->info.bits, bd->info.channels);
+        bd->bypass = true;
+        out_info.bits = bd->info.bits;
+    }
+
+    if (!bd->bypass) {
+        // Only dither and shape what loses bits
+        reduce = s_depth[bd->in_fmt] > s_depth[bd->out_fmt];
+        shaping = reduce ? bd->cfg.shaping : BITDEPTH_SHAPE_NONE;
+        bd->requantize = s_requantize[bd->out_fmt][shaping]
+            [reduce && bd->cfg.dither];
+        bd->in_bytes = s_bytes[bd->in_fmt];
+        bd->channels = bd->info.channels;
+        bd->chan = 0;
+        bd->carry_len = 0;
+        memset(bd->e1, 0, sizeof(bd->e1));
+        memset(bd->e2, 0, sizeof(bd->e2));
+        ESP_LOGI(TAG, "[%s] %d to %d bits, %d channels, dither %s, shaping "
+                "order %d", el->tag, s_depth[bd->in_fmt],
+                s_depth[bd->out_fmt], bd->channels,
+                reduce && bd->cfg.dither ? "on" : "off", shaping);
+    }
+    audio_element_set_info(el->output, out_info);
+}
+
+
+/**
+ * Read up to 'n' samples into 'bd->buf', at 32 bit scale. The wrapped part
+ * of a ring is taken too. A packed sample can be split by the wrap, its
+ * first bytes are kept in 'carry' until the rest is there.
+ *
+ * Returns the number of samples read.
+ */
+static size_t _bitdepth_load(audio_element_t *el, size_t n) {
+    bitdepth_t *bd = el->data;
+    size_t done = 0, len, whole, rest;
+    char *data;
+
+    memset(bd->buf, 0, n * sizeof(int32_t));
+    while (done < n) {
+        if (bd->carry_len) {
+            len = bd->in_bytes - bd->carry_len;
+            data = io_acquire_read(el->input, &len, el);
+            if (!data || !len)
+                break;
+            memcpy(bd->carry + bd->carry_len, data, len);
+            io_release_read(el->input, len);
+            bd->carry_len += len;
+            if (bd->carry_len < bd->in_bytes)
+                continue;
+            _bitdepth_convert(bd, bd->buf + done++, bd->carry, 1);
+            bd->carry_len = 0;
+            continue;
+        }
+
+        len = (n - done) * bd->in_bytes;
+        data = io_acquire_read(el->input, &len, el);
+        if (!data || !len)
+            break;
+        whole = len / bd->in_bytes;
+        rest = len - whole * bd->in_bytes;
+        _bitdepth_convert(bd, bd->buf + done, data, whole);
+        done += whole;
+        if (rest) {
+            memcpy(bd->carry, data + whole * bd->in_bytes, rest);
+            bd->carry_len = rest;
+        }
+        io_release_read(el->input, len);
+    }
+    return done;
+}
+
+
+static size_t _bitdepth_process(audio_element_t *el) {
+    bitdepth_t *bd = el->data;
+    size_t n, done, j = 0, len, whole, rest;
+    uint8_t split[4];
+    char *data;
+
+    // A format change queued in the input applies from here on
+    io_apply_markers(el->input);
+    if (!bd->configured
+            || audio_element_info_changed(el->input, el->input_gen))
+        _bitdepth_format(el);
+    if (bd->bypass)
+        return block_conv_bypass(el);
+
+    // Never convert more than can be written to the output right away
+    n = io_space(el->output) / bd->out_bytes;
+    if (n > BITDEPTH_BUF_LEN)
+        n = BITDEPTH_BUF_LEN;
+    if (n > el->buf_len / bd->in_bytes)
+        n = el->buf_len / bd->in_bytes;
+    if (!n)
+        return 0;
+
+    done = _bitdepth_load(el, n);
+    if (!done)
+        return 0;
+
+    // Store in place, a sample split by the wrap goes through 'split'
+    while (j < done) {
+        len = (done - j) * bd->out_bytes;
+        data = io_acquire_write(el->output, &len);
+        if (!data || !len)
+            return j ? j * bd->out_bytes : IO_WRITE_ERROR;
+
+        whole = len / bd->out_bytes;
+        rest = len - whole * bd->out_bytes;
+        bd->requantize(data, bd->buf + j, whole, bd);
+        j += whole;
+        if (rest) {
+            bd->requantize(split, bd->buf + j++, 1, bd);
+            memcpy(data + whole * bd->out_bytes, split, rest);
+        }
+        if (io_commit_write(el->output, len, el) == IO_WRITE_ERROR)
+            return IO_WRITE_ERROR;
+
+        if (rest) {
+            len = bd->out_bytes - rest;
+            data = io_acquire_write(el->output, &len);
+            if (!data || len < bd->out_bytes - rest)
+                return IO_WRITE_ERROR;
+            memcpy(data, split + rest, len);
+            if (io_commit_write(el->output, len, el) == IO_WRITE_ERROR)
+                return IO_WRITE_ERROR;
+        }
+    }
+
+    return done * bd->out_bytes;
+}
+
+
+static esp_err_t _bitdepth_open(audio_element_t *el, void* pv) {
+    ESP_LOGI(TAG, "[%s] Initialization done", el->tag);
+    el->is_open = true;
+    return ESP_OK;
+}
+
+
+static esp_err_t _bitdepth_destroy(audio_element_t *el) {
+    ESP_LOGI(TAG, "Destroying bit depth converter");
+    free(el->data);
+
+    return ESP_OK;
+}
+
+
+audio_element_t *bitdepth_init(audio_element_cfg_t cfg,
+        bitdepth_cfg_t bd_cfg) {
+    int out_fmt = _format(bd_cfg.bits, bd_cfg.packed);
+
+    if (out_fmt < 0 || bd_cfg.shaping > BITDEPTH_SHAPE_SECOND) {
+        ESP_LOGE(TAG, "Cannot convert to %d bits", bd_cfg.bits);
+        return NULL;
+    }
+
+    bitdepth_t *bd = calloc(1, sizeof(bitdepth_t));
+    if (!bd) {
+        ESP_LOGE(TAG, "Could not allocate memory!");
+        return NULL;
+    }
+    bd->cfg = bd_cfg;
+    bd->out_fmt = out_fmt;
+    bd->out_bytes = s_bytes[out_fmt];
+    bd->seed = 1;
+
+    cfg.open = _bitdepth_open;
+    cfg.destroy = _bitdepth_destroy;
+    cfg.process = _bitdepth_process;
+
+    cfg.tag = "bitdepth";
+
+    audio_element_t *el = audio_element_init(&cfg);
+    if (!el) {
+        ESP_LOGE(TAG, "[%s] could not init audio element.", cfg.tag);
+        free(bd);
+        return NULL;
+    }
+    // The format is taken from the input on the first block
+    el->data = bd;
+
+    return el;
+}
@@ -0,0 +1,82 @@
+/**
+ * Bit depth converter: converts a stream to a fixed sample format.
+ *
+ * The formats are those of mix.h (8 bit unsigned, 16, 24 in a 32 bit word
+ * and 32 bit signed), plus 24 bit packed in three bytes, as in most wav
+ * files. Stream info cannot tell the two 24 bit formats apart, packed
+ * input or output is asked for in bitdepth_cfg_t.
+ *
+ * When the depth goes down, the lost bits are not just cut off, which
+ * leaves distortion correlated with the signal. They are requantized,
+ * optionally with:
+ *
+ *  - TPDF dither: triangular noise of +-1 LSB of the output, which turns
+ *    the error into a constant, signal independent noise floor.
+ *  - Noise shaping: the error is fed back, through a first (1 - z^-1) or
+ *    second order (1 - z^-1)^2 highpass, moving the noise floor up to where
+ *    the ear is least sensitive. At 44.1 kHz, second order lowers it by
+ *    10 dB and more below 4 kHz, and raises it by 12 dB near Nyquist.
+ *
+ * Samples go through an int32_t block at 32 bit scale, with one kernel per
+ * output format and shaping order, picked once per format. E.g. mix at 24
+ * bits, and reduce to 16 for the DAC only, with:
+ *
+ *      bitdepth_cfg_t bd_cfg = DEFAULT_BITDEPTH_CFG();
+ *      bd_cfg.shaping = BITDEPTH_SHAPE_SECOND;
+ *      audio_element_t *bd = bitdepth_init(cfg, bd_cfg);
+ *
+ * An input in the output format already is passed on as is.
+ */
+
+#ifndef BITDEPTH_H
+#define BITDEPTH_H
+
+#include <stdbool.h>
+
+#include "audio_element.h"
+
+#define BITDEPTH_BUF_LEN 1024       // int32_t samples per block
+#define BITDEPTH_MAX_CHANNELS 8     // With their own shaping state
+
+typedef enum {
+    BITDEPTH_SHAPE_NONE,
+    BITDEPTH_SHAPE_FIRST,           // Error fed back through 1 - z^-1
+    BITDEPTH_SHAPE_SECOND,          // Through (1 - z^-1)^2
+} bitdepth_shape_t;
+
+typedef struct bitdepth_cfg {
+    int     bits;                   // Output format: 8, 16, 24 or 32
+    bool    packed;                 // 24 bit output in three bytes
+    bool    in_packed;              // 24 bit input is in three bytes
+    bool    dither;                 // TPDF dither when the depth goes down
+    bitdepth_shape_t shaping;       // When the depth goes down
+} bitdepth_cfg_t;
+
+#define DEFAULT_BITDEPTH_CFG() {        \
+    .bits = 16,                         \
+    .packed = false,                    \
+    .in_packed = false,                 \
+    .dither = true,                     \
+    .shaping = BITDEPTH_SHAPE_NONE,     \
+}
+
+
+/**
+ * Initialize the bit depth converter
+ *
+ * The open, process and destroy fields of `cfg` are set by the converter.
+ * `buf_len` is the max number of bytes read from the input per process
+ * call.
+ *
+ * @param cfg       A configured `audio_element_cfg_t` struct, linked to the
+ *                  element to convert
+ * @param bd_cfg    Output format, dither and noise shaping
+ *
+ * @return
+ *      - audio_element_t if successful
+ *      - NULL if the output format is not supported, or out of memory
+ */
+audio_element_t *bitdepth_init(audio_element_cfg_t cfg,
+        bitdepth_cfg_t bd_cfg);
+
+#endif
@@ -0,0 +1,173 @@
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+
+#include "block_conv.h"
+#include "audio_element.h"
+#include "io.h"
+#include "mix.h"
+
+#include <string.h>
+
+#include "esp_log.h"
+
+static const char TAG[] = "BLOCK_CONV";
+
+
+// Set up the converter for a new input format, and tell the next element
+static void _block_conv_format(audio_element_t *el) {
+    block_conv_t *bc = el->data;
+    audio_element_info_t out_info;
+
+    bc->info = audio_element_get_info(el->input);
+    el->input_gen = bc->info.gen;
+    bc->configured = true;
+    out_info = bc->info;
+
+    bc->bypass = !bc->ops->format(el, &out_info);
+    if (bc->bypass)
+        out_info = bc->info;
+    ESP_LOGI(TAG, "[%s] %d Hz to %d Hz, %d channels, %d bits", el->tag,
+            bc->info.sample_rate, out_info.sample_rate, out_info.channels,
+            out_info.bits);
+    audio_element_set_info(el->output, out_info);
+}
+
+
+size_t block_conv_bypass(audio_element_t *el) {
+    size_t len = io_space(el->output), bytes;
+    char *data;
+
+    if (len > el->buf_len)
+        len = el->buf_len;
+    if (!len)
+        return 0;
+    data = io_acquire_read(el->input, &len, el);
+    if (!data)
+        return 0;
+    bytes = el->output->write(el->output, data, len, el);
+    io_release_read(el->input, bytes == IO_WRITE_ERROR ? 0 : bytes);
+    return bytes;
+}
+
+
+static size_t _block_conv_process(audio_element_t *el) {
+    block_conv_t *bc = el->data;
+    int ch, bits;
+    size_t bytes_per_sample, frame_bytes, out_frames, need, len, used,
+           frames = 0, j, out_len;
+    char *data;
+
+    // A format change queued in the input applies from here on
+    io_apply_markers(el->input);
+    if (!bc->configured
+            || audio_element_info_changed(el->input, el->input_gen))
+        _block_conv_format(el);
+    if (bc->bypass)
+        return block_conv_bypass(el);
+
+    ch = bc->info.channels;
+    bits = bc->info.bits;
+    bytes_per_sample = mix_bytes_per_sample(bits);
+    frame_bytes = bytes_per_sample * ch;
+    if (!frame_bytes || ch > BLOCK_CONV_BUF_LEN)
+        return 0;
+    if (bc->ops->ready && !bc->ops->ready(el, frame_bytes))
+        return 0;
+
+    // Never convert more than can be written to the output right away
+    out_frames = io_space(el->output) / frame_bytes;
+    if (out_frames > BLOCK_CONV_BUF_LEN / ch)
+        out_frames = BLOCK_CONV_BUF_LEN / ch;
+
+    // A few input frames can give no output, keep reading until there is
+    // some
+    while (out_frames && !frames) {
+        need = bc->ops->frames_needed(el, out_frames);
+        if (need > BLOCK_CONV_BUF_LEN / ch)
+            need = BLOCK_CONV_BUF_LEN / ch;
+        if (need > el->buf_len / frame_bytes)
+            need = el->buf_len / frame_bytes;
+
+        data = NULL;
+        len = 0;
+        if (need) {
+            len = need * frame_bytes;
+            data = io_acquire_read(el->input, &len, el);
+            len -= len % frame_bytes;
+            if (!data || !len) {
+                if (data)
+                    io_release_read(el->input, 0);
+                if (bc->ops->converted)
+                    bc->ops->converted(el, 0, frame_bytes);
+                return 0;
+            }
+            memset(bc->in, 0, len / bytes_per_sample * sizeof(int32_t));
+            mix_add(bc->in, data, len / bytes_per_sample, bits, bits,
+                    MIX_UNITY, MIX_UNITY);
+        }
+
+        frames = bc->ops->process(el, bc->in, len / frame_bytes, &used,
+                bc->out, out_frames);
+        if (data)
+            io_release_read(el->input, used * frame_bytes);
+        if (!frames && !used)
+            return 0;
+    }
+    if (frames && bc->ops->converted)
+        bc->ops->converted(el, frames, frame_bytes);
+
+    // Store the output, in two regions if the output ring wraps
+    j = 0;
+    while (j < frames * ch) {
+        out_len = (frames * ch - j) * bytes_per_sample;
+        data = io_acquire_write(el->output, &out_len);
+        out_len -= out_len % bytes_per_sample;
+        if (!data || !out_len)
+            return j ? j * bytes_per_sample : IO_WRITE_ERROR;
+
+        mix_store(data, bc->out + j, out_len / bytes_per_sample, bits);
+        j += out_len / bytes_per_sample;
+        if (io_commit_write(el->output, out_len, el) == IO_WRITE_ERROR)
+            return IO_WRITE_ERROR;
+    }
+
+    return frames * frame_bytes;
+}
+
+
+static esp_err_t _block_conv_open(audio_element_t *el, void* pv) {
+    ESP_LOGI(TAG, "[%s] Initialization done", el->tag);
+    el->is_open = true;
+    return ESP_OK;
+}
+
+
+static esp_err_t _block_conv_destroy(audio_element_t *el) {
+    block_conv_t *bc = el->data;
+
+    ESP_LOGI(TAG, "[%s] Destroying", el->tag);
+    if (bc->ops->deinit)
+        bc->ops->deinit(el);
+    free(bc);
+
+    return ESP_OK;
+}
+
+
+audio_element_t *block_conv_init(audio_element_cfg_t *cfg,
+        const block_conv_ops_t *ops, block_conv_t *bc) {
+    bc->ops = ops;
+
+    cfg->open = _block_conv_open;
+    cfg->destroy = _block_conv_destroy;
+    cfg->process = _block_conv_process;
+
+    audio_element_t *el = audio_element_init(cfg);
+    if (!el) {
+        ESP_LOGE(TAG, "[%s] could not init audio element.", cfg->tag);
+        return NULL;
+    }
+    // The format is taken from the input on the first block
+    el->data = bc;
+
+    return el;
+}
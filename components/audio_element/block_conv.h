@@ -0,0 +1,95 @@
+/**
+ * Block converter: the element around a converter that works on int32_t
+ * frames, like the resampler (see resampler.h), the decimator (see
+ * decimator.h) and the asrc (see asrc.h).
+ *
+ * It tracks the format of the input, passes the input on as is while the
+ * converter has nothing to do, and otherwise reads the input into blocks of
+ * BLOCK_CONV_BUF_LEN int32_t samples, has them converted, and stores the
+ * output in the format of the input. Never more is converted than can be
+ * written to the output right away.
+ *
+ * The data of such an element starts with a block_conv_t, the converter
+ * keeps its own state after it.
+ */
+
+#ifndef BLOCK_CONV_H
+#define BLOCK_CONV_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "audio_element.h"
+
+#define BLOCK_CONV_BUF_LEN 1024
+
+typedef struct block_conv_ops {
+    /**
+     * Set up for a new input format. `out` holds that format, the converter
+     * changes what it changes of it. Returns false to pass the input on as
+     * is, `out` is not used then.
+     */
+    bool    (*format)(audio_element_t *el, audio_element_info_t *out);
+    // Input frames that give at most `out_frames` output frames
+    size_t  (*frames_needed)(audio_element_t *el, size_t out_frames);
+    /**
+     * Convert up to `in_frames` frames, writing at most `out_frames`. Sets
+     * `used` to the input frames taken, and returns the frames written.
+     */
+    size_t  (*process)(audio_element_t *el, const int32_t *in,
+            size_t in_frames, size_t *used, int32_t *out, size_t out_frames);
+    // Free what `format` allocated, can be NULL
+    void    (*deinit)(audio_element_t *el);
+    /**
+     * Called before each block, once the format is set up. Returns false to
+     * convert nothing this time. Can be NULL.
+     */
+    bool    (*ready)(audio_element_t *el, size_t frame_bytes);
+    /**
+     * Called with the frames of each block before they are stored, or with
+     * 0 when the input ran dry. Can be NULL.
+     */
+    void    (*converted)(audio_element_t *el, size_t frames,
+            size_t frame_bytes);
+} block_conv_ops_t;
+
+typedef struct block_conv {
+    const block_conv_ops_t *ops;
+    audio_element_info_t info;      // Of the input
+    bool     configured;            // For the format in 'info'
+    bool     bypass;                // Nothing to convert
+    int32_t  in[BLOCK_CONV_BUF_LEN];
+    int32_t  out[BLOCK_CONV_BUF_LEN];
+} block_conv_t;
+
+
+/**
+ * Initialize a block converter element
+ *
+ * The open, process and destroy fields of `cfg` are set here, `buf_len` is
+ * the max number of bytes read from the input per process call. On
+ * destroy, `ops->deinit` is called and `bc` is freed.
+ *
+ * @param cfg       A configured `audio_element_cfg_t` struct
+ * @param ops       The converter
+ * @param bc        Start of the element data, on the heap
+ *
+ * @return
+ *      - audio_element_t if successful, `bc` is its data
+ *      - NULL otherwise, `bc` is left to the caller
+ */
+audio_element_t *block_conv_init(audio_element_cfg_t *cfg,
+        const block_conv_ops_t *ops, block_conv_t *bc);
+
+/**
+ * Pass the input of an element on as is, no more than its output takes
+ * right away
+ *
+ * @param el        Pointer to audio element
+ *
+ * @return Bytes passed on, or IO_WRITE_ERROR
+ */
+size_t block_conv_bypass(audio_element_t *el);
+
+#endif
@@ -0,0 +1,304 @@
+#include "decimate.h"
+#include "fir.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+static const char TAG[] = "DECIMATE";
+
+#define Q30 (1 << 30)
+
+// End of the passband, of the output's Nyquist frequency, and stopband
+// attenuation (dB) of every quality
+static const struct {
+    double   pass;
+    double   atten;
+} s_quality[] = {
+    [POLYPHASE_LOW] =       { 0.6, 50. },
+    [POLYPHASE_MEDIUM] =    { 0.7, 70. },
+    [POLYPHASE_HIGH] =      { 0.8, 96. },
+};
+
+
+// A linear phase FIR at 'x', the center of its window
+static inline int64_t _fold(const int32_t *h, const int32_t *x, int half) {
+    int64_t acc = (int64_t)h[0] * x[0];
+    for (int k = 1; k < half; k++) {
+        acc += h[k] * ((int64_t)x[-k] + x[k]);
+    }
+    return acc;
+}
+
+// A half-band FIR at 'x': the center, and the odd taps around it
+static inline int64_t _halfband(const int32_t *h, const int32_t *x,
+        int half) {
+    int64_t acc = (int64_t)x[0] * (Q30 >> 1);
+    for (int k = 0; k < half; k++) {
+        acc += h[k] * ((int64_t)x[-2 * k - 1] + x[2 * k + 1]);
+    }
+    return acc;
+}
+
+
+/**
+ * Design the filter of a stage of 'taps' taps: a Kaiser windowed sinc, cut
+ * off at 'fc' cycles per input frame. A half-band filter cuts off at a
+ * quarter, where its taps at an even distance from the center are zero,
+ * and are left out.
+ */
+static esp_err_t _design(decimate_stage_t *st, int taps, double fc,
+        double beta) {
+    int center = taps / 2;
+    int64_t total = 0, target;
+    double sum = 0., *h;
+
+    free(st->coefs);
+    st->taps = taps;
+    st->half = st->halfband ? (taps + 1) / 4 : center + 1;
+    st->coefs = malloc(st->half * sizeof(int32_t));
+    h = malloc(st->half * sizeof(double));
+    if (!st->coefs || !h) {
+        free(h);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Tap j of a half-band filter is 2j + 1 frames from the center. The
+    // sum is of one side, and the center of any other filter.
+    for (int j = 0; j < st->half; j++) {
+        int t = st->halfband ? 2 * j + 1 : j;
+        double r = (double)t / center, x = 2. * fc * t;
+
+        h[j] = 2. * fc * (x == 0. ? 1. : sin(M_PI * x) / (M_PI * x))
+            * fir_bessel_i0(beta * sqrt(1. - r * r)) / fir_bessel_i0(beta);
+        sum += !st->halfband && j ? 2. * h[j] : h[j];
+    }
+
+    // Unity gain at DC, with a center of 1/2 for a half-band filter. The
+    // rounding error goes to the largest tap, the first.
+    target = st->halfband ? Q30 / 4 : Q30;
+    for (int j = 0; j < st->half; j++) {
+        st->coefs[j] = lrint(h[j] / sum * target);
+        total += !st->halfband && j ? 2 * (int64_t)st->coefs[j]
+            : st->coefs[j];
+    }
+    st->coefs[0] += target - total;
+    free(h);
+    return ESP_OK;
+}
+
+/**
+ * Largest gain of a stage's filter from 'stop' cycles per input frame up,
+ * on a grid of four points per tap. The cosines of the taps come from a
+ * recurrence.
+ */
+static double _stopband(const decimate_stage_t *st, double stop) {
+    int points = 4 * st->taps, t;
+    double worst = 0., w, c1, cprev, c, a;
+
+    for (int i = 0; i <= points; i++) {
+        w = 2. * M_PI * (stop + (0.5 - stop) * i / points);
+        c1 = cos(w);
+        a = st->halfband ? 0.5 : (double)st->coefs[0] / Q30;
+        cprev = 1.;
+        c = c1;
+        for (t = 1; t <= st->taps / 2; t++) {
+            if (!st->halfband)
+                a += 2. * st->coefs[t] / Q30 * c;
+            else if (t & 1)
+                a += 2. * st->coefs[t / 2] / Q30 * c;
+            w = 2. * c1 * c - cprev;
+            cprev = c;
+            c = w;
+        }
+        worst = fabs(a) > worst ? fabs(a) : worst;
+    }
+    return worst;
+}
+
+
+/**
+ * Set up a stage that keeps one of every 'factor' frames, with its
+ * passband up to 'pass' and its stopband from 'stop', in cycles per input
+ * frame. Kaiser's estimate of the length can be short for short filters,
+ * it is lengthened until the stopband holds.
+ */
+static esp_err_t _stage_init(decimate_stage_t *st, int factor, double pass,
+        double stop, double atten, int channels) {
+    double beta, fc = (pass + stop) / 2., limit = pow(10., -atten / 20.);
+    int n;
+    esp_err_t ret;
+
+    beta = fir_kaiser_beta(atten);
+    n = fir_kaiser_length(atten, stop - pass);
+
+    st->factor = factor;
+    st->halfband = factor == 2;
+    n = st->halfband ? 4 * ((n + 4) / 4) - 1 : n | 1;
+    do {
+        ret = _design(st, n, fc, beta);
+        n += st->halfband ? 4 : 2;
+    } while (ret == ESP_OK && _stopband(st, stop) > limit);
+    if (ret != ESP_OK)
+        return ret;
+
+    st->len = st->taps + DECIMATE_BLOCK;
+    st->hist = calloc(st->len * channels, sizeof(int32_t));
+    if (!st->hist)
+        return ESP_ERR_NO_MEM;
+
+    // Half a window of silence first, so the output starts with the input
+    st->fill = st->taps / 2;
+    return ESP_OK;
+}
+
+
+// Run a stage over 'in_frames' more frames, returns the frames written
+static size_t _stage_run(decimate_stage_t *st, int ch, const int32_t *in,
+        size_t in_frames, int32_t *out) {
+    int center = st->taps / 2;
+    size_t done = 0, keep;
+
+    // Split the input into a history per channel
+    for (int c = 0; c < ch; c++) {
+        int32_t *hist = st->hist + c * st->len + st->fill;
+        for (size_t i = 0; i < in_frames; i++) {
+            hist[i] = in[i * ch + c];
+        }
+    }
+    st->fill += in_frames;
+
+    while (st->pos + st->taps <= st->fill) {
+        for (int c = 0; c < ch; c++) {
+            const int32_t *x = st->hist + c * st->len + st->pos + center;
+            int64_t acc = st->halfband ? _halfband(st->coefs, x, st->half)
+                : _fold(st->coefs, x, st->half);
+            out[done * ch + c] = fir_sat((acc + (Q30 >> 1)) >> 30);
+        }
+        done++;
+        st->pos += st->factor;
+    }
+
+    // Keep what the next windows still need
+    if (st->pos) {
+        keep = st->fill > st->pos ? st->fill - st->pos : 0;
+        for (int c = 0; c < ch; c++) {
+            int32_t *hist = st->hist + c * st->len;
+            memmove(hist, hist + st->fill - keep, keep * sizeof(int32_t));
+        }
+        st->pos -= st->fill - keep;
+        st->fill = keep;
+    }
+    return done;
+}
+
+
+esp_err_t decimate_init(decimate_t *dc, int in_rate, int out_rate,
+        int channels, polyphase_quality_t quality) {
+    double pass, atten;
+    int rate = in_rate;
+    esp_err_t ret = ESP_OK;
+
+    decimate_deinit(dc);
+    memset(dc, 0, sizeof(decimate_t));
+    if (in_rate <= 0 || out_rate <= 0 || out_rate >= in_rate
+            || channels <= 0 || quality > POLYPHASE_HIGH)
+        return ESP_ERR_INVALID_ARG;
+
+    dc->in_rate = in_rate;
+    dc->out_rate = out_rate;
+    dc->channels = channels;
+    pass = s_quality[quality].pass * out_rate / 2.;
+    atten = s_quality[quality].atten;
+
+    // Half-bands for the factors of two of an integer ratio, or while the
+    // rate stays at or above the output rate for a rational one. What
+    // folds back from the first ones lands above the passband, and is
+    // taken out by the next stages.
+    while (ret == ESP_OK && dc->count < DECIMATE_MAX_STAGES - 1
+            && rate % 2 == 0 && (rate % out_rate == 0
+                ? rate / out_rate % 2 == 0 : rate / 2 >= out_rate)) {
+        ret = _stage_init(&dc->stages[dc->count++], 2, pass / rate,
+                0.5 - pass / rate, atten, channels);
+        rate /= 2;
+    }
+
+    // Then the rest, an integer or a rational ratio
+    if (ret == ESP_OK && rate > out_rate && rate % out_rate == 0)
+        ret = _stage_init(&dc->stages[dc->count++], rate / out_rate,
+                pass / rate, (out_rate - pass) / rate, atten, channels);
+    else if (ret == ESP_OK && rate > out_rate)
+        ret = polyphase_init(&dc->pp, rate, out_rate, channels, quality);
+
+    if (ret == ESP_OK && dc->count) {
+        dc->buf[0] = malloc(DECIMATE_BLOCK * channels * sizeof(int32_t));
+        dc->buf[1] = malloc(DECIMATE_BLOCK * channels * sizeof(int32_t));
+        if (!dc->buf[0] || !dc->buf[1])
+            ret = ESP_ERR_NO_MEM;
+    }
+    if (ret != ESP_OK) {
+        if (ret == ESP_ERR_NO_MEM)
+            ESP_LOGE(TAG, "Could not allocate memory!");
+        decimate_deinit(dc);
+        return ret;
+    }
+
+    for (int i = 0; i < dc->count; i++) {
+        ESP_LOGD(TAG, "%d Hz to %d Hz, stage %d: %d to 1%s, %d taps",
+                in_rate, out_rate, i, dc->stages[i].factor,
+                dc->stages[i].halfband ? " half-band" : "",
+                dc->stages[i].taps);
+    }
+    if (dc->pp.coefs)
+        ESP_LOGD(TAG, "%d Hz to %d Hz, then polyphase from %d Hz", in_rate,
+                out_rate, rate);
+    return ESP_OK;
+}
+
+
+size_t decimate_max_input(const decimate_t *dc, size_t out_frames) {
+    size_t frames;
+
+    // Every stage can give one frame more than its ratio, at the edges of
+    // a block: no more than 2 in all
+    if (out_frames <= 2 || dc->out_rate <= 0)
+        return 0;
+    frames = (uint64_t)(out_frames - 2) * dc->in_rate / dc->out_rate;
+    return frames < DECIMATE_BLOCK ? frames : DECIMATE_BLOCK;
+}
+
+
+size_t decimate_process(decimate_t *dc, const int32_t *in, size_t in_frames,
+        int32_t *out) {
+    const int32_t *src = in;
+    size_t frames = in_frames, used;
+    int32_t *dst;
+
+    for (int i = 0; i < dc->count; i++) {
+        dst = i == dc->count - 1 && !dc->pp.coefs ? out : dc->buf[i & 1];
+        frames = _stage_run(&dc->stages[i], dc->channels, src, frames, dst);
+        src = dst;
+    }
+
+    // The polyphase converter gives fewer frames than it takes, and has
+    // room for a block in its history: it takes them all
+    if (dc->pp.coefs)
+        frames = polyphase_process(&dc->pp, src, frames, &used, out, frames);
+    return frames;
+}
+
+
+void decimate_deinit(decimate_t *dc) {
+    for (int i = 0; i < DECIMATE_MAX_STAGES; i++) {
+        free(dc->stages[i].coefs);
+        free(dc->stages[i].hist);
+        dc->stages[i].coefs = NULL;
+        dc->stages[i].hist = NULL;
+    }
+    free(dc->buf[0]);
+    free(dc->buf[1]);
+    dc->buf[0] = dc->buf[1] = NULL;
+    polyphase_deinit(&dc->pp);
+}
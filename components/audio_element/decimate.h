@@ -0,0 +1,118 @@
+/**
+ * Streaming decimator, to feed a sink at a lower rate than the main path,
+ * e.g. 48 to 16 kHz for a voice or network tap.
+ *
+ * The ratio is split in stages, and every stage only computes the frames
+ * it keeps:
+ *
+ *  - Half-band FIRs for every factor of two, while the rate stays at or
+ *    above the output rate: 48 to 24 kHz, or 44.1 to 22.05 kHz on the way
+ *    to 16 kHz. Every other tap of a half-band filter is zero.
+ *  - Then an FIR for what is left of an integer ratio, e.g. the 3 of 48 to
+ *    16 kHz.
+ *  - Or the polyphase converter of polyphase.h for a rational one, e.g.
+ *    22.05 to 16 kHz.
+ *
+ * The FIRs are linear phase, so each pair of taps around the center takes
+ * a single multiply. Unlike polyphase.h, which keeps everything above the
+ * output's Nyquist frequency out, they only keep the passband free of
+ * aliases: what folds back lands in the transition band, above the
+ * passband. That allows a transition band twice as wide, and half the
+ * taps. The passband ends at 60, 70 or 80% of the output's Nyquist
+ * frequency, and the stopband attenuation is that of polyphase.h, for the
+ * three qualities.
+ *
+ * Samples are int32_t at any scale (e.g. that of their own format, see
+ * mix.h), coefficients are Q30 and are accumulated in 64 bits. Every stage
+ * keeps the input frames its filter still needs between calls, and its
+ * output lags its input by half its filter, so the output starts with the
+ * input.
+ */
+
+#ifndef DECIMATE_H
+#define DECIMATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "polyphase.h"
+
+#define DECIMATE_BLOCK POLYPHASE_BLOCK  // Input frames per call, at most
+#define DECIMATE_MAX_STAGES 5           // Half-bands, then the rest
+
+typedef struct decimate_stage {
+    int32_t  *coefs;        // Q30, from the center out. Half-band: the odd
+                            // taps only, the center is 1/2.
+    int32_t  *hist;         // [channels][len], input frames
+    size_t   len;           // Frames of history per channel
+    size_t   fill;          // Frames in the history
+    size_t   pos;           // First frame of the next window
+    int      half;          // Taps in 'coefs'
+    int      taps;          // Of the whole filter, odd
+    int      factor;        // Input frames per output frame
+    bool     halfband;
+} decimate_stage_t;
+
+typedef struct decimate {
+    decimate_stage_t stages[DECIMATE_MAX_STAGES];
+    int      count;         // Of 'stages'
+    polyphase_t pp;         // For a rational rest, 'coefs' NULL if none
+    int32_t  *buf[2];       // Between the stages, DECIMATE_BLOCK frames
+    int      channels;
+    int      in_rate;
+    int      out_rate;
+} decimate_t;
+
+
+/**
+ * (Re)initialize a decimator, designing its filters and clearing their
+ * history. Zeroed memory is a valid decimator to initialize.
+ *
+ * @param dc        Pointer to decimator
+ * @param in_rate   Sample rate of the input
+ * @param out_rate  Sample rate of the output, below `in_rate`
+ * @param channels  Number of channels
+ * @param quality   Passband and stopband, see above
+ *
+ * @return
+ *      - ESP_OK if successful
+ *      - ESP_ERR_INVALID_ARG if a rate or the channel count is not
+ *        positive, or the output rate is not below the input rate
+ *      - ESP_ERR_NOT_SUPPORTED if a rational rest needs too many phases
+ *      - ESP_ERR_NO_MEM if out of memory
+ */
+esp_err_t decimate_init(decimate_t *dc, int in_rate, int out_rate,
+        int channels, polyphase_quality_t quality);
+
+/**
+ * Number of input frames that give at most `out_frames` output frames, at
+ * most DECIMATE_BLOCK
+ */
+size_t decimate_max_input(const decimate_t *dc, size_t out_frames);
+
+/**
+ * Take input frames, and write the output frames they complete. All of the
+ * input is taken.
+ *
+ * @param dc            Pointer to decimator
+ * @param in            Input frames, interleaved
+ * @param in_frames     Number of input frames, see decimate_max_input
+ * @param out           Output frames, interleaved, with room for as many
+ *                      as decimate_max_input was asked for
+ *
+ * @return
+ *      - Number of frames written to `out`
+ */
+size_t decimate_process(decimate_t *dc, const int32_t *in, size_t in_frames,
+        int32_t *out);
+
+/**
+ * Free the filters, the history and the buffers
+ *
+ * @param dc        Pointer to decimator
+ */
+void decimate_deinit(decimate_t *dc);
+
+#endif
@@ -0,0 +1,93 @@
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+
+#include "decimator.h"
+#include "audio_element.h"
+#include "block_conv.h"
+#include "decimate.h"
+
+#include "esp_log.h"
+
+static const char TAG[] = "DECIMATOR";
+
+typedef struct {
+    block_conv_t bc;
+    decimate_t dc;
+    int      out_rate;
+    polyphase_quality_t quality;
+} decimator_t;
+
+
+// Set up the decimator for a new input format, none at or below the output
+// rate
+static bool _decimator_format(audio_element_t *el,
+        audio_element_info_t *out) {
+    decimator_t *dm = el->data;
+    esp_err_t ret;
+
+    if (out->sample_rate <= dm->out_rate)
+        return false;
+    ret = decimate_init(&dm->dc, out->sample_rate, dm->out_rate,
+            out->channels, dm->quality);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "[%s] Cannot decimate %d Hz to %d Hz: %s, passing "
+                "it on as is", el->tag, out->sample_rate, dm->out_rate,
+                esp_err_to_name(ret));
+        return false;
+    }
+    out->sample_rate = dm->out_rate;
+    return true;
+}
+
+
+static size_t _decimator_frames_needed(audio_element_t *el,
+        size_t out_frames) {
+    decimator_t *dm = el->data;
+    return decimate_max_input(&dm->dc, out_frames);
+}
+
+
+// Takes all of the input, what gives no output yet stays in the filters
+static size_t _decimator_convert(audio_element_t *el, const int32_t *in,
+        size_t in_frames, size_t *used, int32_t *out, size_t out_frames) {
+    decimator_t *dm = el->data;
+    *used = in_frames;
+    return decimate_process(&dm->dc, in, in_frames, out);
+}
+
+
+static void _decimator_deinit(audio_element_t *el) {
+    decimator_t *dm = el->data;
+    decimate_deinit(&dm->dc);
+}
+
+
+static const block_conv_ops_t s_decimator_ops = {
+    .format = _decimator_format,
+    .frames_needed = _decimator_frames_needed,
+    .process = _decimator_convert,
+    .deinit = _decimator_deinit,
+};
+
+
+audio_element_t *decimator_init(audio_element_cfg_t cfg, int out_rate,
+        polyphase_quality_t quality) {
+    if (out_rate <= 0) {
+        ESP_LOGE(TAG, "Invalid output rate: %d", out_rate);
+        return NULL;
+    }
+
+    decimator_t *dm = calloc(1, sizeof(decimator_t));
+    if (!dm) {
+        ESP_LOGE(TAG, "Could not allocate memory!");
+        return NULL;
+    }
+    dm->out_rate = out_rate;
+    dm->quality = quality;
+
+    cfg.tag = "decimator";
+
+    audio_element_t *el = block_conv_init(&cfg, &s_decimator_ops, &dm->bc);
+    if (!el)
+        free(dm);
+    return el;
+}
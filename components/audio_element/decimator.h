@@ -0,0 +1,46 @@
+/**
+ * Decimator: converts a stream down to a fixed, lower sample rate.
+ *
+ * Uses the staged decimator of decimate.h: half-band filters, then an FIR
+ * or a polyphase converter for the rest, each computing only the frames
+ * it keeps. E.g. 48 to 16 kHz takes a quarter of the multiplies of the
+ * resampler (see resampler.h), for a passband that is as wide, but only
+ * kept free of aliases. That is meant for a tap at a lower rate, like voice
+ * or a network stream, next to the main path: link it to an output of a
+ * tee (see tee.h) with `cfg.input = tee_output(tee, i)`.
+ *
+ * The filter state is kept between blocks, and the decimator is set up
+ * again when the input format changes. An input that is at the output rate
+ * already, or below it, is passed on as is.
+ *
+ * The output has the channels and bits of the input. Samples are converted
+ * through int32_t blocks, see block_conv.h.
+ */
+
+#ifndef DECIMATOR_H
+#define DECIMATOR_H
+
+#include "audio_element.h"
+#include "decimate.h"
+
+
+/**
+ * Initialize the decimator
+ *
+ * The open, process and destroy fields of `cfg` are set by the decimator.
+ * `buf_len` is the max number of bytes read from the input per process
+ * call.
+ *
+ * @param cfg       A configured `audio_element_cfg_t` struct, linked to the
+ *                  element (or tee output) to decimate
+ * @param out_rate  Sample rate of the output
+ * @param quality   Passband and stopband, see decimate.h
+ *
+ * @return
+ *      - audio_element_t if successful
+ *      - NULL otherwise
+ */
+audio_element_t *decimator_init(audio_element_cfg_t cfg, int out_rate,
+        polyphase_quality_t quality);
+
+#endif
@@ -0,0 +1,30 @@
+#include "fir.h"
+
+#include <math.h>
+
+
+double fir_bessel_i0(double x) {
+    double sum = 1., term = 1.;
+
+    for (int k = 1; k < 64 && term > 1e-12 * sum; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+
+double fir_kaiser_beta(double atten) {
+    return atten > 50. ? 0.1102 * (atten - 8.7)
+        : 0.5842 * pow(atten - 21., 0.4) + 0.07886 * (atten - 21.);
+}
+
+
+int fir_kaiser_length(double atten, double width) {
+    return ceil((atten - 8.) / (2.285 * 2. * M_PI * width)) + 1;
+}
+
+
+double fir_kaiser_width(double atten, int taps) {
+    return (atten - 8.) / (2.285 * 2. * M_PI * taps);
+}
@@ -0,0 +1,53 @@
+/**
+ * FIR design helpers: the Kaiser window and its estimates, used by the
+ * filters of polyphase.h and decimate.h, and the saturation of their Q30
+ * accumulators.
+ */
+
+#ifndef FIR_H
+#define FIR_H
+
+#include <stdint.h>
+
+
+// An accumulator, scaled back to a sample, clipped to int32_t
+static inline int32_t fir_sat(int64_t x) {
+    return x < INT32_MIN ? INT32_MIN : x > INT32_MAX ? INT32_MAX : x;
+}
+
+/**
+ * Modified Bessel function of the first kind, order 0
+ */
+double fir_bessel_i0(double x);
+
+/**
+ * Kaiser's estimate of the beta of a window
+ *
+ * @param atten     Stopband attenuation, in dB
+ *
+ * @return Beta, the shape of the window
+ */
+double fir_kaiser_beta(double atten);
+
+/**
+ * Kaiser's estimate of the length of a filter
+ *
+ * @param atten     Stopband attenuation, in dB
+ * @param width     Transition band, in cycles per frame
+ *
+ * @return Taps needed
+ */
+int fir_kaiser_length(double atten, double width);
+
+/**
+ * Kaiser's estimate of the transition band of a filter, the inverse of
+ * fir_kaiser_length
+ *
+ * @param atten     Stopband attenuation, in dB
+ * @param taps      Length of the filter
+ *
+ * @return Transition band, in cycles per frame
+ */
+double fir_kaiser_width(double atten, int taps);
+
+#endif
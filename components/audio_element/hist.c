@@ -0,0 +1,28 @@
+#include "hist.h"
+
+
+void hist_add(uint32_t *hist, size_t buckets, uint32_t value) {
+    size_t bucket = value ? 31 - __builtin_clz(value) : 0;
+
+    if (bucket >= buckets)
+        bucket = buckets - 1;
+    hist[bucket]++;
+}
+
+
+uint32_t hist_p99(const uint32_t *hist, size_t buckets, uint32_t count,
+        uint32_t max) {
+    uint32_t target = count - count / 100;
+    uint32_t sum = 0;
+    size_t i;
+
+    for (i = 0; i < buckets - 1; i++) {
+        sum += hist[i];
+        if (sum >= target)
+            break;
+    }
+
+    // Upper bound of the bucket, but never more than the max seen
+    uint32_t bound = (2u << i) - 1;
+    return bound < max ? bound : max;
+}
@@ -0,0 +1,36 @@
+/**
+ * Log2 histograms of times: bucket n holds [2^n, 2^(n+1)), the last one
+ * everything above. Used for the process times of the elements and the
+ * latencies of io_trace.h.
+ */
+
+#ifndef HIST_H
+#define HIST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * Count a value in its bucket
+ *
+ * @param hist      Buckets
+ * @param buckets   Number of buckets
+ * @param value     Value to count, 0 goes in bucket 0
+ */
+void hist_add(uint32_t *hist, size_t buckets, uint32_t value);
+
+/**
+ * The 99th percentile, as the upper bound of its bucket
+ *
+ * @param hist      Buckets
+ * @param buckets   Number of buckets
+ * @param count     Values counted in `hist`
+ * @param max       Largest value counted
+ *
+ * @return Upper bound of the bucket of the p99, never more than `max`
+ */
+uint32_t hist_p99(const uint32_t *hist, size_t buckets, uint32_t count,
+        uint32_t max);
+
+#endif
@@ -14,6 +14,7 @@ static const char TAG[] = "I2S_STREAM";
 typedef struct {
     audio_stream_type_t type;
     int i2s_num;
+    uint32_t info_gen;
 } i2s_stream_t;
 
 
@@ -25,6 +26,7 @@ typedef struct {
 static esp_err_t _i2s_open(audio_element_t *el, void* pv) {
     i2s_stream_t *stream = el->data;
     audio_element_info_t info = audio_element_get_info(el->input);
+    stream->info_gen = info.gen;
 
     i2s_config_t i2s_config = {
         .mode = I2S_MODE_MASTER | I2S_MODE_TX,
@@ -79,17 +81,25 @@ static esp_err_t _i2s_destroy(audio_element_t *el) {
 }
 
 
-static size_t _i2s_write(io_t *io, char *buf, size_t len, void *pv) {
-    i2s_stream_t *stream = ((audio_element_t *)pv)->data;
-    audio_element_info_t *info = io->user_data;
-
-    if (info->changed) {
-        i2s_set_clk(stream->i2s_num, info->sample_rate, info->bits, info->channels);
-        info->changed = false;
+// Borrow data from the input and hand it to the i2s driver directly
+static size_t _i2s_process(audio_element_t *el) {
+    i2s_stream_t *stream = el->data;
+    audio_element_info_t info;
+    size_t len = el->buf_len;
+    size_t bytes_written = 0;
+
+    char *data = io_acquire_read(el->input, &len, el);
+    if (!data)
+        return 0;
+
+    if (audio_element_info_changed(el->input, stream->info_gen)) {
+        info = audio_element_get_info(el->input);
+        i2s_set_clk(stream->i2s_num, info.sample_rate, info.bits, info.channels);
+        stream->info_gen = info.gen;
     }
 
-    size_t bytes_written;
-    i2s_write(stream->i2s_num, buf, len, &bytes_written, portMAX_DELAY);
+    i2s_write(stream->i2s_num, data, len, &bytes_written, portMAX_DELAY);
+    io_release_read(el->input, bytes_written);
 
     ESP_LOGV(TAG, "Bytes written to i2s: %d", bytes_written);
 
@@ -114,15 +124,19 @@ audio_element_t *i2s_stream_init(audio_element_cfg_t cfg, audio_stream_type_t ty
 
     stream->type = type;
     if (type == AEL_STREAM_WRITER) {
-        cfg.write = _i2s_write;
+        cfg.process = _i2s_process;
+        // Data leaves through the i2s driver, not through an output io_t
+        cfg.output = IO_UNUSED;
     } else {
         ESP_LOGE(TAG, "AEL_STREAM_READER Not implemented yet.");
+        free(stream);
         return NULL;
     }
 
     audio_element_t *el = audio_element_init(&cfg);
     if (!el) {
-        ESP_LOGE(TAG, "[%s] could not init audio element.", el->tag);
+        ESP_LOGE(TAG, "[%s] could not init audio element.", cfg.tag);
+        free(stream);
         return NULL;
     }
     el->data = stream;
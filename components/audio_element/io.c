@@ -1,64 +1,546 @@
 
+#include <stdint.h>
 #include <string.h>
 #include <esp_log.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/ringbuf.h>
+#include <freertos/task.h>
 
 #include "io.h"
+#include "spsc_ring.h"
+#include "bcast_ring.h"
+#include "io_trace.h"
+#include "pool.h"
 
 
 #define IO_TICKS_TO_WAIT pdMS_TO_TICKS(1000)
+#define IO_READ_TICKS_TO_WAIT 10
 
 static const char TAG[] = "IO";
 
+POOL_DEFINE(s_io_pool, sizeof(io_t), IO_POOL_SIZE);
+
+// Ticks to wait for data or space, none if the io_t is nonblocking
+static inline TickType_t _ticks(io_t *io, TickType_t ticks) {
+    return io->nonblocking ? 0 : ticks;
+}
+
+// Wake the task on the other side, never the calling task itself. The
+// fence pairs with the one in _wait, so a waiter that registered itself
+// either is seen here or sees the change made before the call.
+static inline void _notify(TaskHandle_t *side, uint32_t bit) {
+    TaskHandle_t task;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    task = *side;
+    if (task && task != xTaskGetCurrentTaskHandle())
+        xTaskNotify(task, bit, eSetBits);
+}
+
+static inline void _count_read(io_t *io, size_t bytes) {
+    if (bytes) {
+        io->bytes_read += bytes;
+        if (io->trace)
+            io_trace_read(io);
+    } else {
+        io->underruns++;
+    }
+}
+
+static inline void _count_write(io_t *io, size_t bytes) {
+    if (bytes != IO_WRITE_ERROR) {
+        io->bytes_written += bytes;
+        if (io->trace)
+            io_trace_written(io, bytes);
+    } else {
+        io->overruns++;
+    }
+}
+
+// Apply the markers the reader has reached, and return how much of 'len'
+// can be read without crossing the next one
+static size_t _markers(io_t *io, size_t len) {
+    unsigned int tail = atomic_load_explicit(&io->mk_tail,
+            memory_order_relaxed);
+    io_marker_t *mk;
+    uint32_t ahead;
+
+    // Nothing pending, the steady state
+    if (atomic_load_explicit(&io->mk_head, memory_order_acquire) == tail)
+        return len;
+
+    do {
+        mk = &io->markers[tail % IO_MAX_MARKERS];
+        ahead = mk->pos - io->bytes_read;
+        if ((int32_t)ahead > 0)
+            return len < ahead ? len : ahead;
+
+        ESP_LOGD(TAG, "Marker reached at %u", mk->pos);
+        if (io->on_marker)
+            io->on_marker(io, mk->data);
+        atomic_store_explicit(&io->mk_tail, ++tail, memory_order_release);
+    } while (atomic_load_explicit(&io->mk_head, memory_order_acquire)
+            != tail);
+
+    return len;
+}
+
 size_t _read_rb(io_t *io, char *buf, size_t len, void *pv) {
     size_t bytes_read;
-    void *data = xRingbufferReceiveUpTo(io->rb, &bytes_read, 10, len);
+    len = _markers(io, len);
+    void *data = xRingbufferReceiveUpTo(io->rb, &bytes_read,
+            _ticks(io, IO_READ_TICKS_TO_WAIT), len);
     if (data) {
         memcpy(buf, data, bytes_read);
         vRingbufferReturnItem(io->rb, data);
+        _notify(&io->writer, IO_BIT_SPACE);
+        _count_read(io, bytes_read);
 
         ESP_LOGV(TAG, "Read %d bytes", bytes_read);
         return bytes_read;
     }
+    _count_read(io, 0);
     return 0;
 }
 
 size_t _write_rb(io_t *io, char *buf, size_t len, void *pv) {
     size_t bytes_written;
-    BaseType_t ret = xRingbufferSend(io->rb, buf, len, IO_TICKS_TO_WAIT);
-    if (ret == pdTRUE)
+    BaseType_t ret = xRingbufferSend(io->rb, buf, len,
+            _ticks(io, IO_TICKS_TO_WAIT));
+    if (ret == pdTRUE) {
         bytes_written = len;
-    else
+        _notify(&io->reader, IO_BIT_DATA);
+    } else {
         bytes_written = IO_WRITE_ERROR;
+    }
+    _count_write(io, bytes_written);
+
+    ESP_LOGV(TAG, "Written %d bytes", bytes_written);
+    return bytes_written;
+}
+
+// The lock-free rings have no blocking primitive. A caller waits for at most
+// 'ticks' as the reader or writer of the io_t, asleep until the other side
+// notifies it. Only while another task is registered on that side it polls.
+static bool _wait(io_t *io, bool for_space, TickType_t ticks) {
+    TaskHandle_t *side = for_space ? &io->writer : &io->reader;
+    TaskHandle_t self;
+    TickType_t start, waited;
+    bool claimed = false, ready;
+
+    if (for_space ? io_space(io) : io_fill(io))
+        return true;
+    if (!ticks)
+        return false;
+
+    self = xTaskGetCurrentTaskHandle();
+    if (!*side) {
+        *side = self;
+        claimed = true;
+    }
+    start = xTaskGetTickCount();
+    while (1) {
+        atomic_thread_fence(memory_order_seq_cst);
+        ready = for_space ? io_space(io) : io_fill(io);
+        waited = xTaskGetTickCount() - start;
+        if (ready || waited >= ticks)
+            break;
+        if (*side == self)
+            xTaskNotifyWait(0, for_space ? IO_BIT_SPACE : IO_BIT_DATA, NULL,
+                    ticks - waited);
+        else
+            vTaskDelay(1);
+    }
+    if (claimed && *side == self)
+        *side = NULL;
+    return ready;
+}
+
+size_t _read_spsc(io_t *io, char *buf, size_t len, void *pv) {
+    if (!_wait(io, false, _ticks(io, IO_READ_TICKS_TO_WAIT))) {
+        _count_read(io, 0);
+        return 0;
+    }
+
+    size_t bytes_read = spsc_ring_read(io->spsc, buf, _markers(io, len));
+    _notify(&io->writer, IO_BIT_SPACE);
+    _count_read(io, bytes_read);
+    ESP_LOGV(TAG, "Read %d bytes", bytes_read);
+    return bytes_read;
+}
+
+size_t _write_spsc(io_t *io, char *buf, size_t len, void *pv) {
+    size_t bytes_written = 0;
+
+    while (bytes_written < len
+            && _wait(io, true, _ticks(io, IO_TICKS_TO_WAIT))) {
+        bytes_written += spsc_ring_write(io->spsc, buf + bytes_written,
+                len - bytes_written);
+    }
+
+    if (bytes_written)
+        _notify(&io->reader, IO_BIT_DATA);
+    if (bytes_written < len)
+        io->overruns++;
+    if (bytes_written)
+        _count_write(io, bytes_written);
+
+    ESP_LOGV(TAG, "Written %d bytes", bytes_written);
+    return bytes_written ? bytes_written : IO_WRITE_ERROR;
+}
+
+// Wake the readers of all taps
+static void _notify_taps(io_t *io) {
+    for (int i = 0; i < BCAST_MAX_READERS; i++) {
+        io_t *tap = io->bcast->readers[i].user_data;
+        if (tap && bcast_ring_connected(io->bcast, i))
+            _notify(&tap->reader, IO_BIT_DATA);
+    }
+}
+
+size_t _read_bcast(io_t *io, char *buf, size_t len, void *pv) {
+    char *data = io_acquire_read(io, &len, pv);
+    if (!data)
+        return 0;
+
+    memcpy(buf, data, len);
+    io_release_read(io, len);
+    return len;
+}
+
+size_t _write_bcast(io_t *io, char *buf, size_t len, void *pv) {
+    size_t bytes_written = 0;
+    size_t n;
+    char *region;
+
+    while (bytes_written < len) {
+        n = len - bytes_written;
+        region = io_acquire_write(io, &n);
+        if (!region)
+            break;
+        memcpy(region, buf + bytes_written, n);
+        io_commit_write(io, n, pv);
+        bytes_written += n;
+    }
 
     ESP_LOGV(TAG, "Written %d bytes", bytes_written);
+    return bytes_written ? bytes_written : IO_WRITE_ERROR;
+}
+
+// Make sure the staging buffer can hold at least 'len' bytes
+static char *_staging(io_t *io, size_t len) {
+    if (io->staging_len < len) {
+        char *staging = realloc(io->staging, len);
+        if (!staging) {
+            ESP_LOGE(TAG, "Could not allocate staging buffer of %d bytes",
+                    len);
+            return NULL;
+        }
+        io->staging = staging;
+        io->staging_len = len;
+    }
+    return io->staging;
+}
+
+size_t io_fill(io_t *io) {
+    if (io->spsc)
+        return spsc_ring_fill(io->spsc);
+    if (io->bcast && io->source)
+        return bcast_ring_fill(io->bcast, io->tap);
+    if (io->bcast)
+        // What the slowest blocking tap has left to read
+        return io->size - bcast_ring_space(io->bcast);
+    if (io->rb)
+        // For a byte buffer the max item size is the whole buffer
+        return xRingbufferGetMaxItemSize(io->rb)
+            - xRingbufferGetCurFreeSize(io->rb);
+    return io->rd_len;
+}
+
+size_t io_space(io_t *io) {
+    if (io->spsc)
+        return spsc_ring_space(io->spsc);
+    if (io->bcast)
+        // Taps are never written to
+        return io->source ? 0 : bcast_ring_space(io->bcast);
+    if (io->rb)
+        return xRingbufferGetCurFreeSize(io->rb);
+    return SIZE_MAX;
+}
+
+char *io_acquire_read(io_t *io, size_t *len, void *pv) {
+    size_t bytes_read = 0;
+
+    *len = _markers(io, *len);
+
+    // Hand out what is left of a partially released region first
+    if (io->rd_len) {
+        if (*len > io->rd_len)
+            *len = io->rd_len;
+        return io->rd_ptr;
+    }
+
+    if (io->spsc) {
+        // Borrow the first region, the wrapped part is returned next time
+        spsc_region_t regions[2];
+        if (_wait(io, false,
+                    _ticks(io, IO_READ_TICKS_TO_WAIT))) {
+            spsc_ring_read_regions(io->spsc, regions);
+            io->rd_ptr = regions[0].data;
+            bytes_read = *len < regions[0].len ? *len : regions[0].len;
+        }
+    } else if (io->bcast) {
+        spsc_region_t regions[2];
+        if (_wait(io, false, _ticks(io, IO_READ_TICKS_TO_WAIT))) {
+            bcast_ring_read_regions(io->bcast, io->tap, regions);
+            io->rd_ptr = regions[0].data;
+            bytes_read = *len < regions[0].len ? *len : regions[0].len;
+        }
+    } else if (io->rb) {
+        // Borrow straight from the ringbuffer, no copy
+        io->rd_item = xRingbufferReceiveUpTo(io->rb, &bytes_read,
+                _ticks(io, IO_READ_TICKS_TO_WAIT), *len);
+        io->rd_ptr = io->rd_item;
+    } else if (io->read) {
+        io->rd_ptr = _staging(io, *len);
+        if (io->rd_ptr)
+            bytes_read = io->read(io, io->rd_ptr, *len, pv);
+    }
+
+    if (!io->rd_ptr || !bytes_read) {
+        io->underruns++;
+        *len = 0;
+        return NULL;
+    }
+
+    ESP_LOGV(TAG, "Acquired %d bytes for reading", bytes_read);
+    io->rd_len = bytes_read;
+    *len = bytes_read;
+    return io->rd_ptr;
+}
+
+void io_apply_markers(io_t *io) {
+    _markers(io, 0);
+}
+
+esp_err_t io_mark(io_t *io, const void *data, size_t len) {
+    if (!io->rb && !io->spsc)
+        return ESP_ERR_NOT_SUPPORTED;
+    if (len > IO_MARKER_SIZE)
+        return ESP_ERR_INVALID_SIZE;
+
+    unsigned int head = atomic_load_explicit(&io->mk_head,
+            memory_order_relaxed);
+    if (head - atomic_load_explicit(&io->mk_tail, memory_order_acquire)
+            >= IO_MAX_MARKERS)
+        return ESP_ERR_NO_MEM;
+
+    // The ring's own position is committed together with the data, the
+    // counter of a ringbuffer only after it
+    io_marker_t *mk = &io->markers[head % IO_MAX_MARKERS];
+    mk->pos = io->spsc ? (uint32_t)spsc_ring_committed(io->spsc)
+        : io->bytes_written;
+    memcpy(mk->data, data, len);
+    atomic_store_explicit(&io->mk_head, head + 1, memory_order_release);
+    return ESP_OK;
+}
+
+void io_release_read(io_t *io, size_t len) {
+    if (len > io->rd_len)
+        len = io->rd_len;
+
+    io->rd_ptr += len;
+    io->rd_len -= len;
+    if (len)
+        _count_read(io, len);
+
+    if (io->spsc) {
+        spsc_ring_release(io->spsc, len);
+        _notify(&io->writer, IO_BIT_SPACE);
+    } else if (io->bcast) {
+        // Skipped ahead by the writer, what is left of the region is stale
+        if (!bcast_ring_release(io->bcast, io->tap, len))
+            io->rd_len = 0;
+        if (io->bcast->readers[io->tap].policy == BCAST_LAG_BLOCK)
+            _notify(&io->source->writer, IO_BIT_SPACE);
+    } else if (!io->rd_len && io->rd_item) {
+        vRingbufferReturnItem(io->rb, io->rd_item);
+        io->rd_item = NULL;
+        _notify(&io->writer, IO_BIT_SPACE);
+    }
+}
+
+char *io_acquire_write(io_t *io, size_t *len) {
+    if (io->spsc) {
+        // Fill the ring in place, up to the wrap point
+        spsc_region_t regions[2];
+        if (!_wait(io, true, _ticks(io, IO_TICKS_TO_WAIT))) {
+            io->overruns++;
+            *len = 0;
+            return NULL;
+        }
+        spsc_ring_write_regions(io->spsc, regions);
+        if (*len > regions[0].len)
+            *len = regions[0].len;
+        return regions[0].data;
+    }
+
+    if (io->bcast) {
+        // In place as well, lagging taps are dealt with by their policy
+        spsc_region_t regions[2];
+        if (!_wait(io, true, _ticks(io, IO_TICKS_TO_WAIT))) {
+            io->overruns++;
+            *len = 0;
+            return NULL;
+        }
+        bcast_ring_write_regions(io->bcast, regions, *len);
+        *len = regions[0].len;
+        return regions[0].data;
+    }
+
+    // A FreeRTOS byte buffer can not lend out memory for in-place writes, so
+    // the region is staged and sent on commit. Never hand out more than fits
+    // right now, or the commit fails and the staged data is lost.
+    if (io->rb) {
+        if (!_wait(io, true, _ticks(io, IO_TICKS_TO_WAIT))) {
+            io->overruns++;
+            *len = 0;
+            return NULL;
+        }
+        size_t space = io_space(io);
+        if (*len > space)
+            *len = space;
+    }
+
+    char *region = _staging(io, *len);
+    if (!region)
+        *len = 0;
+    return region;
+}
+
+size_t io_commit_write(io_t *io, size_t len, void *pv) {
+    if (!len)
+        return 0;
+    if (io->spsc) {
+        spsc_ring_commit(io->spsc, len);
+        _notify(&io->reader, IO_BIT_DATA);
+        _count_write(io, len);
+        return len;
+    }
+    if (io->bcast) {
+        bcast_ring_commit(io->bcast, len);
+        _notify_taps(io);
+        _count_write(io, len);
+        return len;
+    }
+    if (!io->write) {
+        io->overruns++;
+        return IO_WRITE_ERROR;
+    }
+
+    size_t bytes_written = io->write(io, io->staging, len, pv);
+    // Ringbuffer writes are counted by _write_rb itself
+    if (!io->rb)
+        _count_write(io, bytes_written);
     return bytes_written;
 }
 
 io_t *io_create(io_cb read, io_cb write, int size) {
-    io_t *io = calloc(1, sizeof(io_t));
+    return io_create_backend(IO_BACKEND_RINGBUF, read, write, size);
+}
+
+io_t *io_create_backend(io_backend_t backend, io_cb read, io_cb write,
+        int size) {
+    io_t *io = pool_calloc(&s_io_pool);
+    if (!io) {
+        ESP_LOGE(TAG, "Could not allocate memory for io_t");
+        return NULL;
+    }
 
-    if (size) {
+    if (size && backend == IO_BACKEND_SPSC) {
+        io->spsc = spsc_ring_create(size);
+        if (!io->spsc) {
+            ESP_LOGE(TAG, "Could not create SPSC ring of %d bytes", size);
+            pool_free(&s_io_pool, io);
+            return NULL;
+        }
+        io->read = _read_spsc;
+        io->write = _write_spsc;
+        io->size = io->spsc->size;
+    } else if (size && backend == IO_BACKEND_BCAST) {
+        io->bcast = bcast_ring_create(size);
+        if (!io->bcast) {
+            ESP_LOGE(TAG, "Could not create broadcast ring of %d bytes",
+                    size);
+            pool_free(&s_io_pool, io);
+            return NULL;
+        }
+        io->tap = -1;
+        io->write = _write_bcast;
+        io->size = io->bcast->size;
+    } else if (size) {
         io->rb = xRingbufferCreate(size, RINGBUF_TYPE_BYTEBUF);
         io->read =_read_rb;
         io->write =_write_rb;
+        io->size = size;
     } else if (read || write) {
         io->read = read;
         io->write = write;
     } else {
         ESP_LOGE(TAG, "No cb functions or buffer size given.");
+        pool_free(&s_io_pool, io);
         return NULL;
     }
     return io;
 }
 
+io_t *io_tap(io_t *io, bcast_lag_t policy) {
+    if (!io->bcast || io->source) {
+        ESP_LOGE(TAG, "Can only tap a broadcast io_t");
+        return NULL;
+    }
+
+    io_t *tap = pool_calloc(&s_io_pool);
+    if (!tap) {
+        ESP_LOGE(TAG, "Could not allocate memory for io_t");
+        return NULL;
+    }
+
+    tap->tap = bcast_ring_add_reader(io->bcast, policy, tap);
+    if (tap->tap < 0) {
+        ESP_LOGE(TAG, "No more than %d taps allowed", BCAST_MAX_READERS);
+        pool_free(&s_io_pool, tap);
+        return NULL;
+    }
+    tap->bcast = io->bcast;
+    tap->source = io;
+    tap->read = _read_bcast;
+    tap->size = io->size;
+    tap->user_data = io->user_data;
+    return tap;
+}
+
 void io_destroy(io_t *io) {
+    if (io->source) {
+        // A tap only owns itself
+        bcast_ring_remove_reader(io->bcast, io->tap);
+        free(io->staging);
+        pool_free(&s_io_pool, io);
+        return;
+    }
+
+    if (io->rd_item)
+        vRingbufferReturnItem(io->rb, io->rd_item);
+    free(io->staging);
+    if (io->spsc)
+        spsc_ring_destroy(io->spsc);
+    if (io->bcast)
+        bcast_ring_destroy(io->bcast);
     if (io->rb) {
         vRingbufferDelete(io->rb);
     }
     if (io->user_data)
         free(io->user_data);
-    free(io);
+    pool_free(&s_io_pool, io);
     io = NULL;
 }
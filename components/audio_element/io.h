@@ -3,24 +3,82 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <esp_err.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/ringbuf.h>
+#include <freertos/task.h>
+
+#include "spsc_ring.h"
+#include "bcast_ring.h"
+#include "io_trace.h"
 
 #define IO_UNUSED (io_t *)1
+#define IO_POOL_SIZE 16     // Max number of io_t's, taps included
+#define IO_MAX_MARKERS 4    // Markers in flight per io_t
+#define IO_MARKER_SIZE 16   // Max bytes of data per marker
 
 enum IO_ERROR {
     IO_WRITE_ERROR = -2
 };
 
+// Task notification bits sent by the io_t to its reader and writer
+enum IO_NOTIFY_BIT {
+    IO_BIT_DATA = (1 << 16),    // Data was committed, sent to the reader
+    IO_BIT_SPACE = (1 << 17),   // Data was released, sent to the writer
+};
+
+typedef enum {
+    IO_BACKEND_RINGBUF, // FreeRTOS byte ringbuffer
+    IO_BACKEND_SPSC,    // Lock-free single producer/consumer ring
+    IO_BACKEND_BCAST,   // Lock-free ring read by several taps, see io_tap
+} io_backend_t;
+
 typedef struct io_ io_t;
 typedef size_t (*io_cb)(io_t *io, char *buf, size_t len, void *pv);
+typedef void (*io_marker_cb)(io_t *io, const void *data);
+
+// Data attached to a byte position in the stream, see io_mark
+typedef struct {
+    uint32_t        pos;        // In bytes_written
+    char            data[IO_MARKER_SIZE];
+} io_marker_t;
 
 struct io_ {
     io_cb           read;
     io_cb           write;
     RingbufHandle_t rb;
+    spsc_ring_t     *spsc;
+    bcast_ring_t    *bcast;     // Shared by the writer io_t and its taps
+    int             tap;        // Reader index in bcast, -1 for the writer
+    io_t            *source;    // Writer io_t of a tap, NULL otherwise
     void            *user_data; // Used to hold buffer specific information
+    bool            nonblocking;// Never wait for data or space
+    TaskHandle_t    reader;     // Notified with IO_BIT_DATA, optional
+    TaskHandle_t    writer;     // Notified with IO_BIT_SPACE, optional
+                                // (a blocking caller is, while it waits)
+    size_t          size;       // Size of the ring, 0 for callbacks
+
+    // Counters, only ever incremented, wrap around
+    uint32_t        bytes_written;
+    uint32_t        bytes_read;
+    uint32_t        underruns;  // Reads that found no data
+    uint32_t        overruns;   // Writes that found no space
+    io_trace_t      *trace;     // Set by io_trace_start, NULL otherwise
+
+    // Acquire/release state, see io_acquire_read and io_acquire_write
+    void            *rd_item;   // rb item backing rd_ptr, returned when done
+    char            *rd_ptr;    // Region currently borrowed by the reader
+    size_t          rd_len;     // Bytes left in the borrowed region
+    char            *staging;   // Used when the backend can't lend memory
+    size_t          staging_len;
+
+    // In-band markers, queued by io_mark and applied by the reader
+    io_marker_t     markers[IO_MAX_MARKERS];
+    atomic_uint     mk_head;    // Written by io_mark only
+    atomic_uint     mk_tail;    // Written by the reader only
+    io_marker_cb    on_marker;  // Called by the reader when it gets there
 };
 
 /**
@@ -38,6 +96,151 @@ struct io_ {
  */
 io_t *io_create(io_cb read, io_cb write, int size);
 
+/**
+ * Same as io_create, but with a selectable ringbuffer backend.
+ *
+ * IO_BACKEND_SPSC may only be used if exactly one task writes to and one
+ * task reads from the buffer. Its size is rounded up to a power of two.
+ *
+ * @param backend Ringbuffer implementation used if size is set
+ * @param read Callback function to read data
+ * @param write Callback function to write data
+ * @param size Size of the buffer
+ *
+ * @returns io_t Struct
+ */
+io_t *io_create_backend(io_backend_t backend, io_cb read, io_cb write,
+        int size);
+
+/**
+ * Add a reader to an IO_BACKEND_BCAST io_t.
+ *
+ * The returned io_t reads the same data as every other tap of `io`, without
+ * it being copied. It shares the user_data (info) of `io`. What happens
+ * when this tap falls behind the others is set by `policy`.
+ *
+ * A tap has to be destroyed before the io_t it taps.
+ *
+ * @param io Pointer to an io_t created with IO_BACKEND_BCAST
+ * @param policy What to do when this tap falls behind
+ *
+ * @returns
+ *      - io_t Struct
+ *      - NULL if `io` is not a broadcast io_t or has no free reader slots
+ */
+io_t *io_tap(io_t *io, bcast_lag_t policy);
+
+/**
+ * Number of bytes that can be read without waiting
+ *
+ * @param io Pointer to io_t struct
+ *
+ * @returns Bytes available, 0 for callback backed io_t's
+ */
+size_t io_fill(io_t *io);
+
+/**
+ * Number of bytes that can be written without waiting
+ *
+ * @param io Pointer to io_t struct
+ *
+ * @returns Free bytes, SIZE_MAX for callback backed io_t's
+ */
+size_t io_space(io_t *io);
+
+/**
+ * Borrow a readable region of at most `*len` bytes.
+ *
+ * For ringbuffer backed io_t's the returned pointer points directly into the
+ * ringbuffer, no data is copied. For callback backed io_t's the read callback
+ * is called to fill an internal staging buffer.
+ *
+ * Every successful acquire has to be followed by io_release_read. If less
+ * bytes are released than were acquired, the remaining bytes are returned
+ * again by the next acquire.
+ *
+ * @param io Pointer to io_t struct
+ * @param len In: max number of bytes wanted. Out: number of bytes available
+ * @param pv Passed to the read callback (usually the audio element)
+ *
+ * @returns
+ *      - Pointer to the readable region
+ *      - NULL if no data is available
+ */
+char *io_acquire_read(io_t *io, size_t *len, void *pv);
+
+/**
+ * Attach data to the current write position of an io_t.
+ *
+ * When the reader gets to this position, `on_marker` is called with a copy
+ * of the data, before any byte after it is read. Reads never cross a
+ * marker, so e.g. a format change applies from exactly this byte on. While
+ * no markers are pending this costs the reader a single atomic load.
+ *
+ * Can be called by another task than the one writing the data if the io_t
+ * is SPSC backed, the marker then goes after all data committed so far. A
+ * ringbuffer counts its data only after queueing it, so there the marker
+ * can land before data being written at that moment; only mark it from the
+ * writing task. Not supported for other backends.
+ *
+ * @param io Pointer to io_t struct
+ * @param data Data to copy into the marker
+ * @param len Length of data, max IO_MARKER_SIZE
+ *
+ * @returns
+ *      - ESP_OK if succesful
+ *      - ESP_ERR_NOT_SUPPORTED if the backend has no byte positions
+ *      - ESP_ERR_INVALID_SIZE if len is too large
+ *      - ESP_ERR_NO_MEM if IO_MAX_MARKERS markers are pending already
+ */
+esp_err_t io_mark(io_t *io, const void *data, size_t len);
+
+/**
+ * Reader: apply the markers the reader has reached, without reading.
+ * io_acquire_read does this as well. Use it to act on a marker before
+ * deciding how much to read.
+ *
+ * @param io Pointer to io_t struct
+ */
+void io_apply_markers(io_t *io);
+
+/**
+ * Release (part of) a region borrowed with io_acquire_read
+ *
+ * @param io Pointer to io_t struct
+ * @param len Number of bytes consumed
+ */
+void io_release_read(io_t *io, size_t len);
+
+/**
+ * Get a writable region of at most `*len` bytes, to be filled in place.
+ *
+ * With the SPSC backend the region points into the ring itself and ends at
+ * the wrap point, so it can be shorter than asked for. Call again after
+ * committing to get the rest.
+ *
+ * @param io Pointer to io_t struct
+ * @param len In: number of bytes wanted. Out: number of bytes writable
+ *
+ * @returns
+ *      - Pointer to the writable region
+ *      - NULL if no region could be acquired
+ */
+char *io_acquire_write(io_t *io, size_t *len);
+
+/**
+ * Commit the first `len` bytes of the region returned by io_acquire_write
+ *
+ * @param io Pointer to io_t struct
+ * @param len Number of bytes filled
+ * @param pv Passed to the write callback (usually the audio element)
+ *
+ * @returns
+ *      - Number of bytes committed
+ *      - IO_WRITE_ERROR if the data could not be written
+ */
+size_t io_commit_write(io_t *io, size_t len, void *pv);
+
 /**
  * Destroy and free io_t struct
  *
@@ -0,0 +1,160 @@
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "hist.h"
+#include "io.h"
+#include "io_trace.h"
+
+static const char TAG[] = "IO_TRACE";
+
+static io_trace_t s_hops[IO_TRACE_MAX_HOPS];
+static io_t *s_path[IO_TRACE_MAX_HOPS];
+static size_t s_count = 0;
+static io_trace_dist_t s_total;
+static int64_t s_interval;      // us
+static int64_t s_last_tag;
+
+
+static void _record(io_trace_dist_t *dist, int64_t latency) {
+    uint32_t us = latency > 0 ? latency : 0;
+
+    hist_add(dist->hist, IO_TRACE_HIST_BUCKETS, us);
+
+    if (!dist->count || us < dist->min)
+        dist->min = us;
+    if (us > dist->max)
+        dist->max = us;
+    dist->total += us;
+    dist->count++;
+}
+
+
+void io_trace_written(io_t *io, size_t len) {
+    io_trace_t *trace = io->trace;
+    int64_t now, t_source;
+
+    if (!len || atomic_load_explicit(&trace->armed, memory_order_acquire))
+        return;
+
+    now = esp_timer_get_time();
+    if (trace->carry) {
+        // Tag handed over by the previous hop
+        t_source = trace->carry_t_source;
+        trace->carry = false;
+    } else if (io == s_path[0] && now - s_last_tag >= s_interval) {
+        // New tag at the source
+        t_source = now;
+        s_last_tag = now;
+    } else {
+        return;
+    }
+
+    // Tag the first byte of this write
+    trace->pos = io->bytes_written - len;
+    trace->t_source = t_source;
+    trace->t_enter = now;
+    atomic_store_explicit(&trace->armed, true, memory_order_release);
+}
+
+
+void io_trace_read(io_t *io) {
+    io_trace_t *trace = io->trace;
+    int64_t now;
+
+    if (!atomic_load_explicit(&trace->armed, memory_order_acquire)
+            || (int32_t)(io->bytes_read - trace->pos) <= 0)
+        return;
+
+    now = esp_timer_get_time();
+    _record(&trace->hop, now - trace->t_enter);
+
+    if (trace->next) {
+        // The reader of this io_t is the writer of the next one
+        trace->next->trace->carry_t_source = trace->t_source;
+        trace->next->trace->carry = true;
+    } else {
+        _record(&s_total, now - trace->t_source);
+    }
+
+    atomic_store_explicit(&trace->armed, false, memory_order_release);
+}
+
+
+esp_err_t io_trace_start(io_t *path[], size_t count, uint32_t interval_ms) {
+    size_t i;
+
+    if (!count || count > IO_TRACE_MAX_HOPS) {
+        ESP_LOGE(TAG, "Path of %d io_t's, a max of %d allowed", count,
+                IO_TRACE_MAX_HOPS);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    io_trace_stop();
+
+    memset(s_hops, 0, sizeof(s_hops));
+    memset(&s_total, 0, sizeof(s_total));
+    s_interval = interval_ms * 1000LL;
+    s_last_tag = 0;
+
+    for (i = 0; i < count; i++) {
+        s_path[i] = path[i];
+        s_hops[i].next = i + 1 < count ? path[i + 1] : NULL;
+        atomic_init(&s_hops[i].armed, false);
+    }
+    s_count = count;
+
+    // Enable tracing only once the whole path is set up
+    for (i = 0; i < count; i++) {
+        path[i]->trace = &s_hops[i];
+    }
+
+    return ESP_OK;
+}
+
+
+void io_trace_stop(void) {
+    for (size_t i = 0; i < s_count; i++) {
+        s_path[i]->trace = NULL;
+    }
+}
+
+
+esp_err_t io_trace_get(int hop, io_trace_dist_t *dist) {
+    if (hop < 0) {
+        memcpy(dist, &s_total, sizeof(io_trace_dist_t));
+    } else if (hop < s_count) {
+        memcpy(dist, &s_hops[hop].hop, sizeof(io_trace_dist_t));
+    } else {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+
+static void _dump(const char *name, io_trace_dist_t *dist) {
+    if (!dist->count) {
+        ESP_LOGI(TAG, "%s: no samples", name);
+        return;
+    }
+    uint32_t p99 = hist_p99(dist->hist, IO_TRACE_HIST_BUCKETS, dist->count,
+            dist->max);
+
+    ESP_LOGI(TAG, "%s: %u tags, us min/avg/p99/max %u/%llu/%u/%u", name,
+            dist->count, dist->min, dist->total / dist->count, p99,
+            dist->max);
+}
+
+
+void io_trace_dump(void) {
+    char name[8];
+
+    if (!s_count)
+        return;
+    for (size_t i = 0; i < s_count; i++) {
+        snprintf(name, sizeof(name), "hop %d", i);
+        _dump(name, &s_hops[i].hop);
+    }
+    _dump("total", &s_total);
+}
@@ -0,0 +1,98 @@
+/**
+ * Latency tracer for a chain of io_t's.
+ *
+ * Every `interval_ms` a tag is put on the byte position of a write to the
+ * first io_t of the path (e.g. the a2dp or sdcard output). When the reader
+ * has read past that position, the time the tag spent in the io_t is
+ * recorded as the latency of that hop, and the tag is carried over to the
+ * next write to the next io_t in the path. When it leaves the last io_t
+ * (e.g. the i2s input) the total latency since the first write is recorded.
+ *
+ * Only one tag is in flight per io_t, and io_t's without tracing only pay
+ * for a NULL check.
+ */
+
+#ifndef IO_TRACE_H
+#define IO_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "esp_err.h"
+
+#define IO_TRACE_MAX_HOPS 4
+#define IO_TRACE_HIST_BUCKETS 24    // Bucket n holds [2^n, 2^(n+1)) us
+
+typedef struct io_ io_t;
+
+/**
+ * Latency distribution, in us
+ */
+typedef struct io_trace_dist {
+    uint32_t    count;
+    uint64_t    total;
+    uint32_t    min;
+    uint32_t    max;
+    uint32_t    hist[IO_TRACE_HIST_BUCKETS];
+} io_trace_dist_t;
+
+typedef struct io_trace {
+    io_t            *next;          // Next io_t in the path, NULL if last
+
+    // Tag in flight in this io_t, written by the writer, then armed
+    atomic_bool     armed;
+    uint32_t        pos;            // Position in the io_t's bytes_written
+    int64_t         t_source;       // Time the tag entered the first io_t
+    int64_t         t_enter;        // Time the tag entered this io_t
+
+    // Tag from the previous hop, placed on the next write to this io_t
+    bool            carry;
+    int64_t         carry_t_source;
+
+    io_trace_dist_t hop;
+} io_trace_t;
+
+
+/**
+ * Start tracing a path of io_t's.
+ *
+ * @param path          io_t's from source to sink, e.g. { a2dp->output,
+ *                      mixer->output }. Every io_t has to be read by the
+ *                      element writing the next one.
+ * @param count         Number of io_t's, max IO_TRACE_MAX_HOPS
+ * @param interval_ms   Time between two tags
+ *
+ * @return
+ *      - ESP_OK if succesful
+ *      - ESP_ERR_INVALID_ARG if the path is too long
+ */
+esp_err_t io_trace_start(io_t *path[], size_t count, uint32_t interval_ms);
+
+/**
+ * Stop tracing. The distributions are kept until the next start.
+ */
+void io_trace_stop(void);
+
+/**
+ * Get the latency distribution of a hop, or the total
+ *
+ * @param hop   Index in the path, or -1 for the total
+ * @param dist  Filled with the distribution
+ *
+ * @return
+ *      - ESP_OK if succesful
+ *      - ESP_ERR_INVALID_ARG if there is no such hop
+ */
+esp_err_t io_trace_get(int hop, io_trace_dist_t *dist);
+
+/**
+ * Log min/avg/p99/max of every hop and the total
+ */
+void io_trace_dump(void);
+
+// Called by io.c, only if io->trace is set
+void io_trace_written(io_t *io, size_t len);
+void io_trace_read(io_t *io);
+
+#endif
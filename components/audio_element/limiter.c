@@ -0,0 +1,130 @@
+#include "limiter.h"
+#include "mix.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+static const char TAG[] = "LIMITER";
+
+
+// Of the formats with headroom in the accumulator, see mix.h
+static int32_t _full_scale(int bits) {
+    switch (bits) {
+        case 8:     return INT8_MAX;
+        case 16:    return INT16_MAX;
+        case 24:    return (1 << 23) - 1;
+        default:    return 0;
+    }
+}
+
+static inline int32_t _min(int32_t a, int32_t b) {
+    return a < b ? a : b;
+}
+
+// Q15 gain that keeps 'peak' at or below the ceiling
+static inline int32_t _required(limiter_t *lim, uint32_t peak) {
+    if (peak <= (uint32_t)lim->ceiling)
+        return MIX_UNITY;
+    return ((int64_t)lim->ceiling << 15) / peak;
+}
+
+/**
+ * The block being filled is complete, so the block after the outgoing one
+ * is known too. Ramp down to whatever either of them needs within the
+ * outgoing block (the attack), or recover towards it (the release).
+ */
+static void _next_block(limiter_t *lim) {
+    int32_t req = _required(lim, lim->peak);
+    int32_t target = _min(lim->req, req);
+
+    lim->gain = lim->gain_end;
+    if (target < lim->gain)
+        lim->gain_end = target;
+    else    // Rounded up, or the last few steps would never be taken
+        lim->gain_end = lim->gain
+            + (((target - lim->gain) * lim->release + 0x7fff) >> 15);
+
+    lim->req = req;
+    lim->half ^= 1;
+    lim->pos = 0;
+    lim->peak = 0;
+    lim->cur = lim->gain << 15;
+    lim->step = ((lim->gain_end - lim->gain) << 15) / (int32_t)lim->block;
+}
+
+
+esp_err_t limiter_init(limiter_t *lim, limiter_cfg_t cfg, int sample_rate,
+        int channels, int bits) {
+    int frames = sample_rate * cfg.attack_ms / 1000;
+
+    free(lim->delay);
+    memset(lim, 0, sizeof(limiter_t));
+    lim->cfg = cfg;
+    lim->req = lim->gain = lim->gain_end = MIX_UNITY;
+    lim->cur = MIX_UNITY << 15;
+
+    if (cfg.mode == LIMITER_CLIP || frames <= 0 || channels <= 0)
+        return ESP_OK;
+    // A 32 bit accumulator saturates at the ceiling, before the limiter
+    // gets to see a peak
+    if (!_full_scale(bits)) {
+        ESP_LOGE(TAG, "No look-ahead limiter at %d bits", bits);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    lim->block = (size_t)frames * channels;
+    lim->delay = calloc(2 * lim->block, sizeof(int32_t));
+    if (!lim->delay) {
+        ESP_LOGE(TAG, "Could not allocate memory!");
+        lim->block = 0;
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (cfg.ceiling_db > 0.f)
+        cfg.ceiling_db = 0.f;
+    lim->ceiling = _full_scale(bits) * powf(10.f, cfg.ceiling_db / 20.f);
+    lim->release = cfg.release_ms > 0 ? lrintf(MIX_UNITY
+            * (1.f - expf(-(float)cfg.attack_ms / cfg.release_ms)))
+        : MIX_UNITY;
+
+    ESP_LOGD(TAG, "Look-ahead of %d frames, ceiling %d", frames,
+            lim->ceiling);
+    return ESP_OK;
+}
+
+
+int32_t limiter_process(limiter_t *lim, int32_t *buf, size_t n) {
+    int32_t min = _min(lim->cur >> 15, lim->gain_end);
+
+    if (!lim->block)
+        return MIX_UNITY;
+
+    for (size_t i = 0; i < n; i++) {
+        int32_t *slot = &lim->delay[lim->half * lim->block + lim->pos];
+        int32_t out = *slot;
+        int32_t x = buf[i];
+        uint32_t mag = x < 0 ? -(uint32_t)x : (uint32_t)x;
+
+        *slot = x;
+        if (mag > lim->peak)
+            lim->peak = mag;
+        buf[i] = ((int64_t)out * (lim->cur >> 15) + (1 << 14)) >> 15;
+        lim->cur += lim->step;
+
+        if (++lim->pos == lim->block) {
+            _next_block(lim);
+            min = _min(min, lim->gain_end);
+        }
+    }
+    return min;
+}
+
+
+void limiter_deinit(limiter_t *lim) {
+    free(lim->delay);
+    lim->delay = NULL;
+    lim->block = 0;
+}
@@ -0,0 +1,101 @@
+/**
+ * Mix bus limiter, working on the int32_t accumulator of the mixer (see
+ * mix.h) before it is stored as output samples.
+ *
+ * LIMITER_CLIP only saturates, which mix_store does anyway. LIMITER_PEAK
+ * is a look-ahead peak limiter: the signal is delayed by two blocks of
+ * `attack_ms`, and the gain is lowered over a whole block before a peak
+ * arrives, so the output never exceeds the ceiling. After a peak the gain
+ * recovers exponentially with `release_ms`.
+ *
+ * It is block-based and fixed-point: the gain is computed once per block
+ * (one division), and ramped linearly within a block (one multiply per
+ * sample).
+ */
+
+#ifndef LIMITER_H
+#define LIMITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef enum {
+    LIMITER_CLIP,   // Hard saturation only, no latency
+    LIMITER_PEAK,   // Look-ahead peak limiter
+} limiter_mode_t;
+
+/**
+ * Limiter configuration
+ */
+typedef struct limiter_cfg {
+    limiter_mode_t  mode;
+    float           ceiling_db;     // Max output level, in dBFS
+    int             attack_ms;      // Look-ahead, the latency is twice this
+    int             release_ms;     // Time constant of the recovery
+} limiter_cfg_t;
+
+#define DEFAULT_LIMITER_CFG() {     \
+    .mode = LIMITER_PEAK,           \
+    .ceiling_db = -0.3f,            \
+    .attack_ms = 2,                 \
+    .release_ms = 100,              \
+}
+
+typedef struct limiter {
+    limiter_cfg_t   cfg;
+    int32_t         *delay;     // Two blocks, filled one after the other
+    size_t          block;      // Samples (not frames) per block
+    size_t          pos;        // Position in the block being filled
+    int             half;       // Block being filled, 0 or 1
+    uint32_t        peak;       // Peak of the block being filled
+    int32_t         ceiling;    // At the scale of the accumulator
+    int32_t         release;    // Q15 coefficient, per block
+    int32_t         req;        // Q15 gain the previous block needs
+    int32_t         gain;       // Q15 gain at the start of the output block
+    int32_t         gain_end;   // Q15 gain at the end of the output block
+    int32_t         step;       // Q30, per sample
+    int32_t         cur;        // Q30, current gain
+} limiter_t;
+
+
+/**
+ * (Re)initialize a limiter for a stream format. Anything in the delay
+ * line is dropped.
+ *
+ * @param lim           Pointer to limiter, zeroed before the first call
+ * @param cfg           Configuration
+ * @param sample_rate   Sample rate of the stream
+ * @param channels      Number of channels
+ * @param bits          Bits per sample of the output, sets the full scale
+ *
+ * @return
+ *      - ESP_OK if successful
+ *      - ESP_ERR_NOT_SUPPORTED for LIMITER_PEAK at 32 bits, where the
+ *        accumulator has no headroom left to limit in. The limiter only
+ *        saturates then.
+ *      - ESP_ERR_NO_MEM if the delay line could not be allocated
+ */
+esp_err_t limiter_init(limiter_t *lim, limiter_cfg_t cfg, int sample_rate,
+        int channels, int bits);
+
+/**
+ * Limit `n` samples in place. With LIMITER_PEAK, the samples returned are
+ * the ones given two blocks earlier.
+ *
+ * @param lim   Pointer to limiter
+ * @param buf   Accumulated samples
+ * @param n     Number of samples
+ *
+ * @return
+ *      - Lowest Q15 gain applied to these samples, MIX_UNITY if none
+ */
+int32_t limiter_process(limiter_t *lim, int32_t *buf, size_t n);
+
+/**
+ * Free the delay line of a limiter
+ */
+void limiter_deinit(limiter_t *lim);
+
+#endif
@@ -0,0 +1,476 @@
+#include <string.h>
+
+#include "mix.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define MIX_SIMD
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MIX_SIMD
+#endif
+
+// Samples staged at a time for blocks that are not aligned
+#define MIX_STAGE_LEN 64
+
+enum {
+    FMT_U8,
+    FMT_S16,
+    FMT_S24,
+    FMT_S32,
+    FMT_COUNT
+};
+
+#define BITS_u8     8
+#define BITS_s16    16
+#define BITS_s24    24
+#define BITS_s32    32
+
+// Unity kernels ignore the gains
+typedef void (*mix_add_fn)(int32_t *acc, const void *src, size_t n,
+        int32_t gain, int32_t step);
+typedef void (*mix_store_fn)(void *dst, const int32_t *acc, size_t n);
+typedef uint32_t (*mix_peak_fn)(const void *src, size_t n);
+
+
+static inline int _format(int bits) {
+    switch (bits) {
+        case 8:     return FMT_U8;
+        case 16:    return FMT_S16;
+        case 24:    return FMT_S24;
+        case 32:    return FMT_S32;
+        default:    return -1;
+    }
+}
+
+static inline int32_t _clamp(int32_t x, int32_t lo, int32_t hi) {
+    return x < lo ? lo : x > hi ? hi : x;
+}
+
+static inline int32_t _sat_add(int32_t a, int32_t b) {
+    int32_t sum;
+    if (__builtin_add_overflow(a, b, &sum))
+        return a < 0 ? INT32_MIN : INT32_MAX;
+    return sum;
+}
+
+// A sample as a signed value, at the scale of its own format
+static inline int32_t _ld_u8(const uint8_t *p, size_t i) {
+    return (int32_t)p[i] - 128;
+}
+static inline int32_t _ld_s16(const int16_t *p, size_t i) {
+    return p[i];
+}
+static inline int32_t _ld_s24(const int32_t *p, size_t i) {
+    return p[i];
+}
+static inline int32_t _ld_s32(const int32_t *p, size_t i) {
+    return p[i];
+}
+
+// Rescale from one format to another, both known at compile time
+#define SCALE(x, from, to) ((to) >= (from)                                  \
+        ? (int32_t)((uint32_t)(x) << (((to) - (from)) & 31))                \
+        : (x) >> (((from) - (to)) & 31))
+
+// Only a 32 bit accumulator has no headroom left
+#define ACC_u8(a, x)    ((a) + (x))
+#define ACC_s16(a, x)   ((a) + (x))
+#define ACC_s24(a, x)   ((a) + (x))
+#define ACC_s32(a, x)   _sat_add((a), (x))
+
+// Times a Q15 gain, rounded. Up to 16 bits the product fits in 32 bits.
+#define MUL_u8(x, g)    (((x) * (g) + (1 << 14)) >> 15)
+#define MUL_s16(x, g)   (((x) * (g) + (1 << 14)) >> 15)
+#define MUL_s24(x, g)   (int32_t)(((int64_t)(x) * (g) + (1 << 14)) >> 15)
+#define MUL_s32(x, g)   (int32_t)(((int64_t)(x) * (g) + (1 << 14)) >> 15)
+
+#define ADD_KERNEL(in, in_t, out)                                           \
+static void _add_##in##_##out(int32_t *acc, const void *src, size_t n,      \
+        int32_t gain, int32_t step) {                                       \
+    const in_t *s = src;                                                    \
+    for (size_t i = 0; i < n; i++) {                                        \
+        int32_t x = SCALE(_ld_##in(s, i), BITS_##in, BITS_##out);           \
+        acc[i] = ACC_##out(acc[i], x);                                      \
+    }                                                                       \
+}
+
+// The gain is interpolated in Q30, 'gain' and 'step' are Q30 as well
+#define GAIN_KERNEL(in, in_t, out)                                          \
+static void _gain_##in##_##out(int32_t *acc, const void *src, size_t n,     \
+        int32_t gain, int32_t step) {                                       \
+    const in_t *s = src;                                                    \
+    for (size_t i = 0; i < n; i++, gain += step) {                          \
+        int32_t x = SCALE(_ld_##in(s, i), BITS_##in, BITS_##out);           \
+        acc[i] = ACC_##out(acc[i], MUL_##out(x, gain >> 15));               \
+    }                                                                       \
+}
+
+#define ADD_KERNELS(in, in_t)                                               \
+    ADD_KERNEL(in, in_t, u8)                                                \
+    ADD_KERNEL(in, in_t, s16)                                               \
+    ADD_KERNEL(in, in_t, s24)                                               \
+    ADD_KERNEL(in, in_t, s32)                                               \
+    GAIN_KERNEL(in, in_t, u8)                                               \
+    GAIN_KERNEL(in, in_t, s16)                                              \
+    GAIN_KERNEL(in, in_t, s24)                                              \
+    GAIN_KERNEL(in, in_t, s32)
+
+ADD_KERNELS(u8, uint8_t)
+ADD_KERNELS(s16, int16_t)
+ADD_KERNELS(s24, int32_t)
+ADD_KERNELS(s32, int32_t)
+
+// Largest magnitude, at the scale of the input's own format
+#define PEAK_KERNEL(in, in_t)                                               \
+static uint32_t _peak_##in(const void *src, size_t n) {                     \
+    const in_t *s = src;                                                    \
+    uint32_t peak = 0;                                                      \
+    for (size_t i = 0; i < n; i++) {                                        \
+        int32_t x = _ld_##in(s, i);                                         \
+        uint32_t mag = x < 0 ? -(uint32_t)x : (uint32_t)x;                  \
+        peak = mag > peak ? mag : peak;                                     \
+    }                                                                       \
+    return peak;                                                            \
+}
+
+PEAK_KERNEL(u8, uint8_t)
+PEAK_KERNEL(s16, int16_t)
+PEAK_KERNEL(s24, int32_t)
+PEAK_KERNEL(s32, int32_t)
+
+
+static void _store_u8(void *dst, const int32_t *acc, size_t n) {
+    uint8_t *d = dst;
+    for (size_t i = 0; i < n; i++) {
+        d[i] = _clamp(acc[i], INT8_MIN, INT8_MAX) + 128;
+    }
+}
+
+static void _store_s16(void *dst, const int32_t *acc, size_t n) {
+    int16_t *d = dst;
+    for (size_t i = 0; i < n; i++) {
+        d[i] = _clamp(acc[i], INT16_MIN, INT16_MAX);
+    }
+}
+
+static void _store_s24(void *dst, const int32_t *acc, size_t n) {
+    int32_t *d = dst;
+    for (size_t i = 0; i < n; i++) {
+        d[i] = _clamp(acc[i], -(1 << 23), (1 << 23) - 1);
+    }
+}
+
+static void _store_s32(void *dst, const int32_t *acc, size_t n) {
+    memcpy(dst, acc, n * sizeof(int32_t));
+}
+
+
+#ifdef MIX_SIMD
+// s16 > s16 is by far the most common (a2dp, wav files), eight at a time
+static void _add_s16_s16_simd(int32_t *acc, const void *src, size_t n,
+        int32_t gain, int32_t step) {
+    const int16_t *s = src;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    for (; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+        // Sign extend by shifting the high halves back down
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+        __m128i *a = (__m128i *)(acc + i);
+        _mm_storeu_si128(a, _mm_add_epi32(_mm_loadu_si128(a), lo));
+        _mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1), hi));
+    }
+#else
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t x = vld1q_s16(s + i);
+        vst1q_s32(acc + i, vaddw_s16(vld1q_s32(acc + i), vget_low_s16(x)));
+        vst1q_s32(acc + i + 4, vaddw_s16(vld1q_s32(acc + i + 4),
+                    vget_high_s16(x)));
+    }
+#endif
+
+    _add_s16_s16(acc + i, s + i, n - i, gain, step);
+}
+
+// A constant gain below unity fits in an int16_t, ramps are left to the
+// scalar kernel
+static void _gain_s16_s16_simd(int32_t *acc, const void *src, size_t n,
+        int32_t gain, int32_t step) {
+    const int16_t *s = src;
+    int16_t g = gain >> 15;
+    size_t i = 0;
+
+    if (step || gain >> 15 >= MIX_UNITY) {
+        _gain_s16_s16(acc, src, n, gain, step);
+        return;
+    }
+
+#if defined(__SSE2__)
+    __m128i gv = _mm_set1_epi16(g);
+    __m128i round = _mm_set1_epi32(1 << 14);
+    for (; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+        // Full 32 bit products from their low and high halves
+        __m128i pl = _mm_mullo_epi16(x, gv);
+        __m128i ph = _mm_mulhi_epi16(x, gv);
+        __m128i lo = _mm_srai_epi32(_mm_add_epi32(
+                    _mm_unpacklo_epi16(pl, ph), round), 15);
+        __m128i hi = _mm_srai_epi32(_mm_add_epi32(
+                    _mm_unpackhi_epi16(pl, ph), round), 15);
+        __m128i *a = (__m128i *)(acc + i);
+        _mm_storeu_si128(a, _mm_add_epi32(_mm_loadu_si128(a), lo));
+        _mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1), hi));
+    }
+#else
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t x = vld1q_s16(s + i);
+        // Rounding shift, like the scalar kernel
+        int32x4_t lo = vrshrq_n_s32(vmull_n_s16(vget_low_s16(x), g), 15);
+        int32x4_t hi = vrshrq_n_s32(vmull_n_s16(vget_high_s16(x), g), 15);
+        vst1q_s32(acc + i, vaddq_s32(vld1q_s32(acc + i), lo));
+        vst1q_s32(acc + i + 4, vaddq_s32(vld1q_s32(acc + i + 4), hi));
+    }
+#endif
+
+    _gain_s16_s16(acc + i, s + i, n - i, gain, step);
+}
+
+static void _store_s16_simd(void *dst, const int32_t *acc, size_t n) {
+    int16_t *d = dst;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    for (; i + 8 <= n; i += 8) {
+        __m128i lo = _mm_loadu_si128((const __m128i *)(acc + i));
+        __m128i hi = _mm_loadu_si128((const __m128i *)(acc + i + 4));
+        // Packing saturates
+        _mm_storeu_si128((__m128i *)(d + i), _mm_packs_epi32(lo, hi));
+    }
+#else
+    for (; i + 8 <= n; i += 8) {
+        vst1q_s16(d + i, vcombine_s16(vqmovn_s32(vld1q_s32(acc + i)),
+                    vqmovn_s32(vld1q_s32(acc + i + 4))));
+    }
+#endif
+
+    _store_s16(d + i, acc + i, n - i);
+}
+#endif
+
+
+// [input][output], at unity gain
+static const mix_add_fn s_add[FMT_COUNT][FMT_COUNT] = {
+    [FMT_U8] =  { _add_u8_u8, _add_u8_s16, _add_u8_s24, _add_u8_s32 },
+#ifdef MIX_SIMD
+    [FMT_S16] = { _add_s16_u8, _add_s16_s16_simd, _add_s16_s24,
+                  _add_s16_s32 },
+#else
+    [FMT_S16] = { _add_s16_u8, _add_s16_s16, _add_s16_s24, _add_s16_s32 },
+#endif
+    [FMT_S24] = { _add_s24_u8, _add_s24_s16, _add_s24_s24, _add_s24_s32 },
+    [FMT_S32] = { _add_s32_u8, _add_s32_s16, _add_s32_s24, _add_s32_s32 },
+};
+
+static const mix_add_fn s_gain[FMT_COUNT][FMT_COUNT] = {
+    [FMT_U8] =  { _gain_u8_u8, _gain_u8_s16, _gain_u8_s24, _gain_u8_s32 },
+#ifdef MIX_SIMD
+    [FMT_S16] = { _gain_s16_u8, _gain_s16_s16_simd, _gain_s16_s24,
+                  _gain_s16_s32 },
+#else
+    [FMT_S16] = { _gain_s16_u8, _gain_s16_s16, _gain_s16_s24,
+                  _gain_s16_s32 },
+#endif
+    [FMT_S24] = { _gain_s24_u8, _gain_s24_s16, _gain_s24_s24,
+                  _gain_s24_s32 },
+    [FMT_S32] = { _gain_s32_u8, _gain_s32_s16, _gain_s32_s24,
+                  _gain_s32_s32 },
+};
+
+static const mix_store_fn s_store[FMT_COUNT] = {
+    _store_u8,
+#ifdef MIX_SIMD
+    _store_s16_simd,
+#else
+    _store_s16,
+#endif
+    _store_s24,
+    _store_s32,
+};
+
+
+bool mix_add(int32_t *acc, const void *src, size_t n, int in_bits,
+        int out_bits, int32_t gain, int32_t gain_end) {
+    int in = _format(in_bits), out = _format(out_bits);
+    size_t bytes = mix_bytes_per_sample(in_bits);
+    int32_t stage[MIX_STAGE_LEN];
+    int32_t step;
+    size_t len;
+
+    if (in < 0 || out < 0)
+        return false;
+    if (!n || (gain == 0 && gain_end == 0))
+        return true;
+
+    mix_add_fn add = s_add[in][out];
+    if (gain != MIX_UNITY || gain_end != MIX_UNITY)
+        add = s_gain[in][out];
+
+    // Interpolate in Q30, the last sample gets just below 'gain_end'
+    step = (int32_t)(((int64_t)(gain_end - gain) << 15) / (int64_t)n);
+    gain <<= 15;
+
+    if ((uintptr_t)src % bytes == 0) {
+        add(acc, src, n, gain, step);
+        return true;
+    }
+
+    // Word loads would fault on the esp32, copy to an aligned buffer first
+    for (; n; n -= len, acc += len, src = (const char *)src + len * bytes) {
+        len = n < MIX_STAGE_LEN ? n : MIX_STAGE_LEN;
+        memcpy(stage, src, len * bytes);
+        add(acc, stage, len, gain, step);
+        gain += step * (int32_t)len;
+    }
+    return true;
+}
+
+static const mix_peak_fn s_peak[FMT_COUNT] = {
+    _peak_u8,
+    _peak_s16,
+    _peak_s24,
+    _peak_s32,
+};
+
+
+bool mix_store(void *dst, const int32_t *acc, size_t n, int out_bits) {
+    int out = _format(out_bits);
+    size_t bytes = mix_bytes_per_sample(out_bits);
+    int32_t stage[MIX_STAGE_LEN];
+    size_t len;
+
+    if (out < 0)
+        return false;
+    mix_store_fn store = s_store[out];
+
+    if ((uintptr_t)dst % bytes == 0) {
+        store(dst, acc, n);
+        return true;
+    }
+
+    for (; n; n -= len, acc += len, dst = (char *)dst + len * bytes) {
+        len = n < MIX_STAGE_LEN ? n : MIX_STAGE_LEN;
+        store(stage, acc, len);
+        memcpy(dst, stage, len * bytes);
+    }
+    return true;
+}
+
+uint32_t mix_peak(const void *src, size_t n, int bits) {
+    int in = _format(bits);
+    size_t bytes = mix_bytes_per_sample(bits);
+    int32_t stage[MIX_STAGE_LEN];
+    uint32_t peak = 0, p;
+    size_t len;
+
+    if (in < 0)
+        return 0;
+
+    if ((uintptr_t)src % bytes == 0) {
+        peak = s_peak[in](src, n);
+    } else {
+        for (; n; n -= len, src = (const char *)src + len * bytes) {
+            len = n < MIX_STAGE_LEN ? n : MIX_STAGE_LEN;
+            memcpy(stage, src, len * bytes);
+            p = s_peak[in](stage, len);
+            peak = p > peak ? p : peak;
+        }
+    }
+    // To 16 bits, so a full scale sample is MIX_UNITY
+    return bits < 16 ? peak << (16 - bits) : peak >> (bits - 16);
+}
+
+
+bool mix_matrix_init(mix_matrix_t *m, int in_ch, int out_ch,
+        const int32_t *coef) {
+    bool pass = in_ch == out_ch, dup = in_ch == 1, sum = false;
+
+    if (in_ch < 1 || in_ch > MIX_MAX_CHANNELS
+            || out_ch < 1 || out_ch > MIX_MAX_CHANNELS)
+        return false;
+
+    memset(m, 0, sizeof(mix_matrix_t));
+    m->in_ch = in_ch;
+    m->out_ch = out_ch;
+    for (int o = 0; o < out_ch; o++) {
+        for (int i = 0; i < in_ch; i++) {
+            if (coef)
+                m->coef[o][i] = coef[o * in_ch + i];
+            else if (in_ch == 2 && out_ch == 1)
+                m->coef[o][i] = MIX_UNITY / 2;
+            else
+                m->coef[o][i] = (in_ch == 1 || i == o) ? MIX_UNITY : 0;
+
+            pass &= m->coef[o][i] == (i == o ? MIX_UNITY : 0);
+            dup &= m->coef[o][i] == MIX_UNITY;
+        }
+    }
+    sum = in_ch == 2 && out_ch == 1 && m->coef[0][0] == MIX_UNITY / 2
+        && m->coef[0][1] == MIX_UNITY / 2;
+
+    m->map = pass ? MIX_MAP_PASS : dup ? MIX_MAP_DUP : sum ? MIX_MAP_SUM
+        : MIX_MAP_MATRIX;
+    return true;
+}
+
+void mix_matrix_add(int32_t *acc, const int32_t *src, size_t frames,
+        const mix_matrix_t *m) {
+    int in_ch = m->in_ch, out_ch = m->out_ch;
+
+    switch (m->map) {
+        case MIX_MAP_PASS:
+            for (size_t i = 0; i < frames * out_ch; i++) {
+                acc[i] = _sat_add(acc[i], src[i]);
+            }
+            break;
+
+        case MIX_MAP_DUP:
+            if (out_ch == 2) {
+                for (size_t i = 0; i < frames; i++) {
+                    acc[2*i] = _sat_add(acc[2*i], src[i]);
+                    acc[2*i + 1] = _sat_add(acc[2*i + 1], src[i]);
+                }
+                break;
+            }
+            for (size_t i = 0; i < frames; i++, acc += out_ch) {
+                for (int o = 0; o < out_ch; o++) {
+                    acc[o] = _sat_add(acc[o], src[i]);
+                }
+            }
+            break;
+
+        case MIX_MAP_SUM:
+            // Halves first, the sum of two int32_t would not fit
+            for (size_t i = 0; i < frames; i++) {
+                acc[i] = _sat_add(acc[i], (src[2*i] >> 1) + (src[2*i + 1] >> 1)
+                        + (src[2*i] & src[2*i + 1] & 1));
+            }
+            break;
+
+        case MIX_MAP_MATRIX:
+            for (size_t i = 0; i < frames; i++, acc += out_ch, src += in_ch) {
+                for (int o = 0; o < out_ch; o++) {
+                    int64_t y = 0;
+                    for (int c = 0; c < in_ch; c++) {
+                        y += (int64_t)src[c] * m->coef[o][c];
+                    }
+                    y = (y + (1 << 14)) >> 15;
+                    acc[o] = _sat_add(acc[o], y < INT32_MIN ? INT32_MIN
+                            : y > INT32_MAX ? INT32_MAX : (int32_t)y);
+                }
+            }
+            break;
+    }
+}
@@ -0,0 +1,148 @@
+/**
+ * Mixing kernels.
+ *
+ * Samples are mixed in an int32_t accumulator at the scale of the output
+ * format: mix_add converts a block of input samples and adds it to the
+ * accumulator, mix_store converts the accumulator back into output samples,
+ * saturating at the limits of the output format.
+ *
+ * There is a kernel for every (input, output) format pair, with the scaling
+ * between the two fixed at compile time. The formats follow the `bits` of
+ * audio_element_info_t:
+ *  - 8: unsigned, one byte per sample
+ *  - 16: signed, two bytes per sample
+ *  - 24: signed, right aligned in a 32 bit word (like the i2s driver wants)
+ *  - 32: signed, 32 bit word
+ *
+ * Input samples are multiplied by a Q15 gain before they are added, once
+ * per sample. The gain can ramp linearly over a block, for click-free
+ * changes. At MIX_UNITY the multiply is skipped.
+ *
+ * Inputs with another channel layout than the output go through a channel
+ * matrix (mix_matrix_add), from an int32_t buffer at the output scale.
+ * Common layouts have their own kernels, a full matrix multiply is only
+ * the fallback.
+ *
+ * Blocks that are not aligned to their sample size are handled too, but
+ * aligned blocks are faster. On the host the 16 bit kernels use SSE2 or
+ * NEON when available.
+ */
+
+#ifndef MIX_H
+#define MIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MIX_UNITY (1 << 15)     // Q15 gain of 1.0, the max
+#define MIX_MAX_CHANNELS 8
+
+typedef enum {
+    MIX_MAP_PASS,       // Same layout, added as is
+    MIX_MAP_DUP,        // Mono to every output channel
+    MIX_MAP_SUM,        // Stereo to mono, at half the sum
+    MIX_MAP_MATRIX,     // Anything else
+} mix_map_t;
+
+/**
+ * Channel matrix from `in_ch` to `out_ch` interleaved channels. coef holds
+ * a Q15 gain for every [out][in] pair.
+ */
+typedef struct mix_matrix {
+    mix_map_t   map;
+    int         in_ch;
+    int         out_ch;
+    int32_t     coef[MIX_MAX_CHANNELS][MIX_MAX_CHANNELS];
+} mix_matrix_t;
+
+/**
+ * Bytes used by a sample of `bits` bits, 0 if the format is not supported
+ */
+static inline size_t mix_bytes_per_sample(int bits) {
+    switch (bits) {
+        case 8:     return 1;
+        case 16:    return 2;
+        case 24:
+        case 32:    return 4;
+        default:    return 0;
+    }
+}
+
+/**
+ * Add `n` samples to the accumulator, times a gain that goes linearly from
+ * `gain` at the first sample to `gain_end` after the last one
+ *
+ * @param acc       Accumulator, at the scale of `out_bits`
+ * @param src       Input samples
+ * @param n         Number of samples
+ * @param in_bits   Format of the input samples
+ * @param out_bits  Format of the output, and thus the accumulator
+ * @param gain      Q15 gain at the start of the block, 0 to MIX_UNITY
+ * @param gain_end  Q15 gain at the end of the block, 0 to MIX_UNITY
+ *
+ * @return
+ *      - true if successful
+ *      - false if either format is not supported, nothing is added then
+ */
+bool mix_add(int32_t *acc, const void *src, size_t n, int in_bits,
+        int out_bits, int32_t gain, int32_t gain_end);
+
+/**
+ * Store `n` accumulated samples as output samples, saturating
+ *
+ * @param dst       Output samples
+ * @param acc       Accumulator
+ * @param n         Number of samples
+ * @param out_bits  Format of the output samples
+ *
+ * @return
+ *      - true if successful
+ *      - false if the format is not supported, nothing is stored then
+ */
+bool mix_store(void *dst, const int32_t *acc, size_t n, int out_bits);
+
+/**
+ * Largest magnitude of `n` samples, scaled so full scale is MIX_UNITY, for
+ * level meters and the like
+ *
+ * @param src       Samples
+ * @param n         Number of samples
+ * @param bits      Format of the samples
+ *
+ * @return
+ *      - Peak, 0 to MIX_UNITY. 0 if the format is not supported.
+ */
+uint32_t mix_peak(const void *src, size_t n, int bits);
+
+/**
+ * Set up a channel matrix, and pick the fastest kernel for it
+ *
+ * Without `coef`, the default layout is used: mono is copied to every
+ * output channel, stereo to mono is half the sum, otherwise the channels
+ * are passed on in order, and outputs with no matching input are silent.
+ *
+ * @param m         Pointer to matrix
+ * @param in_ch     Input channels, 1 to MIX_MAX_CHANNELS
+ * @param out_ch    Output channels, 1 to MIX_MAX_CHANNELS
+ * @param coef      Q15 gains, out_ch rows of in_ch gains each, or NULL
+ *
+ * @return
+ *      - true if successful
+ *      - false if a channel count is out of range
+ */
+bool mix_matrix_init(mix_matrix_t *m, int in_ch, int out_ch,
+        const int32_t *coef);
+
+/**
+ * Add `frames` frames through a channel matrix, saturating
+ *
+ * @param acc       Accumulator, `out_ch` channels
+ * @param src       Samples at the scale of the accumulator, `in_ch` channels
+ * @param frames    Number of frames
+ * @param m         Channel matrix
+ */
+void mix_matrix_add(int32_t *acc, const int32_t *src, size_t frames,
+        const mix_matrix_t *m);
+
+#endif
@@ -3,147 +3,702 @@
 #include "mixer.h"
 #include "audio_element.h"
 #include "io.h"
+#include "mix.h"
+#include "polyphase.h"
+
+#include <math.h>
+#include <stdatomic.h>
+#include <string.h>
 
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 
 static const char TAG[] = "MIXER";
 
+// A gain request packed in 32 bits, so it is set and taken atomically
+#define GAIN_PENDING        (1u << 31)
+#define GAIN_RAMP_SHIFT     16
+#define GAIN_RAMP_MAX       0x7fff  // ms
+#define GAIN_CDB_MASK       0xffff  // Attenuation in 1/100 dB
+
+/**
+ * Gain of an input or of the master. The ramp runs in dB, so it sounds
+ * even over its whole length. It is advanced once per block, the kernels
+ * interpolate linearly within a block.
+ */
+typedef struct {
+    atomic_uint request;    // Set by mixer_set_gain, taken by the process
+    float    db;            // Current gain, MIXER_GAIN_MIN_DB when muted
+    float    target;        // dB
+    float    step;          // dB per sample, 0 if not ramping
+    int32_t  q15;           // Current gain, Q15
+} mixer_gain_t;
+
+/**
+ * Ducking of an input, and its level as seen by the inputs it ducks. The
+ * target and step are worked out once per block, the gain moves along
+ * with the samples read, all in Q30.
+ */
+typedef struct {
+    int32_t  gain;          // Current duck gain
+    int32_t  target;
+    int32_t  step;          // Per sample, towards the target
+    uint32_t peak;          // Q15 level in this block, after the gain
+    int32_t  hold;          // Samples the input still counts as playing
+    bool     sidechain;     // Ducks another input, so its level is needed
+} mixer_duck_t;
+
+// A channel matrix set with mixer_set_matrix, for one pair of layouts
+typedef struct {
+    int      in_ch;         // 0 for the default matrix
+    int      out_ch;
+    int32_t  coef[MIX_MAX_CHANNELS * MIX_MAX_CHANNELS];
+} mixer_layout_t;
+
+/**
+ * The table of inputs. mixer_add_input and mixer_remove_input publish a
+ * new copy, the process takes it at the start of a block and frees it, so
+ * it never waits for a lock.
+ */
 typedef struct {
     io_t     *inputs[MIXER_MAX_INPUTS];
-    uint16_t volumes[MIXER_MAX_INPUTS];
-    size_t   count;
+    uint32_t ids[MIXER_MAX_INPUTS];     // Tells a new input from an old one
+    int      fade_ms[MIXER_MAX_INPUTS]; // Leaving if >= 0, fading out first
+} mixer_table_t;
+
+typedef struct {
+    io_t     *inputs[MIXER_MAX_INPUTS];     // Being mixed, NULL if none
+    uint32_t ids[MIXER_MAX_INPUTS];
+    bool     leaving[MIXER_MAX_INPUTS];
+    mixer_table_t shadow;   // Latest table, only used with 'lock' held
+    uint32_t last_id;       // Likewise
+    uint32_t removing;      // Likewise, inputs a remover waits for
+    _Atomic(mixer_table_t *) next;  // Published, not taken yet
+    atomic_uint released;   // Inputs done fading out, one bit each
+    SemaphoreHandle_t lock; // Serializes adds and removes
+    audio_element_info_t infos[MIXER_MAX_INPUTS];  // Last snapshots
+    audio_element_info_t out_info;
+    mixer_gain_t gains[MIXER_MAX_INPUTS];
+    mixer_gain_t master;
+    polyphase_t resamplers[MIXER_MAX_INPUTS];
+    mix_matrix_t matrices[MIXER_MAX_INPUTS];
+    mixer_layout_t layouts[MIXER_MAX_INPUTS];       // Set by the user
+    int32_t  scratch[MIXER_BUF_LEN];    // An input at its own format
+    int32_t  resampled[MIXER_BUF_LEN];  // At the output rate, own layout
+    int      rate;          // Output rate, MIXER_RATE_AUTO for the highest
+    int      channels;      // Output channels, MIXER_CHANNELS_AUTO for input 0
+    int      bits;          // Output format, MIXER_BITS_AUTO for the deepest
+    int      period_ms;     // MIXER_PERIOD_FREE to mix what the inputs have
+    atomic_uint underruns[MIXER_MAX_INPUTS];    // Periods filled with silence
+    limiter_t limiter;
+    atomic_int reduction;   // Lowest Q15 limiter gain since the last read
+    atomic_int priorities[MIXER_MAX_INPUTS];
+    mixer_duck_t ducks[MIXER_MAX_INPUTS];
+    mixer_duck_cfg_t duck_cfg;
+    int32_t  duck_depth;    // Q15
+    int32_t  duck_threshold;    // Q15
 } mixer_t;
 
 
-// Create signed 32-bit integer from a 'byte_count' length sample
-int32_t buffer_to_sample(int offset, char *arr, size_t byte_count,
-        bool big_endian) {
-    int32_t out = 0;
-    int i;
+static int32_t _q15(float db) {
+    if (db <= MIXER_GAIN_MIN_DB)
+        return 0;
+    if (db >= 0.f)
+        return MIX_UNITY;
+    return lrintf(MIX_UNITY * powf(10.f, db / 20.f));
+}
+
+static inline int32_t _q15_mul(int32_t a, int32_t b) {
+    return (a * b + (1 << 14)) >> 15;
+}
+
+// Back to 0 dB, a pending request is kept
+static void _gain_reset(mixer_gain_t *gain) {
+    gain->db = gain->target = 0.f;
+    gain->step = 0.f;
+    gain->q15 = MIX_UNITY;
+}
+
+static void _gain_init(mixer_gain_t *gain) {
+    atomic_init(&gain->request, 0);
+    _gain_reset(gain);
+}
+
+// Ramp to 'db' in 'ramp_ms'. 'rate' is in samples (not frames) per second.
+static void _gain_ramp(mixer_gain_t *gain, float db, int ramp_ms, int rate) {
+    gain->target = db;
+    if (!ramp_ms || rate <= 0 || gain->target == gain->db) {
+        gain->db = gain->target;
+        gain->step = 0.f;
+        gain->q15 = _q15(gain->db);
+        return;
+    }
+    gain->step = (gain->target - gain->db) / (ramp_ms * (rate / 1000.f));
+}
+
+// Take a new request, if any
+static void _gain_update(mixer_gain_t *gain, int rate) {
+    uint32_t request = atomic_exchange_explicit(&gain->request, 0,
+            memory_order_acquire);
+
+    if (!request)
+        return;
+    _gain_ramp(gain, -(float)(request & GAIN_CDB_MASK) / 100.f,
+            (request >> GAIN_RAMP_SHIFT) & GAIN_RAMP_MAX, rate);
+}
+
+// dB after 'n' more samples
+static inline float _gain_db_after(mixer_gain_t *gain, size_t n) {
+    float db = gain->db + gain->step * n;
+    if ((gain->step > 0.f && db > gain->target)
+            || (gain->step < 0.f && db < gain->target))
+        return gain->target;
+    return db;
+}
+
+// Q15 gain after 'n' more samples, without moving the ramp
+static int32_t _gain_peek(mixer_gain_t *gain, size_t n) {
+    return gain->step == 0.f ? gain->q15 : _q15(_gain_db_after(gain, n));
+}
+
+// Move the ramp 'n' samples, returns the new Q15 gain
+static int32_t _gain_advance(mixer_gain_t *gain, size_t n) {
+    if (gain->step == 0.f)
+        return gain->q15;
+
+    gain->db = _gain_db_after(gain, n);
+    if (gain->db == gain->target)
+        gain->step = 0.f;
+    gain->q15 = _q15(gain->db);
+    return gain->q15;
+}
+
+
+static void _duck_reset(mixer_duck_t *duck) {
+    memset(duck, 0, sizeof(mixer_duck_t));
+    duck->gain = duck->target = MIX_UNITY << 15;
+}
+
+// Q15 duck gain after 'n' more samples
+static int32_t _duck_peek(mixer_duck_t *duck, size_t n) {
+    int64_t gain = duck->gain + (int64_t)duck->step * n;
+
+    if ((duck->step > 0 && gain > duck->target)
+            || (duck->step < 0 && gain < duck->target))
+        gain = duck->target;
+    return gain >> 15;
+}
+
+// Move the ramp 'n' samples, returns the new Q15 duck gain
+static int32_t _duck_advance(mixer_duck_t *duck, size_t n) {
+    duck->gain = _duck_peek(duck, n) << 15;
+    if (duck->gain == duck->target)
+        duck->step = 0;
+    return duck->gain >> 15;
+}
+
+
+/**
+ * Make sure the channel matrix of an input matches its layout and the
+ * output's. Returns false if the input cannot be mixed.
+ */
+static bool _mixer_matrix(audio_element_t *el, int i_input) {
+    mixer_t *mixer = el->data;
+    mix_matrix_t *m = &mixer->matrices[i_input];
+    mixer_layout_t *layout = &mixer->layouts[i_input];
+    int in_ch = mixer->infos[i_input].channels,
+        out_ch = mixer->out_info.channels;
+
+    if (m->in_ch == in_ch && m->out_ch == out_ch)
+        return true;
+
+    // A matrix set for other layouts is kept for when they come back
+    if (!mix_matrix_init(m, in_ch, out_ch, layout->in_ch == in_ch
+                && layout->out_ch == out_ch ? layout->coef : NULL)) {
+        ESP_LOGW(TAG, "[%s] Input %d: %d to %d channels not supported",
+                el->tag, i_input, in_ch, out_ch);
+        return false;
+    }
+    ESP_LOGD(TAG, "[%s] Input %d: %d to %d channels, map %d", el->tag,
+            i_input, in_ch, out_ch, m->map);
+    return true;
+}
+
+
+/**
+ * Read up to 'n' samples of an input, in whole units of 'align' bytes, and
+ * add them to 'acc' at the scale of the output. The gain of the input and
+ * the master gain ramp along. The wrapped part of a ring is taken too, so
+ * an input only comes up short when it has no more data.
+ *
+ * Returns the number of samples added to 'acc'.
+ */
+static size_t _mixer_read(audio_element_t *el, int i_input, int32_t *acc,
+        size_t n, size_t align, int out_bits) {
+    mixer_t *mixer = el->data;
+    io_t *input = mixer->inputs[i_input];
+    audio_element_info_t *info = &mixer->infos[i_input];
+    mixer_gain_t *gain = &mixer->gains[i_input];
+    mixer_duck_t *duck = &mixer->ducks[i_input];
+    size_t bytes_per_sample = mix_bytes_per_sample(info->bits),
+           limit = n * bytes_per_sample,
+           done = 0,
+           len,
+           samples;
+    int32_t start, end;
+    uint32_t peak;
+    char *data;
 
-    arr += offset;
-    if (big_endian) {
-        for (i = 0; i < byte_count; i++) {
-            out = (out << 8) | arr[i];
+    // Never more than buf_len per input per call
+    if (limit > el->buf_len)
+        limit = el->buf_len;
+    limit -= limit % align;
+
+    while (done < limit) {
+        len = limit - done;
+        data = io_acquire_read(input, &len, el);
+        // Leave a partial unit for the next round
+        len -= len % align;
+        if (!data || !len)
+            break;
+
+        // The master ramp is counted in output samples, for a resampled
+        // input this is close enough
+        samples = len / bytes_per_sample;
+        start = _q15_mul(gain->q15, duck->gain >> 15);
+        end = _q15_mul(_gain_advance(gain, samples),
+                _duck_advance(duck, samples));
+        if (duck->sidechain) {
+            peak = mix_peak(data, samples, info->bits)
+                * (uint64_t)(start > end ? start : end) >> 15;
+            duck->peak = peak > duck->peak ? peak : duck->peak;
         }
-    } else {
-        for (i = byte_count-1; i >= 0; i--) {
-            out = (out << 8) | arr[i];
+        mix_add(acc, data, samples, info->bits, out_bits,
+                _q15_mul(start,
+                    _gain_peek(&mixer->master, done / bytes_per_sample)),
+                _q15_mul(end, _gain_peek(&mixer->master,
+                        done / bytes_per_sample + samples)));
+        io_release_read(input, len);
+
+        acc += samples;
+        done += len;
+    }
+    return done / bytes_per_sample;
+}
+
+
+/**
+ * Add an input that is not at the output rate or channel layout to
+ * 'output'. Its samples are first converted to the output scale in
+ * 'scratch'. From there they are resampled into 'resampled' and then added
+ * through the input's channel matrix. Only as many input frames are read
+ * as the resampler takes.
+ *
+ * Returns the number of samples added to 'output'.
+ */
+static size_t _mixer_convert(audio_element_t *el, int i_input,
+        int32_t *output, size_t samples_limit, int out_bits) {
+    mixer_t *mixer = el->data;
+    audio_element_info_t *info = &mixer->infos[i_input];
+    polyphase_t *pp = &mixer->resamplers[i_input];
+    mix_matrix_t *m = &mixer->matrices[i_input];
+    int in_ch = info->channels,
+        out_rate = mixer->out_info.sample_rate;
+    bool resample = info->sample_rate != out_rate;
+    size_t frame_bytes = mix_bytes_per_sample(info->bits) * in_ch,
+           max_frames = samples_limit / m->out_ch,
+           budget = el->buf_len / frame_bytes,
+           in_frames,
+           frames,
+           used,
+           n;
+    esp_err_t ret;
+
+    if (max_frames > MIXER_BUF_LEN / in_ch)
+        max_frames = MIXER_BUF_LEN / in_ch;
+
+    if (!resample) {
+        memset(mixer->scratch, 0, max_frames * in_ch * sizeof(int32_t));
+        frames = _mixer_read(el, i_input, mixer->scratch, max_frames * in_ch,
+                frame_bytes, out_bits) / in_ch;
+        mix_matrix_add(output, mixer->scratch, frames, m);
+        return frames * m->out_ch;
+    }
+
+    // The filter state is kept until the input's format changes
+    if (pp->in_rate != info->sample_rate || pp->out_rate != out_rate
+            || pp->channels != in_ch) {
+        ESP_LOGD(TAG, "[%s] Input %d: resampling %d Hz to %d Hz", el->tag,
+                i_input, info->sample_rate, out_rate);
+        ret = polyphase_init(pp, info->sample_rate, out_rate, in_ch,
+                MIXER_RESAMPLE_QUALITY);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "[%s] Input %d: cannot resample %d Hz to %d Hz: "
+                    "%s, leaving it unread", el->tag, i_input,
+                    info->sample_rate, out_rate, esp_err_to_name(ret));
+            // Not tried again until the format changes
+            pp->in_rate = info->sample_rate;
+            pp->out_rate = out_rate;
+            pp->channels = in_ch;
         }
     }
+    if (!pp->coefs)
+        return 0;
 
-    uint32_t mask = (1<<8*byte_count) - 1;
-    if (out & (1 << (8*byte_count-1))) {
-        out = (~out + 1) & mask;
-        out = -out;
+    // The first windows take input without giving output, and at most
+    // POLYPHASE_BLOCK frames are taken per call. Keep reading until the
+    // block is full or the input runs short, never more than it all takes.
+    frames = 0;
+    while (frames < max_frames) {
+        in_frames = polyphase_frames_needed(pp, max_frames - frames);
+        if (in_frames > POLYPHASE_BLOCK)
+            in_frames = POLYPHASE_BLOCK;
+        if (in_frames > budget)
+            in_frames = budget;
+        if (in_frames) {
+            memset(mixer->scratch, 0, in_frames * in_ch * sizeof(int32_t));
+            in_frames = _mixer_read(el, i_input, mixer->scratch,
+                    in_frames * in_ch, frame_bytes, out_bits) / in_ch;
+            budget -= in_frames;
+        }
+        n = polyphase_process(pp, mixer->scratch, in_frames, &used,
+                mixer->resampled + frames * in_ch, max_frames - frames);
+        if (!n)
+            break;
+        frames += n;
     }
+    mix_matrix_add(output, mixer->resampled, frames, m);
 
-    return out;
+    return frames * m->out_ch;
 }
 
-// Write 32-bit integer to data array, handling 'byte_count' bytes per sample
-void sample_to_buffer(int32_t sample, int offset, char *arr,
-        size_t byte_count, bool big_endian) {
-    int i;
-    arr += offset;
-
-    uint32_t mask = (1<<8*byte_count) - 1;
-    if (sample < 0) {
-        sample = -sample;
-        sample = (~sample + 1) & mask;
-    }
-    
-    if (big_endian) {
-        for (i = byte_count-1; i >= 0; i--) {
-            arr[i] = (sample & 0xff);
-            sample >>= 8;
+
+/**
+ * Work out for this block which inputs are ducked, and how fast their duck
+ * gain moves. An input is ducked while one with a higher priority played
+ * in the previous block, or in the hold time after it. Only inputs that
+ * can duck another one get their level measured.
+ */
+static void _mixer_duck(mixer_t *mixer) {
+    mixer_duck_cfg_t *cfg = &mixer->duck_cfg;
+    audio_element_info_t *info;
+    mixer_duck_t *duck;
+    int priorities[MIXER_MAX_INPUTS];
+    int32_t range = (MIX_UNITY - mixer->duck_depth) << 15,
+            step;
+    int64_t samples;
+    bool ducked;
+    int i, j;
+
+    for (i = 0; i < MIXER_MAX_INPUTS; i++) {
+        priorities[i] = atomic_load_explicit(&mixer->priorities[i],
+                memory_order_relaxed);
+        mixer->ducks[i].sidechain = false;
+    }
+
+    for (i = 0; i < MIXER_MAX_INPUTS; i++) {
+        if (!mixer->inputs[i])
+            continue;
+        duck = &mixer->ducks[i];
+        info = &mixer->infos[i];
+
+        ducked = false;
+        for (j = 0; j < MIXER_MAX_INPUTS; j++) {
+            if (!mixer->inputs[j] || priorities[j] <= priorities[i])
+                continue;
+            mixer->ducks[j].sidechain = true;
+            ducked |= mixer->ducks[j].hold > 0;
         }
-    } else {
-        for (i = 0; i < byte_count; i++) {
-            arr[i] = (sample & 0xff);
-            sample >>= 8;
+
+        duck->target = ducked ? mixer->duck_depth << 15 : MIX_UNITY << 15;
+        if (duck->target == duck->gain) {
+            duck->step = 0;
+            continue;
+        }
+        // In the input's own samples, like its gain
+        samples = (int64_t)info->sample_rate * info->channels
+            * (duck->target < duck->gain ? cfg->attack_ms : cfg->release_ms)
+            / 1000;
+        step = samples > 0 ? range / samples : range;
+        if (!step)
+            step = 1;
+        duck->step = duck->target < duck->gain ? -step : step;
+    }
+}
+
+// After a block of 'samples' output samples, see which inputs played
+static void _mixer_duck_levels(mixer_t *mixer, size_t samples) {
+    mixer_duck_t *duck;
+    int32_t hold = (int64_t)mixer->out_info.sample_rate
+        * mixer->out_info.channels * mixer->duck_cfg.hold_ms / 1000;
+
+    for (int i = 0; i < MIXER_MAX_INPUTS; i++) {
+        duck = &mixer->ducks[i];
+        if (!mixer->inputs[i] || !duck->sidechain) {
+            duck->hold = 0;
+        } else if (duck->peak && duck->peak >= mixer->duck_threshold) {
+            // At least through the next block
+            duck->hold = hold > 0 ? hold : 1;
+        } else {
+            duck->hold = duck->hold > samples ? duck->hold - samples : 0;
         }
+        duck->peak = 0;
+    }
+}
+
+
+/**
+ * Whether every input has a period of 'samples' output samples ready
+ */
+static bool _mixer_ready(mixer_t *mixer, size_t samples) {
+    audio_element_info_t *info;
+    size_t need;
+
+    for (size_t i = 0; i < MIXER_MAX_INPUTS; i++) {
+        if (!mixer->inputs[i])
+            continue;
+        info = &mixer->infos[i];
+        // Roughly, the resampler keeps a few frames of its own
+        need = (uint64_t)samples * info->sample_rate
+            / mixer->out_info.sample_rate * info->channels
+            / mixer->out_info.channels * mix_bytes_per_sample(info->bits);
+        if (io_fill(mixer->inputs[i]) < need)
+            return false;
     }
+    return true;
 }
 
 
-// TODO: Support big endian? 
+/**
+ * Take the latest table of inputs, if one was published. New inputs start
+ * from a clean state at this block, leaving inputs start to fade out.
+ */
+static void _mixer_take_table(audio_element_t *el) {
+    mixer_t *mixer = el->data;
+    mixer_table_t *table = atomic_exchange_explicit(&mixer->next, NULL,
+            memory_order_acquire);
+    audio_element_info_t *info;
+
+    if (!table)
+        return;
+
+    for (int i = 0; i < MIXER_MAX_INPUTS; i++) {
+        if (table->ids[i] != mixer->ids[i]) {
+            mixer->ids[i] = table->ids[i];
+            mixer->inputs[i] = table->inputs[i];
+            mixer->leaving[i] = false;
+            if (mixer->inputs[i]) {
+                ESP_LOGD(TAG, "[%s] Input %d added", el->tag, i);
+                mixer->infos[i] = audio_element_get_info(mixer->inputs[i]);
+                _gain_reset(&mixer->gains[i]);
+                _duck_reset(&mixer->ducks[i]);
+                polyphase_deinit(&mixer->resamplers[i]);
+                memset(&mixer->resamplers[i], 0, sizeof(polyphase_t));
+                mixer->matrices[i].in_ch = 0;
+            }
+        }
+
+        info = &mixer->infos[i];
+        if (mixer->inputs[i] && table->fade_ms[i] >= 0
+                && !mixer->leaving[i]) {
+            ESP_LOGD(TAG, "[%s] Input %d leaving in %d ms", el->tag, i,
+                    table->fade_ms[i]);
+            mixer->leaving[i] = true;
+            _gain_ramp(&mixer->gains[i], MIXER_GAIN_MIN_DB,
+                    table->fade_ms[i], info->sample_rate * info->channels);
+        }
+    }
+    free(table);
+}
+
+
+// TODO: Support big endian?
 static size_t _mixer_process(audio_element_t *el) {
     mixer_t *mixer = el->data;
     audio_element_info_t *info;
-    io_t *input;
-    unsigned int i_input, j, i_sample;
+    unsigned int i_input, j;
+    char *data;
 
-    uint16_t max_sample_rate = 0,
-             max_bits = 0;
+    int      max_sample_rate = 0,
+             max_bits = 0,
+             out_rate,
+             out_channels,
+             first_channels = 0;
+    int32_t  gain;
+    size_t   read[MIXER_MAX_INPUTS] = {0};
     size_t bytes_per_sample = 0,
            max_bytes_per_sample = 0,
-           bytes_read,
-           max_bytes_read = 0;
+           samples,
+           max_samples = 0,
+           samples_limit,
+           period = 0,
+           out_len;
 
     int32_t output[MIXER_BUF_LEN] = {0};
-    
-    // Loop over every input, and write its samples in int32_t form to a
-    // single output array, this way you can easily add the samples from
-    // multiple inputs.
-    for (i_input = 0; i_input < mixer->count; i_input++) {
-        if (!mixer->inputs[i_input])
-            break;
-        input = mixer->inputs[i_input];
-        info = input->user_data;
 
-        // Determine number of bytes per sample
-        bytes_per_sample = info->bits > 16 ? 4 : info->bits/8;
+    // Inputs only come and go between blocks
+    _mixer_take_table(el);
+
+    // Find the max samplerate and bitwidth, the latter is used to
+    // reconstruct an output buffer
+    for (i_input = 0; i_input < MIXER_MAX_INPUTS; i_input++) {
+        if (!mixer->inputs[i_input])
+            continue;
+        info = &mixer->infos[i_input];
+        // A format change queued in the input applies from here on, reads
+        // below stop at the next one
+        io_apply_markers(mixer->inputs[i_input]);
+        if (audio_element_info_changed(mixer->inputs[i_input], info->gen))
+            *info = audio_element_get_info(mixer->inputs[i_input]);
 
-        // Find max samplerate
         max_sample_rate = info->sample_rate > max_sample_rate ?
             info->sample_rate : max_sample_rate;
-        // And bitwdith, this is used to reconstruct an output buffer
+        if (!first_channels)
+            first_channels = info->channels;
         if (info->bits > max_bits) {
             max_bits = info->bits;
-            max_bytes_per_sample = bytes_per_sample;
+            max_bytes_per_sample = mix_bytes_per_sample(info->bits);
         }
+    }
+    if (!max_bytes_per_sample)
+        return 0;
+    if (mixer->bits != MIXER_BITS_AUTO) {
+        max_bits = mixer->bits;
+        max_bytes_per_sample = mix_bytes_per_sample(max_bits);
+    } else if (max_bits == 32 && mixer->limiter.cfg.mode == LIMITER_PEAK) {
+        // The limiter needs the headroom of a 24 bit bus
+        max_bits = 24;
+        max_bytes_per_sample = mix_bytes_per_sample(max_bits);
+    }
+    out_rate = mixer->rate == MIXER_RATE_AUTO ? max_sample_rate : mixer->rate;
+    out_channels = mixer->channels == MIXER_CHANNELS_AUTO ?
+        first_channels : mixer->channels;
+
+    // Tell the next element from which byte on the output format changes
+    if (out_rate != mixer->out_info.sample_rate
+            || max_bits != mixer->out_info.bits
+            || out_channels != mixer->out_info.channels) {
+        mixer->out_info.sample_rate = out_rate;
+        mixer->out_info.bits = max_bits;
+        mixer->out_info.channels = out_channels;
+        ESP_LOGI(TAG, "Output format: %d Hz, %d bits, %d channels",
+                out_rate, max_bits, mixer->out_info.channels);
+        audio_element_set_info(el->output, mixer->out_info);
+        limiter_init(&mixer->limiter, mixer->limiter.cfg, out_rate,
+                mixer->out_info.channels, max_bits);
+    }
+    _gain_update(&mixer->master,
+            mixer->out_info.sample_rate * mixer->out_info.channels);
+    _mixer_duck(mixer);
+
+    // Never read more than can be written to the output right away
+    samples_limit = io_space(el->output) / max_bytes_per_sample;
+    if (samples_limit > MIXER_BUF_LEN)
+        samples_limit = MIXER_BUF_LEN;
+
+    // With a period, mix whole periods only. Wait for inputs that are
+    // short, but not once the output is about to run dry.
+    if (mixer->period_ms) {
+        period = (size_t)out_rate * mixer->period_ms / 1000 * out_channels;
+        if (period > MIXER_BUF_LEN)
+            period = MIXER_BUF_LEN - MIXER_BUF_LEN % out_channels;
+        if (samples_limit < period)
+            return 0;
+        samples_limit = period;
+        if (io_fill(el->output) >= period * max_bytes_per_sample
+                && !_mixer_ready(mixer, period))
+            return 0;
+    }
+
+    // Loop over every input, and write its samples in int32_t form to a
+    // single output array, this way you can easily add the samples from
+    // multiple inputs. Inputs are never waited for, what they do not have
+    // is silence.
+    for (i_input = 0; i_input < MIXER_MAX_INPUTS && samples_limit;
+            i_input++) {
+        if (!mixer->inputs[i_input])
+            continue;
+        info = &mixer->infos[i_input];
+
+        // Determine number of bytes per sample
+        bytes_per_sample = mix_bytes_per_sample(info->bits);
+        if (!bytes_per_sample || !_mixer_matrix(el, i_input))
+            continue;
+        // A leaving input keeps fading out, whatever the user asks
+        if (!mixer->leaving[i_input])
+            _gain_update(&mixer->gains[i_input],
+                    info->sample_rate * info->channels);
+
+        // Add the samples to 'output', at the scale of the output format
+        if (info->sample_rate != out_rate
+                || mixer->matrices[i_input].map != MIX_MAP_PASS)
+            samples = _mixer_convert(el, i_input, output, samples_limit,
+                    max_bits);
+        else
+            samples = _mixer_read(el, i_input, output, samples_limit,
+                    bytes_per_sample, max_bits);
+
+        read[i_input] = samples;
+        max_samples = samples > max_samples ? samples : max_samples;
+    }
+    if (period)
+        max_samples = period;
+
+    // An input that came up short was filled with silence. A leaving input
+    // goes once it faded out, or once it has nothing left to fade.
+    for (i_input = 0; i_input < MIXER_MAX_INPUTS && samples_limit;
+            i_input++) {
+        if (!mixer->inputs[i_input])
+            continue;
+        if (read[i_input] < max_samples)
+            atomic_fetch_add_explicit(&mixer->underruns[i_input], 1,
+                    memory_order_relaxed);
 
-        // Read this input's audio data
-        bytes_read = input->read(input, el->buf, el->buf_len, el);
-        max_bytes_read = bytes_read > max_bytes_read ? bytes_read : 
-            max_bytes_read;
-        
-        // TODO: This will mix channels if not all inputs have the same number
-        // of channels.
-        // Loop over each sample, i_sample holds index of sample in bytes,
-        // j is the actual sample number
-        for (i_sample = 0, j = 0; i_sample < bytes_read;
-                i_sample += bytes_per_sample, j++) {
-
-            // Convert sample in multiple bytes into a single int32_t integer
-            // Add it to the existing buffer to mix signals
-            output[j] += buffer_to_sample(i_sample, el->buf, bytes_per_sample,
-                    false);
-            // Crude volume control, output is 'volumes' times divided by two
-            output[j] >>= mixer->volumes[i_input];
+        if (mixer->leaving[i_input] && (!read[i_input]
+                    || (mixer->gains[i_input].q15 == 0
+                        && mixer->gains[i_input].step == 0.f))) {
+            // The io_t is the caller's again after this
+            ESP_LOGD(TAG, "[%s] Input %d removed", el->tag, i_input);
+            mixer->inputs[i_input] = NULL;
+            polyphase_deinit(&mixer->resamplers[i_input]);
+            atomic_fetch_or_explicit(&mixer->released, 1u << i_input,
+                    memory_order_release);
         }
     }
 
-    // Loop over each sample after they are mixed.
-    for (i_sample = 0, j = 0; i_sample < max_bytes_read;
-            i_sample += bytes_per_sample, j++) {
+    _mixer_duck_levels(mixer, max_samples);
 
-        // Convert int32_t sample back into bytes and write them to the
-        // internal buffer
-        sample_to_buffer(output[j], i_sample, el->buf, max_bytes_per_sample,
-                false);
+    if (!max_samples) {
+        // The task sleeps until one of the inputs or the output notifies
+        ESP_LOGV(TAG, "No bytes written");
+        return 0;
     }
+    _gain_advance(&mixer->master, max_samples);
 
-    if (max_bytes_read)
-        // Write mixed audio to the output rb
-        el->output->write(el->output, el->buf, max_bytes_read, el);
-    else {
-        ESP_LOGD(TAG, "No bytes written");
-        vTaskDelay(100);
+    // Limit the mix bus before it is stored, the stores saturate anyway
+    gain = limiter_process(&mixer->limiter, output, max_samples);
+    if (gain < atomic_load_explicit(&mixer->reduction, memory_order_relaxed))
+        atomic_store_explicit(&mixer->reduction, gain, memory_order_relaxed);
+
+    // Convert the mixed samples straight into the output region. This can
+    // take two regions if the output ring wraps.
+    j = 0;
+    while (j < max_samples) {
+        out_len = (max_samples - j) * max_bytes_per_sample;
+        data = io_acquire_write(el->output, &out_len);
+        out_len -= out_len % max_bytes_per_sample;
+        if (!data || !out_len)
+            return j ? j * max_bytes_per_sample : IO_WRITE_ERROR;
+
+        mix_store(data, output + j, out_len / max_bytes_per_sample, max_bits);
+        j += out_len / max_bytes_per_sample;
+        if (io_commit_write(el->output, out_len, el) == IO_WRITE_ERROR)
+            return IO_WRITE_ERROR;
     }
 
-    return max_bytes_read;
+    return max_samples * max_bytes_per_sample;
 }
 
 
@@ -165,13 +720,20 @@ static esp_err_t _mixer_destroy(audio_element_t *el) {
 
 
     ESP_LOGI(TAG, "Destroying Mixer");
+    limiter_deinit(&mixer->limiter);
+    for (int i = 0; i < MIXER_MAX_INPUTS; i++) {
+        polyphase_deinit(&mixer->resamplers[i]);
+    }
+    free(atomic_load_explicit(&mixer->next, memory_order_acquire));
+    vSemaphoreDelete(mixer->lock);
     free(mixer);
 
     return ESP_OK;
 }
 
 
-audio_element_t *mixer_init(io_t *inputs[], size_t count) {
+audio_element_t *mixer_init(audio_element_cfg_t cfg, io_t *inputs[],
+        size_t count) {
     if (count > MIXER_MAX_INPUTS) {
         ESP_LOGE(TAG, "Too many inputs: %d, a max of %d allowed", count,
                 MIXER_MAX_INPUTS);
@@ -183,24 +745,42 @@ audio_element_t *mixer_init(io_t *inputs[], size_t count) {
         ESP_LOGE(TAG, "Could not allocate memory!");
         return NULL;
     }
+    mixer->lock = xSemaphoreCreateMutex();
+    if (!mixer->lock) {
+        ESP_LOGE(TAG, "Could not create lock!");
+        free(mixer);
+        return NULL;
+    }
+    atomic_init(&mixer->next, NULL);
+    atomic_init(&mixer->released, 0);
+    for (int i = 0; i < MIXER_MAX_INPUTS; i++) {
+        _gain_init(&mixer->gains[i]);
+        _duck_reset(&mixer->ducks[i]);
+        atomic_init(&mixer->underruns[i], 0);
+        atomic_init(&mixer->priorities[i], MIXER_PRIORITY_DEFAULT);
+        mixer->shadow.fade_ms[i] = -1;
+    }
     for (int i = 0; i < count; i++) {
-        mixer->inputs[i] = inputs[i];
+        mixer->inputs[i] = mixer->shadow.inputs[i] = inputs[i];
+        mixer->ids[i] = mixer->shadow.ids[i] = ++mixer->last_id;
+        mixer->infos[i] = audio_element_get_info(inputs[i]);
     }
-    mixer->count = count;
-    mixer->volumes[0] = 0;
-    /* mixer->volumes[1] = 4; */
-
-    audio_element_cfg_t cfg = { 0 };
+    _gain_init(&mixer->master);
+    mixer->limiter.cfg = (limiter_cfg_t)DEFAULT_LIMITER_CFG();
+    mixer->limiter.cfg.mode = LIMITER_CLIP;
+    atomic_init(&mixer->reduction, MIX_UNITY);
+    mixer->rate = MIXER_DEFAULT_RATE;
+    mixer->channels = MIXER_DEFAULT_CHANNELS;
+    mixer->bits = MIXER_BITS_AUTO;
+    mixer->duck_cfg = (mixer_duck_cfg_t)DEFAULT_MIXER_DUCK_CFG();
+    mixer->duck_depth = _q15(mixer->duck_cfg.depth_db);
+    mixer->duck_threshold = _q15(mixer->duck_cfg.threshold_db);
 
     cfg.open = _mixer_open;
     cfg.close = _mixer_close;
     cfg.destroy = _mixer_destroy;
     cfg.process = _mixer_process;
 
-    cfg.buf_len = 2048;
-    cfg.task_stack = 2048*4;
-    cfg.out_rb_size = 2048;
-
     cfg.tag = "mixer";
 
     // Regular input is unused, as we now handle a list of inputs in process
@@ -211,10 +791,308 @@ audio_element_t *mixer_init(io_t *inputs[], size_t count) {
 
     audio_element_t *el = audio_element_init(&cfg);
     if (!el) {
-        ESP_LOGE(TAG, "[%s] could not init audio element.", el->tag);
+        ESP_LOGE(TAG, "[%s] could not init audio element.", cfg.tag);
+        limiter_deinit(&mixer->limiter);
+        vSemaphoreDelete(mixer->lock);
+        free(mixer);
         return NULL;
     }
     el->data = mixer;
+    // A starving input must never hold up the others
+    for (int i = 0; i < count; i++)
+        inputs[i]->nonblocking = true;
+    // Inputs added later show up here too, while the table is locked an
+    // input in it is not given back
+    el->inputs = mixer->shadow.inputs;
+    el->input_count = MIXER_MAX_INPUTS;
+    el->inputs_lock = mixer->lock;
 
     return el;
 }
+
+
+esp_err_t mixer_set_gain(audio_element_t *el, int input, float db,
+        int ramp_ms) {
+    mixer_t *mixer = el->data;
+    mixer_gain_t *gain;
+
+    if (input == MIXER_MASTER)
+        gain = &mixer->master;
+    else if (input >= 0 && input < MIXER_MAX_INPUTS)
+        gain = &mixer->gains[input];
+    else
+        return ESP_ERR_INVALID_ARG;
+
+    if (db > 0.f) {
+        ESP_LOGW(TAG, "[%s] Gain of %.1f dB limited to 0 dB", el->tag, db);
+        db = 0.f;
+    }
+    if (db < MIXER_GAIN_MIN_DB)
+        db = MIXER_GAIN_MIN_DB;
+    if (ramp_ms < 0)
+        ramp_ms = 0;
+    if (ramp_ms > GAIN_RAMP_MAX)
+        ramp_ms = GAIN_RAMP_MAX;
+
+    // Taken by the process at the start of the next block, a request that
+    // was not taken yet is replaced
+    atomic_store_explicit(&gain->request, GAIN_PENDING
+            | (uint32_t)ramp_ms << GAIN_RAMP_SHIFT
+            | (uint32_t)lrintf(-db * 100.f), memory_order_release);
+    return ESP_OK;
+}
+
+
+esp_err_t mixer_set_rate(audio_element_t *el, int sample_rate) {
+    mixer_t *mixer = el->data;
+
+    if (sample_rate < 0)
+        return ESP_ERR_INVALID_ARG;
+    mixer->rate = sample_rate;
+    return ESP_OK;
+}
+
+
+esp_err_t mixer_set_channels(audio_element_t *el, int channels) {
+    mixer_t *mixer = el->data;
+
+    if (channels < 0 || channels > MIX_MAX_CHANNELS)
+        return ESP_ERR_INVALID_ARG;
+    mixer->channels = channels;
+    return ESP_OK;
+}
+
+
+esp_err_t mixer_set_bits(audio_element_t *el, int bits) {
+    mixer_t *mixer = el->data;
+
+    if (bits != MIXER_BITS_AUTO && !mix_bytes_per_sample(bits))
+        return ESP_ERR_INVALID_ARG;
+    if (bits == 32 && mixer->limiter.cfg.mode == LIMITER_PEAK)
+        return ESP_ERR_NOT_SUPPORTED;
+    mixer->bits = bits;
+    return ESP_OK;
+}
+
+
+esp_err_t mixer_set_matrix(audio_element_t *el, int input, int in_channels,
+        int out_channels, const float *matrix) {
+    mixer_t *mixer = el->data;
+    mixer_layout_t *layout;
+
+    if (input < 0 || input >= MIXER_MAX_INPUTS
+            || in_channels < 1 || in_channels > MIX_MAX_CHANNELS
+            || out_channels < 1 || out_channels > MIX_MAX_CHANNELS)
+        return ESP_ERR_INVALID_ARG;
+
+    layout = &mixer->layouts[input];
+    layout->in_ch = 0;
+    if (matrix) {
+        for (int i = 0; i < in_channels * out_channels; i++) {
+            float g = matrix[i] > 2.f ? 2.f : matrix[i] < -2.f ? -2.f
+                : matrix[i];
+            layout->coef[i] = lrintf(g * MIX_UNITY);
+        }
+        layout->in_ch = in_channels;
+        layout->out_ch = out_channels;
+    }
+    // Picked up by the process on its next block
+    mixer->matrices[input].in_ch = 0;
+    return ESP_OK;
+}
+
+
+esp_err_t mixer_set_period(audio_element_t *el, int period_ms) {
+    mixer_t *mixer = el->data;
+
+    if (period_ms < 0)
+        return ESP_ERR_INVALID_ARG;
+    mixer->period_ms = period_ms;
+    return ESP_OK;
+}
+
+
+unsigned int mixer_get_underruns(audio_element_t *el, int input) {
+    mixer_t *mixer = el->data;
+
+    if (input < 0 || input >= MIXER_MAX_INPUTS)
+        return 0;
+    return atomic_load_explicit(&mixer->underruns[input],
+            memory_order_relaxed);
+}
+
+
+esp_err_t mixer_set_limiter(audio_element_t *el, limiter_cfg_t cfg) {
+    mixer_t *mixer = el->data;
+
+    if (cfg.mode == LIMITER_PEAK && mixer->bits == 32)
+        return ESP_ERR_NOT_SUPPORTED;
+    // Without an output format yet, the process does this once it has one
+    return limiter_init(&mixer->limiter, cfg, mixer->out_info.sample_rate,
+            mixer->out_info.channels, mixer->out_info.bits);
+}
+
+
+float mixer_get_gain_reduction(audio_element_t *el) {
+    mixer_t *mixer = el->data;
+    int32_t gain = atomic_exchange_explicit(&mixer->reduction, MIX_UNITY,
+            memory_order_relaxed);
+
+    if (gain <= 0)
+        return -MIXER_GAIN_MIN_DB;
+    return -20.f * log10f((float)gain / MIX_UNITY);
+}
+
+
+esp_err_t mixer_set_priority(audio_element_t *el, int input, int priority) {
+    mixer_t *mixer = el->data;
+
+    if (input < 0 || input >= MIXER_MAX_INPUTS)
+        return ESP_ERR_INVALID_ARG;
+    atomic_store_explicit(&mixer->priorities[input], priority,
+            memory_order_relaxed);
+    return ESP_OK;
+}
+
+
+esp_err_t mixer_set_ducking(audio_element_t *el, mixer_duck_cfg_t cfg) {
+    mixer_t *mixer = el->data;
+
+    if (cfg.attack_ms < 0 || cfg.hold_ms < 0 || cfg.release_ms < 0)
+        return ESP_ERR_INVALID_ARG;
+    mixer->duck_cfg = cfg;
+    mixer->duck_depth = _q15(cfg.depth_db);
+    mixer->duck_threshold = _q15(cfg.threshold_db);
+    return ESP_OK;
+}
+
+
+/**
+ * Clear the inputs that finished fading out, but for those a remover still
+ * waits for: it clears its own. Call with the lock held.
+ */
+static void _mixer_reclaim(mixer_t *mixer, uint32_t mask) {
+    uint32_t released = atomic_fetch_and_explicit(&mixer->released,
+            ~mask, memory_order_acquire) & mask;
+
+    for (int i = 0; i < MIXER_MAX_INPUTS; i++) {
+        if (released & (1u << i)) {
+            mixer->shadow.inputs[i] = NULL;
+            mixer->shadow.ids[i] = 0;
+            mixer->shadow.fade_ms[i] = -1;
+        }
+    }
+}
+
+// Publish a copy of the shadow table. Call with the lock held.
+static esp_err_t _mixer_publish(audio_element_t *el) {
+    mixer_t *mixer = el->data;
+    mixer_table_t *table = malloc(sizeof(mixer_table_t));
+
+    if (!table) {
+        ESP_LOGE(TAG, "Could not allocate memory!");
+        return ESP_ERR_NO_MEM;
+    }
+    *table = mixer->shadow;
+
+    // A table the process did not take yet is outdated by this one
+    free(atomic_exchange_explicit(&mixer->next, table, memory_order_acq_rel));
+    audio_element_notify(el, AEL_BIT_EVENT);
+    return ESP_OK;
+}
+
+
+esp_err_t mixer_add_input(audio_element_t *el, io_t *input, int *index) {
+    mixer_t *mixer = el->data;
+    esp_err_t ret;
+    int i;
+
+    xSemaphoreTake(mixer->lock, portMAX_DELAY);
+    _mixer_reclaim(mixer, ~mixer->removing);
+    for (i = 0; i < MIXER_MAX_INPUTS && mixer->shadow.inputs[i]; i++);
+    if (i == MIXER_MAX_INPUTS) {
+        xSemaphoreGive(mixer->lock);
+        ESP_LOGW(TAG, "[%s] No free input, a max of %d allowed", el->tag,
+                MIXER_MAX_INPUTS);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // The process does not touch a free input, so its settings can be
+    // cleared here
+    atomic_store_explicit(&mixer->gains[i].request, 0, memory_order_relaxed);
+    atomic_store_explicit(&mixer->underruns[i], 0, memory_order_relaxed);
+    atomic_store_explicit(&mixer->priorities[i], MIXER_PRIORITY_DEFAULT,
+            memory_order_relaxed);
+    mixer->layouts[i].in_ch = 0;
+    input->reader = el->task_handle;
+    input->nonblocking = true;
+
+    mixer->shadow.inputs[i] = input;
+    mixer->shadow.ids[i] = ++mixer->last_id;
+    mixer->shadow.fade_ms[i] = -1;
+    ret = _mixer_publish(el);
+    if (ret != ESP_OK) {
+        mixer->shadow.inputs[i] = NULL;
+        mixer->shadow.ids[i] = 0;
+    }
+    xSemaphoreGive(mixer->lock);
+
+    if (ret == ESP_OK && index)
+        *index = i;
+    return ret;
+}
+
+
+esp_err_t mixer_remove_input(audio_element_t *el, io_t *input, int fade_ms) {
+    mixer_t *mixer = el->data;
+    TickType_t start, timeout;
+    esp_err_t ret;
+    int i;
+
+    if (fade_ms < 0)
+        fade_ms = 0;
+
+    xSemaphoreTake(mixer->lock, portMAX_DELAY);
+    _mixer_reclaim(mixer, ~mixer->removing);
+    for (i = 0; i < MIXER_MAX_INPUTS && mixer->shadow.inputs[i] != input;
+            i++);
+    if (!input || i == MIXER_MAX_INPUTS || mixer->shadow.fade_ms[i] >= 0) {
+        xSemaphoreGive(mixer->lock);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    mixer->shadow.fade_ms[i] = fade_ms;
+    ret = _mixer_publish(el);
+    if (ret != ESP_OK) {
+        mixer->shadow.fade_ms[i] = -1;
+        xSemaphoreGive(mixer->lock);
+        return ret;
+    }
+    // The slot stays taken while it fades, others can add and remove
+    mixer->removing |= 1u << i;
+    xSemaphoreGive(mixer->lock);
+
+    // Wait for the process to let go of it, it is the caller's then
+    start = xTaskGetTickCount();
+    timeout = pdMS_TO_TICKS(fade_ms + MIXER_REMOVE_TIMEOUT_MS);
+    while (!(atomic_load_explicit(&mixer->released, memory_order_acquire)
+                & (1u << i))) {
+        if (xTaskGetTickCount() - start > timeout)
+            break;
+        vTaskDelay(1);
+    }
+
+    xSemaphoreTake(mixer->lock, portMAX_DELAY);
+    mixer->removing &= ~(1u << i);
+    if (!(atomic_load_explicit(&mixer->released, memory_order_acquire)
+                & (1u << i))) {
+        // Cleared by a later add or remove, once the process is done
+        xSemaphoreGive(mixer->lock);
+        ESP_LOGW(TAG, "[%s] Input %d still in use", el->tag, i);
+        return ESP_ERR_TIMEOUT;
+    }
+    _mixer_reclaim(mixer, 1u << i);
+    ret = _mixer_publish(el);
+    xSemaphoreGive(mixer->lock);
+    return ret;
+}
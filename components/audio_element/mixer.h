@@ -3,11 +3,309 @@
 
 #include <audio_element.h>
 #include <io.h>
+#include "limiter.h"
+#include "polyphase.h"
 
 #define MIXER_MAX_INPUTS 4
 #define MIXER_BUF_LEN 1024
+#define MIXER_MASTER -1             // Input index of the master gain
+#define MIXER_GAIN_MIN_DB -96.f     // At or below this an input is muted
+#define MIXER_DEFAULT_RATE 44100
+#define MIXER_RATE_AUTO 0           // Output at the highest input rate
+#define MIXER_DEFAULT_CHANNELS 2
+#define MIXER_CHANNELS_AUTO 0       // Output as many channels as input 0
+#define MIXER_BITS_AUTO 0           // Output at the deepest input format
+#define MIXER_PERIOD_FREE 0         // Mix whatever the inputs have
+#define MIXER_REMOVE_TIMEOUT_MS 500 // On top of the fade
+#define MIXER_PRIORITY_DEFAULT 0    // Of every input, nothing is ducked
+#define MIXER_RESAMPLE_QUALITY POLYPHASE_MEDIUM   // See mixer_set_rate
 
+/**
+ * Ducking: while an input is playing, every input with a lower priority is
+ * turned down by `depth_db`. An input counts as playing while its level
+ * (after its gain) reaches `threshold_db`, and for `hold_ms` after that.
+ */
+typedef struct mixer_duck_cfg {
+    float   depth_db;       // Gain of a ducked input, 0 to turn ducking off
+    float   threshold_db;   // Peak level, relative to full scale
+    int     attack_ms;      // From 0 dB to `depth_db`
+    int     hold_ms;
+    int     release_ms;     // From `depth_db` back to 0 dB
+} mixer_duck_cfg_t;
 
-audio_element_t *mixer_init(io_t *inputs[], size_t count);
+#define DEFAULT_MIXER_DUCK_CFG() {  \
+    .depth_db = -12.f,              \
+    .threshold_db = -50.f,          \
+    .attack_ms = 50,                \
+    .hold_ms = 300,                 \
+    .release_ms = 500,              \
+}
+
+
+/**
+ * Initialize the mixer
+ *
+ * The process, input and callback fields of `cfg` are set by the mixer.
+ * `buf_len` is the max number of bytes read per input per process call.
+ * The mixer keeps MIXER_BUF_LEN int32_t samples on the stack while mixing,
+ * take this into account for `task_stack` (or the pipeline's stack).
+ *
+ * More inputs can be added later, with mixer_add_input.
+ *
+ * @param cfg       A configured `audio_element_cfg_t` struct
+ * @param inputs    Array of io_t's to mix, input 0 and up
+ * @param count     Number of inputs, max MIXER_MAX_INPUTS
+ *
+ * @return
+ *      - audio_element_t if successful
+ *      - NULL otherwise
+ */
+audio_element_t *mixer_init(audio_element_cfg_t cfg, io_t *inputs[],
+        size_t count);
+
+/**
+ * Add an input while the mixer runs. It starts at the next block, at
+ * 0 dB, in the lowest free input. Can be called from any task.
+ *
+ * The process never waits for this: it takes a new copy of the table of
+ * inputs at the start of a block.
+ *
+ * @param el        Pointer to the mixer
+ * @param input     The io_t to mix, read by the mixer's task from now on
+ * @param index     Set to the index of the input, for mixer_set_gain and
+ *                  the like, can be NULL
+ *
+ * @return
+ *      - ESP_OK if successful
+ *      - ESP_ERR_NO_MEM if all MIXER_MAX_INPUTS inputs are in use
+ */
+esp_err_t mixer_add_input(audio_element_t *el, io_t *input, int *index);
+
+/**
+ * Remove an input while the mixer runs. It fades out in `fade_ms` first.
+ * Blocks until the mixer let go of the io_t, after which it can be
+ * destroyed. Other inputs can be added and removed meanwhile, from other
+ * tasks. Can be called from any task, but not from the mixer's.
+ *
+ * @param el        Pointer to the mixer
+ * @param input     The io_t to remove
+ * @param fade_ms   Length of the fade out, 0 to cut at the next block
+ *
+ * @return
+ *      - ESP_OK if successful
+ *      - ESP_ERR_INVALID_ARG if the io_t is not an input, or already leaving
+ *      - ESP_ERR_TIMEOUT if the mixer did not let go in time, for example
+ *        because it is not running. It is removed once it does.
+ */
+esp_err_t mixer_remove_input(audio_element_t *el, io_t *input, int fade_ms);
+
+/**
+ * Set the gain of an input, or the master gain. Can be called from any
+ * task.
+ *
+ * The gain ramps to the new value in `ramp_ms`, in even dB steps, so a
+ * change never clicks. Gains are Q15 internally and applied to the samples
+ * with a single multiply, the input and master gain combined.
+ *
+ * @param el        Pointer to the mixer
+ * @param input     Index of the input, or MIXER_MASTER
+ * @param db        New gain, from MIXER_GAIN_MIN_DB (muted) to 0 dB
+ * @param ramp_ms   Duration of the ramp, 0 to jump, max 32767
+ *
+ * @return
+ *      - ESP_OK if successful
+ *      - ESP_ERR_INVALID_ARG if there is no such input
+ */
+esp_err_t mixer_set_gain(audio_element_t *el, int input, float db,
+        int ramp_ms);
+
+/**
+ * Set the output sample rate, MIXER_DEFAULT_RATE by default. Inputs at
+ * another rate are resampled on the fly, each with its own filter state.
+ * With MIXER_RATE_AUTO the output follows the highest input rate, and
+ * only the other inputs are resampled.
+ *
+ * The resampling is that of polyphase.h at MIXER_RESAMPLE_QUALITY, which
+ * keeps aliases 70 dB down. Its filter takes heap per input, 20 KiB for
+ * 44.1 to 48 kHz, and delays the input by half its length. Only ratios of
+ * up to POLYPHASE_MAX_PHASES phases work, which covers every pair of
+ * common rates: an input at any other rate is left unread, with an error.
+ *
+ * Call this before the mixer is opened.
+ *
+ * @param el            Pointer to the mixer
+ * @param sample_rate   Output rate in Hz, or MIXER_RATE_AUTO
+ *
+ * @return
+ *      - ESP_OK if successful
+ *      - ESP_ERR_INVALID_ARG if the rate is negative
+ */
+esp_err_t mixer_set_rate(audio_element_t *el, int sample_rate);
+
+/**
+ * Set the number of output channels, MIXER_DEFAULT_CHANNELS by default.
+ * Inputs with another number of channels go through a channel matrix: by
+ * default mono is copied to every channel, stereo to mono is half the sum,
+ * and otherwise channels are passed on in order. See mixer_set_matrix.
+ *
+ * Call this before the mixer is opened.
+ *
+ * @param el        Pointer to the mixer
+ * @param channels  Output channels, or MIXER_CHANNELS_AUTO
+ *
+ * @return
+ *      - ESP_OK if successful
+ *      - ESP_ERR_INVALID_ARG if there are more than MIX_MAX_CHANNELS
+ */
+esp_err_t mixer_set_channels(audio_element_t *el, int channels);
+
+/**
+ * Set the output format, MIXER_BITS_AUTO by default. At 24 bits, what the
+ * gains, ducking and the limiter do to 16 bit inputs is kept below their
+ * LSB, instead of being truncated, and the int32_t accumulator has 8 bits
+ * of headroom: sums above full scale are only clipped when stored, after
+ * the limiter. A bitdepth element (see bitdepth.h) can then dither it down
+ * to what the DAC takes.
+ *
+ * At 32 bits the accumulator has no headroom, every sum above full scale
+ * saturates before the limiter sees it. Use it for 32 bit inputs, not to
+ * mix 16 bit ones. It does not go with the look-ahead limiter: with
+ * LIMITER_PEAK, MIXER_BITS_AUTO mixes 32 bit inputs at 24 bits.
+ *
+ * Call this before the mixer is opened.
+ *
+ * @param el        Pointer to the mixer
+ * @param bits      8, 16, 24 or 32, see mix.h, or MIXER_BITS_AUTO
+ *
+ * @return
+ *      - ESP_OK if successful
+ *      - ESP_ERR_INVALID_ARG if the format is not supported
+ *      - ESP_ERR_NOT_SUPPORTED for 32 bits with LIMITER_PEAK
+ */
+esp_err_t mixer_set_bits(audio_element_t *el, int bits);
+
+/**
+ * Set the channel matrix of an input, used while the input has
+ * `in_channels` and the output `out_channels` channels. Other layouts use
+ * the default matrix.
+ *
+ * Mono to stereo duplication, stereo to mono at half the sum and
+ * passthrough are recognized and run as their own kernels, any other
+ * matrix is a full multiply per frame.
+ *
+ * Call this before the mixer is opened.
+ *
+ * @param el            Pointer to the mixer
+ * @param input         Index of the input
+ * @param in_channels   Channels of the input
+ * @param out_channels  Channels of the output
+ * @param matrix        out_channels rows of in_channels gains each, from
+ *                      -2.0 to 2.0, or NULL for the default matrix
+ *
+ * @return
+ *      - ESP_OK if successful
+ *      - ESP_ERR_INVALID_ARG if there is no such input, or a channel count
+ *        is out of range
+ */
+esp_err_t mixer_set_matrix(audio_element_t *el, int input, int in_channels,
+        int out_channels, const float *matrix);
+
+/**
+ * Mix in periods of `period_ms`, for an output with a clock of its own,
+ * like i2s. Every period has exactly this length: what an input does not
+ * have in time is filled with silence, and counted as an underrun. The
+ * mixer waits for short inputs only while the output still has a period
+ * queued. So a starving input never stalls the others, and a bus where all
+ * inputs starve plays silence.
+ *
+ * With MIXER_PERIOD_FREE (the default) the mixer mixes as much as the
+ * inputs have, as fast as the output takes it, for offline renders. Short
+ * inputs are filled with silence and counted in this mode too.
+ *
+ * A period is at most MIXER_BUF_LEN samples. Call this before the mixer
+ * is opened.
+ *
+ * @param el            Pointer to the mixer
+ * @param period_ms     Length of a period, or MIXER_PERIOD_FREE
+ *
+ * @return
+ *      - ESP_OK if successful
+ *      - ESP_ERR_INVALID_ARG if the period is negative
+ */
+esp_err_t mixer_set_period(audio_element_t *el, int period_ms);
+
+/**
+ * Number of mixed blocks in which an input had less than the others (or
+ * than a period), and was filled with silence. Can be called from any
+ * task.
+ *
+ * @param el        Pointer to the mixer
+ * @param input     Index of the input
+ *
+ * @return
+ *      - Underruns since the mixer was created, 0 if there is no such input
+ */
+unsigned int mixer_get_underruns(audio_element_t *el, int input);
+
+/**
+ * Configure the limiter on the mix bus. By default the mixer only
+ * saturates (LIMITER_CLIP). With LIMITER_PEAK the output is delayed by
+ * twice `attack_ms`, and the delay line is cleared on every change of the
+ * output format.
+ *
+ * Call this before the mixer is opened.
+ *
+ * @param el    Pointer to the mixer
+ * @param cfg   Limiter configuration, see DEFAULT_LIMITER_CFG
+ *
+ * @return
+ *      - ESP_OK if successful
+ *      - ESP_ERR_NOT_SUPPORTED for LIMITER_PEAK on a 32 bit output, see
+ *        mixer_set_bits
+ *      - ESP_ERR_NO_MEM if the delay line could not be allocated
+ */
+esp_err_t mixer_set_limiter(audio_element_t *el, limiter_cfg_t cfg);
+
+/**
+ * Most gain reduction the limiter applied since the previous call, for a
+ * meter. Can be called from any task.
+ *
+ * @param el    Pointer to the mixer
+ *
+ * @return
+ *      - Gain reduction in dB, 0 or positive
+ */
+float mixer_get_gain_reduction(audio_element_t *el);
+
+/**
+ * Set the priority of an input for ducking. Inputs start at
+ * MIXER_PRIORITY_DEFAULT, also when added later. Can be called from any
+ * task, it applies from the next block.
+ *
+ * @param el        Pointer to the mixer
+ * @param input     Index of the input
+ * @param priority  Higher ducks lower
+ *
+ * @return
+ *      - ESP_OK if successful
+ *      - ESP_ERR_INVALID_ARG if there is no such input
+ */
+esp_err_t mixer_set_priority(audio_element_t *el, int input, int priority);
+
+/**
+ * Configure ducking, see mixer_duck_cfg_t. DEFAULT_MIXER_DUCK_CFG is used
+ * until this is called, it takes effect once inputs get different
+ * priorities. The duck gain ramps linearly, on top of the input's own gain.
+ *
+ * Call this before the mixer is opened.
+ *
+ * @param el        Pointer to the mixer
+ * @param cfg       Ducking configuration
+ *
+ * @return
+ *      - ESP_OK if successful
+ *      - ESP_ERR_INVALID_ARG if a time is negative
+ */
+esp_err_t mixer_set_ducking(audio_element_t *el, mixer_duck_cfg_t cfg);
 
 #endif
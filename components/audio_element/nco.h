@@ -0,0 +1,60 @@
+/**
+ * Numerically controlled oscillator: a sine from a 32 bit phase accumulator
+ * and a table of NCO_LUT_LEN 16 bit samples.
+ *
+ * A full turn of the accumulator is one period, the frequency is set by how
+ * much it turns per frame. That step resolves rate / 2^32 Hz (11 uHz at 48
+ * kHz), and as the phase is never rounded to a frame, a tone stays in tune
+ * at any frequency, whether or not its period is a whole number of frames.
+ *
+ * The top NCO_LUT_BITS bits of the phase pick a sample of the table, the
+ * next 16 interpolate linearly to the one after it. That keeps the error at
+ * some -106 dB, below the rounding of the table itself. A frame costs two
+ * table reads and two multiplies, for any number of channels.
+ */
+
+#ifndef NCO_H
+#define NCO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define NCO_LUT_BITS 10
+#define NCO_LUT_LEN (1 << NCO_LUT_BITS)
+
+typedef struct nco {
+    uint32_t phase;         // A full turn is one period
+    uint32_t step;          // Phase per frame
+    int32_t  amp;           // Peak, at the scale of the output
+} nco_t;
+
+
+/**
+ * Set the frequency. The phase is kept, so a tone changes its pitch
+ * without a click. Zeroed memory is a silent oscillator.
+ *
+ * @param nco       Pointer to oscillator
+ * @param freq      Frequency in Hz, 0 for a constant output
+ * @param rate      Sample rate
+ *
+ * @return
+ *      - ESP_OK if successful
+ *      - ESP_ERR_INVALID_ARG if the rate is not positive, or the frequency
+ *        is negative or not below half the rate
+ */
+esp_err_t nco_set_freq(nco_t *nco, float freq, int rate);
+
+/**
+ * Write `frames` frames of the sine, the same sample in every channel,
+ * from the current phase on
+ *
+ * @param nco       Pointer to oscillator
+ * @param out       Output frames, interleaved
+ * @param frames    Number of frames
+ * @param channels  Number of channels
+ */
+void nco_run(nco_t *nco, int32_t *out, size_t frames, int channels);
+
+#endif
@@ -0,0 +1,203 @@
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+
+#include "pipeline.h"
+#include "audio_element.h"
+#include "io.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char TAG[] = "PIPELINE";
+
+
+// True if 'to' reads the output of 'from'
+static inline bool _feeds(audio_element_t *from, audio_element_t *to) {
+    return from != to && audio_element_reads_from(to, from->output);
+}
+
+
+// Order the elements so every element comes after the ones it reads from.
+// Stable: of all elements that are ready, the first given is taken first.
+static esp_err_t _sort(pipeline_t *pl, audio_element_t *elements[],
+        size_t count) {
+    bool placed[PIPELINE_MAX_ELEMENTS] = { false };
+    size_t i, j;
+    bool ready;
+
+    pl->count = 0;
+    while (pl->count < count) {
+        for (i = 0; i < count; i++) {
+            if (placed[i])
+                continue;
+
+            ready = true;
+            for (j = 0; j < count && ready; j++) {
+                if (!placed[j] && _feeds(elements[j], elements[i]))
+                    ready = false;
+            }
+            if (ready)
+                break;
+        }
+
+        if (i == count) {
+            ESP_LOGE(TAG, "Elements are linked in a loop");
+            return ESP_FAIL;
+        }
+        placed[i] = true;
+        pl->elements[pl->count++] = elements[i];
+    }
+
+    return ESP_OK;
+}
+
+
+// Process every element once, returns whether any of them moved data
+static bool _period(pipeline_t *pl) {
+    bool busy = false;
+    size_t i;
+
+    for (i = 0; i < pl->count; i++) {
+        if (audio_element_run(pl->elements[i]) > 0)
+            busy = true;
+    }
+    return busy;
+}
+
+
+static void _attach(pipeline_t *pl) {
+    size_t i;
+
+    for (i = 0; i < pl->count; i++) {
+        audio_element_attach(pl->elements[i], xTaskGetCurrentTaskHandle());
+    }
+}
+
+
+static void _deinit(pipeline_t *pl) {
+    size_t i;
+
+    for (i = 0; i < pl->count; i++) {
+        audio_element_deinit(pl->elements[i]);
+    }
+}
+
+
+static esp_err_t _check(audio_element_t *elements[], size_t count) {
+    size_t i;
+
+    if (count > PIPELINE_MAX_ELEMENTS) {
+        ESP_LOGE(TAG, "Too many elements: %d, a max of %d allowed", count,
+                PIPELINE_MAX_ELEMENTS);
+        return ESP_FAIL;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (elements[i]->task_handle) {
+            ESP_LOGE(TAG, "[%s] already has its own task", elements[i]->tag);
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
+
+
+static void pipeline_task(void *pv) {
+    pipeline_t *pl = pv;
+    uint32_t notification;
+
+    _attach(pl);
+
+    pl->task_running = true;
+    while (pl->task_running) {
+        // Nothing moved this period, sleep until any of the elements or
+        // io_t's notifies
+        if (!_period(pl))
+            xTaskNotifyWait(pdFALSE, ULONG_MAX, &notification,
+                    portMAX_DELAY);
+    }
+
+    ESP_LOGI(TAG, "[%s] task deleted. Max mem usage: %d", pl->tag,
+            uxTaskGetStackHighWaterMark(NULL));
+    _deinit(pl);
+    free(pl);
+    vTaskDelete(NULL);
+}
+
+
+pipeline_t *pipeline_init(pipeline_cfg_t *cfg, audio_element_t *elements[],
+        size_t count) {
+    size_t i;
+
+    if (_check(elements, count) != ESP_OK)
+        return NULL;
+
+    pipeline_t *pl = calloc(1, sizeof(pipeline_t));
+    if (!pl) {
+        ESP_LOGE(TAG, "Could not allocate memory!");
+        return NULL;
+    }
+    pl->tag = cfg->tag;
+
+    if (_sort(pl, elements, count) != ESP_OK) {
+        free(pl);
+        return NULL;
+    }
+
+    // The task attaches itself to the elements, making their io_t's
+    // nonblocking
+    for (i = 0; i < pl->count; i++) {
+        ESP_LOGD(TAG, "[%s] %d: %s", pl->tag, i, pl->elements[i]->tag);
+        pl->elements[i]->is_inline = true;
+    }
+
+    if (xTaskCreate(pipeline_task, cfg->tag, cfg->task_stack, pl,
+                cfg->task_prio, &pl->task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "[%s] Could not create task", pl->tag);
+        free(pl);
+        return NULL;
+    }
+
+    return pl;
+}
+
+
+void pipeline_stop(pipeline_t *pl) {
+    // The task frees 'pl' once it is stopped
+    TaskHandle_t task = pl->task_handle;
+    pl->task_running = false;
+    xTaskNotify(task, AEL_BIT_STATUS_CHANGED, eSetBits);
+}
+
+
+esp_err_t pipeline_run(audio_element_t *elements[], size_t count,
+        int idle_ms) {
+    pipeline_t pl = { .tag = "render" };
+    uint32_t notification;
+    int64_t start;
+    size_t i;
+
+    if (_check(elements, count) != ESP_OK
+            || _sort(&pl, elements, count) != ESP_OK)
+        return ESP_FAIL;
+
+    for (i = 0; i < pl.count; i++) {
+        pl.elements[i]->is_inline = true;
+    }
+    _attach(&pl);
+
+    // Free running: a period starts as soon as the previous one is done.
+    // Only sleep when nothing moved, the end is when that lasts 'idle_ms'.
+    start = esp_timer_get_time();
+    while (_period(&pl)
+            || xTaskNotifyWait(pdFALSE, ULONG_MAX, &notification,
+                pdMS_TO_TICKS(idle_ms)) == pdTRUE);
+
+    ESP_LOGI(TAG, "[%s] done after %lld us", pl.tag,
+            (esp_timer_get_time() - start) - idle_ms * 1000ll);
+    _deinit(&pl);
+    return ESP_OK;
+}
@@ -0,0 +1,99 @@
+/**
+ * Pipeline: run a chain of audio elements inside a single task.
+ *
+ * Instead of every element getting its own task, the elements of a linked
+ * chain (e.g. mixer -> i2s) are created without a task (task_stack = 0) and
+ * handed to a pipeline. The pipeline task calls the process function of
+ * each element once per period, in dependency order: an element is always
+ * processed after the elements whose output it reads.
+ *
+ * The io_t's of inline elements are made nonblocking, so one element
+ * waiting for data can not stall the rest of the chain. When a whole period
+ * did not move any data, the task sleeps until one of the io_t's or
+ * elements notifies it. The period is paced by the element that blocks on
+ * hardware, in most cases the i2s sink.
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "audio_element.h"
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define PIPELINE_MAX_ELEMENTS 8
+
+typedef struct pipeline pipeline_t;
+
+/**
+ * Pipeline configuration
+ */
+typedef struct pipeline_cfg {
+    int             task_stack;
+    int             task_prio;
+    char            *tag;
+} pipeline_cfg_t;
+
+#define DEFAULT_PIPELINE_CFG() {                \
+    .task_stack = 2048*4,                       \
+    .task_prio = configMAX_PRIORITIES - 1,      \
+    .tag = "pipeline"                           \
+}
+
+struct pipeline {
+    audio_element_t *elements[PIPELINE_MAX_ELEMENTS];  // In process order
+    size_t          count;
+
+    char            *tag;
+    TaskHandle_t    task_handle;
+    bool            task_running;
+};
+
+
+/**
+ * Create a pipeline running the given elements in a single task.
+ *
+ * The elements may be given in any order, they are sorted by their links.
+ * Elements without a link between them keep the order they were given in.
+ *
+ * @param cfg       Pointer to a pipeline configuration
+ * @param elements  Elements to run, all created with task_stack = 0
+ * @param count     Number of elements, max PIPELINE_MAX_ELEMENTS
+ *
+ * @return
+ *      - pipeline_t pointer
+ *      - NULL otherwise
+ */
+pipeline_t *pipeline_init(pipeline_cfg_t *cfg, audio_element_t *elements[],
+        size_t count);
+
+/**
+ * Stop the pipeline. Its task closes and destroys all elements, and frees
+ * the pipeline itself.
+ *
+ * @param pl        Pointer to pipeline
+ */
+void pipeline_stop(pipeline_t *pl);
+
+/**
+ * Offline render: run the given elements in the calling task, without
+ * waiting for any clock, until none of them moved data for `idle_ms`.
+ * Then close and destroy them, like a stopped pipeline does.
+ *
+ * Meant for a chain ending in a sink that does not pace itself, e.g. a
+ * file written by sdcard_stream. Its source(s) may run in their own task.
+ *
+ * @param elements  Elements to run, all created with task_stack = 0
+ * @param count     Number of elements, max PIPELINE_MAX_ELEMENTS
+ * @param idle_ms   How long nothing has to move before it is done
+ *
+ * @return
+ *      - ESP_OK when done
+ *      - ESP_FAIL if the elements could not be run
+ */
+esp_err_t pipeline_run(audio_element_t *elements[], size_t count,
+        int idle_ms);
+
+#endif
@@ -0,0 +1,277 @@
+#include "polyphase.h"
+#include "fir.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+static const char TAG[] = "POLYPHASE";
+
+#define Q30 (1 << 30)
+#define PHASE_SHIFT 24      // Of a Q32 position, for the adaptive phases
+#define RATIO_RANGE (POLYPHASE_ONE >> 4)
+
+_Static_assert(POLYPHASE_ADAPTIVE_PHASES == 1 << (32 - PHASE_SHIFT),
+        "PHASE_SHIFT does not match POLYPHASE_ADAPTIVE_PHASES");
+
+// Taps per phase and stopband attenuation (dB) of every quality
+static const struct {
+    int      taps;
+    float    atten;
+} s_quality[] = {
+    [POLYPHASE_LOW] =       { 16, 50.f },
+    [POLYPHASE_MEDIUM] =    { 32, 70.f },
+    [POLYPHASE_HIGH] =      { 64, 96.f },
+};
+
+
+static int _gcd(int a, int b) {
+    while (b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static inline int64_t _dot(const int32_t *h, const int32_t *x, int taps) {
+    int64_t acc = 0;
+    for (int j = 0; j < taps; j++) {
+        acc += (int64_t)h[j] * x[j];
+    }
+    return acc;
+}
+
+/**
+ * Design the filter: a sinc cut off at 'fc' (cycles per input frame), with
+ * a Kaiser window of 'beta', 'taps' input frames long. Phase p holds the
+ * taps for an output p / phases of a frame after the newest input frame in
+ * its window. An adaptive filter has one more phase, the first one a frame
+ * later, to interpolate the last one with.
+ */
+static void _design(polyphase_t *pp, double *h, double fc, double beta) {
+    int n = pp->taps * pp->phases;
+    double center = (n - 1) / 2., i0_beta = fir_bessel_i0(beta);
+
+    for (int p = 0; p < pp->phases + pp->adaptive; p++) {
+        int32_t *coefs = pp->coefs + p * pp->taps;
+        double sum = 0.;
+        int64_t total = 0;
+        int max = 0;
+
+        for (int j = 0; j < pp->taps; j++) {
+            int k = p + (pp->taps - 1 - j) * pp->phases;
+            double t = (k - center) / pp->phases;
+            double r = 2. * k / (n - 1) - 1.;
+            double x = 2. * fc * t;
+
+            h[j] = r * r > 1. ? 0. : 2. * fc
+                * (x == 0. ? 1. : sin(M_PI * x) / (M_PI * x))
+                * fir_bessel_i0(beta * sqrt(1. - r * r)) / i0_beta;
+            sum += h[j];
+        }
+
+        // Unity gain at DC, the rounding error goes to the largest tap
+        for (int j = 0; j < pp->taps; j++) {
+            coefs[j] = lrint(h[j] / sum * Q30);
+            total += coefs[j];
+            if (abs(coefs[j]) > abs(coefs[max]))
+                max = j;
+        }
+        coefs[max] += Q30 - total;
+    }
+}
+
+
+/**
+ * Allocate and design the filter of a converter whose rates, phases and
+ * taps are set. Cut off at the lower of the two Nyquist frequencies.
+ */
+static esp_err_t _setup(polyphase_t *pp) {
+    int taps = pp->taps;
+    double atten, beta, df, fc, *h;
+
+    pp->len = taps + POLYPHASE_BLOCK;
+    pp->coefs = malloc((size_t)(pp->phases + pp->adaptive) * taps
+            * sizeof(int32_t));
+    pp->hist = calloc(pp->len * pp->channels, sizeof(int32_t));
+    h = malloc(taps * sizeof(double));
+    if (!pp->coefs || !pp->hist || !h) {
+        ESP_LOGE(TAG, "Could not allocate memory!");
+        free(h);
+        polyphase_deinit(pp);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Kaiser's estimates of the window and the transition band it gives.
+    // The band ends at the lower Nyquist frequency.
+    atten = s_quality[pp->quality].atten;
+    beta = fir_kaiser_beta(atten);
+    df = fir_kaiser_width(atten, taps);
+    fc = (pp->in_rate > pp->out_rate ? 0.5 * pp->out_rate / pp->in_rate
+            : 0.5) - df / 2.;
+    _design(pp, h, fc, beta);
+    free(h);
+
+    // Half a window of silence first, so the output starts with the input
+    pp->fill = taps / 2;
+
+    ESP_LOGD(TAG, "%d Hz to %d Hz: %d phases of %d taps, cutoff %.3f",
+            pp->in_rate, pp->out_rate, pp->phases, taps, fc);
+    return ESP_OK;
+}
+
+
+esp_err_t polyphase_init(polyphase_t *pp, int in_rate, int out_rate,
+        int channels, polyphase_quality_t quality) {
+    int g, taps;
+
+    polyphase_deinit(pp);
+    memset(pp, 0, sizeof(polyphase_t));
+    if (in_rate <= 0 || out_rate <= 0 || channels <= 0
+            || quality > POLYPHASE_HIGH)
+        return ESP_ERR_INVALID_ARG;
+
+    g = _gcd(in_rate, out_rate);
+    if (out_rate / g > POLYPHASE_MAX_PHASES) {
+        ESP_LOGE(TAG, "%d Hz to %d Hz needs %d phases, a max of %d allowed",
+                in_rate, out_rate, out_rate / g, POLYPHASE_MAX_PHASES);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    // Longer when downsampling, the cutoff moves down with the output rate
+    taps = s_quality[quality].taps;
+    if (in_rate > out_rate)
+        taps = ((int64_t)taps * in_rate + out_rate - 1) / out_rate;
+    taps += taps & 1;
+
+    pp->in_rate = in_rate;
+    pp->out_rate = out_rate;
+    pp->channels = channels;
+    pp->quality = quality;
+    pp->phases = out_rate / g;
+    pp->step = in_rate / g;
+    pp->taps = taps;
+    return _setup(pp);
+}
+
+
+esp_err_t polyphase_init_adaptive(polyphase_t *pp, int rate, int channels,
+        polyphase_quality_t quality) {
+    polyphase_deinit(pp);
+    memset(pp, 0, sizeof(polyphase_t));
+    if (rate <= 0 || channels <= 0 || quality > POLYPHASE_HIGH)
+        return ESP_ERR_INVALID_ARG;
+
+    pp->in_rate = pp->out_rate = rate;
+    pp->channels = channels;
+    pp->quality = quality;
+    pp->phases = POLYPHASE_ADAPTIVE_PHASES;
+    pp->taps = s_quality[quality].taps;
+    pp->adaptive = true;
+    pp->ratio = POLYPHASE_ONE;
+    return _setup(pp);
+}
+
+
+void polyphase_set_ratio(polyphase_t *pp, uint64_t ratio) {
+    if (ratio < POLYPHASE_ONE - RATIO_RANGE)
+        ratio = POLYPHASE_ONE - RATIO_RANGE;
+    if (ratio > POLYPHASE_ONE + RATIO_RANGE)
+        ratio = POLYPHASE_ONE + RATIO_RANGE;
+    pp->ratio = ratio;
+}
+
+
+size_t polyphase_frames_needed(const polyphase_t *pp, size_t out_frames) {
+    size_t end;
+
+    if (!out_frames || !pp->coefs)
+        return 0;
+    // End of the window of the last output frame
+    if (pp->adaptive)
+        end = pp->pos + pp->taps + ((pp->frac + (out_frames - 1)
+                    * pp->ratio) >> 32);
+    else
+        end = pp->pos + pp->taps + (pp->phase + (uint64_t)(out_frames - 1)
+                * pp->step) / pp->phases;
+    return end > pp->fill ? end - pp->fill : 0;
+}
+
+
+size_t polyphase_process(polyphase_t *pp, const int32_t *in,
+        size_t in_frames, size_t *used, int32_t *out, size_t out_frames) {
+    int ch = pp->channels, taps = pp->taps;
+    size_t taken = pp->len - pp->fill, done = 0, keep;
+
+    *used = 0;
+    if (!pp->coefs)
+        return 0;
+
+    // Split the input into a history per channel
+    if (taken > in_frames)
+        taken = in_frames;
+    for (int c = 0; c < ch; c++) {
+        int32_t *hist = pp->hist + c * pp->len + pp->fill;
+        for (size_t i = 0; i < taken; i++) {
+            hist[i] = in[i * ch + c];
+        }
+    }
+    pp->fill += taken;
+    *used = taken;
+
+    while (pp->adaptive && done < out_frames && pp->pos + taps <= pp->fill) {
+        // Between two phases, Q16
+        const int32_t *h = pp->coefs + (pp->frac >> PHASE_SHIFT) * taps;
+        int64_t mix = (pp->frac >> (PHASE_SHIFT - 16)) & 0xffff;
+        uint64_t next = pp->frac + pp->ratio;
+
+        for (int c = 0; c < ch; c++) {
+            const int32_t *x = pp->hist + c * pp->len + pp->pos;
+            int64_t a = _dot(h, x, taps), b = _dot(h + taps, x, taps);
+            a += ((b - a) >> 16) * mix;
+            out[done * ch + c] = fir_sat((a + (Q30 >> 1)) >> 30);
+        }
+        done++;
+
+        pp->pos += next >> 32;
+        pp->frac = next;
+    }
+
+    while (!pp->adaptive && done < out_frames
+            && pp->pos + taps <= pp->fill) {
+        const int32_t *h = pp->coefs + pp->phase * taps;
+
+        for (int c = 0; c < ch; c++) {
+            const int32_t *x = pp->hist + c * pp->len + pp->pos;
+            out[done * ch + c] = fir_sat((_dot(h, x, taps) + (Q30 >> 1)) >> 30);
+        }
+        done++;
+
+        pp->phase += pp->step;
+        pp->pos += pp->phase / pp->phases;
+        pp->phase %= pp->phases;
+    }
+
+    // Keep what the next windows still need
+    if (pp->pos) {
+        keep = pp->fill > pp->pos ? pp->fill - pp->pos : 0;
+        for (int c = 0; c < ch; c++) {
+            int32_t *hist = pp->hist + c * pp->len;
+            memmove(hist, hist + pp->pos, keep * sizeof(int32_t));
+        }
+        pp->pos -= pp->fill - keep;
+        pp->fill = keep;
+    }
+    return done;
+}
+
+
+void polyphase_deinit(polyphase_t *pp) {
+    free(pp->coefs);
+    free(pp->hist);
+    pp->coefs = NULL;
+    pp->hist = NULL;
+}
@@ -0,0 +1,154 @@
+/**
+ * Streaming polyphase sample rate converter.
+ *
+ * Converts between any two rates whose ratio, reduced, has at most
+ * POLYPHASE_MAX_PHASES as its numerator (the output side): 44.1 to 48 kHz
+ * is 160/147, 16 to 44.1 kHz is 441/160. The filter is a Kaiser windowed
+ * sinc, cut off below the lower of the two Nyquist frequencies, and split
+ * in one phase per output position between two input frames. Every phase
+ * is normalized to unity gain at DC.
+ *
+ * Coefficients are Q30, samples are int32_t at any scale (e.g. that of
+ * their own format, see mix.h) and are accumulated in 64 bits. The quality
+ * sets the length of the filter and its stopband attenuation:
+ *
+ *  - POLYPHASE_LOW:    16 taps, 50 dB
+ *  - POLYPHASE_MEDIUM: 32 taps, 70 dB
+ *  - POLYPHASE_HIGH:   64 taps, 96 dB
+ *
+ * When downsampling there are proportionally more taps, so the transition
+ * band stays equally narrow. The output lags the input by half the filter
+ * length.
+ *
+ * The coefficients take phases * taps * 4 bytes: 40 KiB for 44.1 to 48 kHz
+ * at POLYPHASE_HIGH, 110 KiB for 16 to 44.1 kHz. Pick a lower quality
+ * where that does not fit.
+ *
+ * The input frames a window still needs are kept between calls, so a
+ * stream can be converted in blocks of any size.
+ *
+ * An adaptive converter (polyphase_init_adaptive) runs at a ratio close to
+ * 1 that can change on every call, for clock drift. Its filter has
+ * POLYPHASE_ADAPTIVE_PHASES phases, and an output between two of them is
+ * interpolated linearly from both. That takes two dot products per output.
+ * Its table takes 16, 32 or 64 KiB, for the three qualities.
+ */
+
+#ifndef POLYPHASE_H
+#define POLYPHASE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define POLYPHASE_MAX_PHASES 1024
+#define POLYPHASE_BLOCK 256     // Input frames taken per call, at most
+#define POLYPHASE_ADAPTIVE_PHASES 256
+#define POLYPHASE_ONE (1ull << 32)  // Q32 ratio of 1, see polyphase_set_ratio
+
+typedef enum {
+    POLYPHASE_LOW,
+    POLYPHASE_MEDIUM,
+    POLYPHASE_HIGH,
+} polyphase_quality_t;
+
+typedef struct polyphase {
+    int32_t  *coefs;        // [phases][taps], Q30, oldest frame first
+    int32_t  *hist;         // [channels][len], input frames
+    size_t   len;           // Frames of history per channel
+    size_t   fill;          // Frames in the history
+    size_t   pos;           // First frame of the next window
+    int      taps;
+    int      phases;        // L, the output rate over the common divisor
+    int      step;          // M, the input rate over the common divisor
+    int      phase;         // Of the next output frame, 0 to phases - 1
+    uint64_t ratio;         // Adaptive: Q32 input frames per output frame
+    uint32_t frac;          // Adaptive: Q32 position of the next output
+    bool     adaptive;
+    int      channels;
+    int      in_rate;
+    int      out_rate;
+    polyphase_quality_t quality;
+} polyphase_t;
+
+
+/**
+ * (Re)initialize a converter, designing its filter and clearing its
+ * history. Zeroed memory is a valid converter to initialize.
+ *
+ * @param pp        Pointer to converter
+ * @param in_rate   Sample rate of the input
+ * @param out_rate  Sample rate of the output
+ * @param channels  Number of channels
+ * @param quality   Length of the filter
+ *
+ * @return
+ *      - ESP_OK if successful
+ *      - ESP_ERR_INVALID_ARG if a rate or the channel count is not positive
+ *      - ESP_ERR_NOT_SUPPORTED if the ratio needs too many phases
+ *      - ESP_ERR_NO_MEM if out of memory
+ */
+esp_err_t polyphase_init(polyphase_t *pp, int in_rate, int out_rate,
+        int channels, polyphase_quality_t quality);
+
+/**
+ * (Re)initialize an adaptive converter, at a ratio of 1. Zeroed memory is a
+ * valid converter to initialize.
+ *
+ * @param pp        Pointer to converter
+ * @param rate      Nominal sample rate, of both the input and the output
+ * @param channels  Number of channels
+ * @param quality   Length of the filter
+ *
+ * @return
+ *      - ESP_OK if successful
+ *      - ESP_ERR_INVALID_ARG if the rate or the channel count is not
+ *        positive
+ *      - ESP_ERR_NO_MEM if out of memory
+ */
+esp_err_t polyphase_init_adaptive(polyphase_t *pp, int rate, int channels,
+        polyphase_quality_t quality);
+
+/**
+ * Set the ratio of an adaptive converter, from the next output frame on.
+ * It is kept within 1 +- 1/16, the filter cuts off just below the Nyquist
+ * frequency of the input.
+ *
+ * @param pp        Pointer to adaptive converter
+ * @param ratio     Q32 input frames per output frame, POLYPHASE_ONE for 1
+ */
+void polyphase_set_ratio(polyphase_t *pp, uint64_t ratio);
+
+/**
+ * Number of input frames needed for `out_frames` more output frames, on
+ * top of those in the history. At most POLYPHASE_BLOCK are taken per call.
+ */
+size_t polyphase_frames_needed(const polyphase_t *pp, size_t out_frames);
+
+/**
+ * Take input frames, and write as many output frames as they complete
+ *
+ * @param pp            Pointer to converter
+ * @param in            Input frames, interleaved
+ * @param in_frames     Number of input frames
+ * @param used          Set to the number of input frames taken, the rest
+ *                      should be given again in the next call
+ * @param out           Output frames, interleaved
+ * @param out_frames    Max number of frames to write to `out`
+ *
+ * @return
+ *      - Number of frames written to `out`
+ */
+size_t polyphase_process(polyphase_t *pp, const int32_t *in,
+        size_t in_frames, size_t *used, int32_t *out, size_t out_frames);
+
+/**
+ * Free the filter and the history
+ *
+ * @param pp        Pointer to converter
+ */
+void polyphase_deinit(polyphase_t *pp);
+
+#endif
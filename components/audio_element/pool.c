@@ -0,0 +1,111 @@
+#include <string.h>
+
+#include "pool.h"
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+
+static const char TAG[] = "POOL";
+
+static pool_t *s_pools = NULL;
+static portMUX_TYPE s_pools_lock = portMUX_INITIALIZER_UNLOCKED;
+
+
+// Pools are defined statically, add them to the list on first use
+static void _register(pool_t *pool) {
+    portENTER_CRITICAL(&s_pools_lock);
+    if (!pool->registered) {
+        pool->next = s_pools;
+        s_pools = pool;
+        pool->registered = true;
+    }
+    portEXIT_CRITICAL(&s_pools_lock);
+}
+
+
+void *pool_alloc(pool_t *pool) {
+    void *block = NULL;
+
+    if (!pool->registered)
+        _register(pool);
+
+    portENTER_CRITICAL(&pool->lock);
+    if (pool->free_list) {
+        block = pool->free_list;
+        pool->free_list = *(void **)block;
+    } else if (pool->untouched < pool->count) {
+        block = pool->mem + pool->untouched++ * pool->block_size;
+    }
+
+    if (block) {
+        pool->allocs++;
+        if (++pool->in_use > pool->high_water)
+            pool->high_water = pool->in_use;
+    } else {
+        pool->failures++;
+    }
+    portEXIT_CRITICAL(&pool->lock);
+
+    if (!block)
+        ESP_LOGE(TAG, "[%s] Exhausted, all %d blocks in use", pool->name,
+                pool->count);
+    return block;
+}
+
+
+void *pool_calloc(pool_t *pool) {
+    void *block = pool_alloc(pool);
+    if (block)
+        memset(block, 0, pool->block_size);
+    return block;
+}
+
+
+void pool_free(pool_t *pool, void *block) {
+    if (!block)
+        return;
+
+    if (!pool_owns(pool, block)
+            || ((char *)block - pool->mem) % pool->block_size) {
+        ESP_LOGE(TAG, "[%s] %p is not a block of this pool", pool->name,
+                block);
+        return;
+    }
+
+    portENTER_CRITICAL(&pool->lock);
+    *(void **)block = pool->free_list;
+    pool->free_list = block;
+    pool->in_use--;
+    portEXIT_CRITICAL(&pool->lock);
+}
+
+
+bool pool_owns(pool_t *pool, const void *ptr) {
+    const char *p = ptr;
+    return p >= pool->mem && p < pool->mem + pool->count * pool->block_size;
+}
+
+
+void pool_get_stats(pool_t *pool, pool_stats_t *stats) {
+    portENTER_CRITICAL(&pool->lock);
+    stats->block_size = pool->block_size;
+    stats->count = pool->count;
+    stats->in_use = pool->in_use;
+    stats->high_water = pool->high_water;
+    stats->allocs = pool->allocs;
+    stats->failures = pool->failures;
+    portEXIT_CRITICAL(&pool->lock);
+}
+
+
+void pool_dump_stats(void) {
+    pool_stats_t stats;
+
+    for (pool_t *pool = s_pools; pool; pool = pool->next) {
+        pool_get_stats(pool, &stats);
+        ESP_LOGI(TAG, "[%s] %d x %d bytes, in use %d, high water %d, "
+                "allocs %u, failed %u", pool->name, stats.count,
+                stats.block_size, stats.in_use, stats.high_water,
+                stats.allocs, stats.failures);
+    }
+}
@@ -0,0 +1,119 @@
+/**
+ * Fixed-block pool allocator.
+ *
+ * A pool hands out blocks of a single size from one statically allocated
+ * array, so objects that come and go (bt event parameters, io_t's, ...) do
+ * not fragment the heap. Allocation and freeing are O(1) and can be done
+ * from any task.
+ *
+ * Pools are defined at file scope with POOL_DEFINE and need no further
+ * initialization. Every pool keeps a high-water mark and counts the
+ * allocations that failed because it was exhausted, to be able to size it.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+
+// Blocks are aligned to 8 bytes, and large enough to link them when free
+#define POOL_BLOCK_SIZE(size) \
+    ((((size) < sizeof(void *) ? sizeof(void *) : (size)) + 7) & ~(size_t)7)
+
+typedef struct pool pool_t;
+
+struct pool {
+    const char      *name;
+    char            *mem;
+    size_t          block_size;     // Rounded up with POOL_BLOCK_SIZE
+    size_t          count;
+
+    portMUX_TYPE    lock;
+    void            *free_list;     // Blocks freed before
+    size_t          untouched;      // Index of the first never used block
+
+    // Counters
+    size_t          in_use;
+    size_t          high_water;     // Max blocks in use, ever
+    uint32_t        allocs;
+    uint32_t        failures;       // Allocations with the pool exhausted
+
+    bool            registered;     // In the list of pools, for the stats
+    pool_t          *next;
+};
+
+/**
+ * Define a pool of `count` blocks of `size` bytes, e.g.
+ *      POOL_DEFINE(s_msg_pool, sizeof(msg_t), 8);
+ */
+#define POOL_DEFINE(var, size, cnt)                                     \
+    static char var##_mem[(cnt) * POOL_BLOCK_SIZE(size)]                \
+        __attribute__((aligned(8)));                                    \
+    static pool_t var = {                                               \
+        .name = #var,                                                   \
+        .mem = var##_mem,                                               \
+        .block_size = POOL_BLOCK_SIZE(size),                            \
+        .count = (cnt),                                                 \
+        .lock = portMUX_INITIALIZER_UNLOCKED,                           \
+    }
+
+/**
+ * Statistics of a pool, see pool_get_stats
+ */
+typedef struct pool_stats {
+    size_t      block_size;
+    size_t      count;
+    size_t      in_use;
+    size_t      high_water;
+    uint32_t    allocs;
+    uint32_t    failures;
+} pool_stats_t;
+
+
+/**
+ * Take a block from the pool
+ *
+ * @param pool  Pointer to pool
+ *
+ * @return
+ *      - Pointer to a block of at least the pool's size, not cleared
+ *      - NULL if the pool is exhausted
+ */
+void *pool_alloc(pool_t *pool);
+
+/**
+ * Same as pool_alloc, but the block is zeroed
+ */
+void *pool_calloc(pool_t *pool);
+
+/**
+ * Return a block to the pool
+ *
+ * @param pool  Pointer to pool
+ * @param block Block taken from this pool, or NULL
+ */
+void pool_free(pool_t *pool, void *block);
+
+/**
+ * Check whether a pointer points into a block of the pool
+ */
+bool pool_owns(pool_t *pool, const void *ptr);
+
+/**
+ * Get the statistics of a pool. Can be called from any task.
+ *
+ * @param pool  Pointer to pool
+ * @param stats Filled with the statistics
+ */
+void pool_get_stats(pool_t *pool, pool_stats_t *stats);
+
+/**
+ * Log the statistics of every pool that has been used
+ */
+void pool_dump_stats(void);
+
+#endif
@@ -0,0 +1,90 @@
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+
+#include "resampler.h"
+#include "audio_element.h"
+#include "block_conv.h"
+#include "polyphase.h"
+
+#include "esp_log.h"
+
+static const char TAG[] = "RESAMPLER";
+
+typedef struct {
+    block_conv_t bc;
+    polyphase_t pp;
+    int      out_rate;
+    polyphase_quality_t quality;
+} resampler_t;
+
+
+// Set up the converter for a new input format, none at the output rate
+static bool _resampler_format(audio_element_t *el,
+        audio_element_info_t *out) {
+    resampler_t *rs = el->data;
+    esp_err_t ret;
+
+    if (out->sample_rate == rs->out_rate)
+        return false;
+    ret = polyphase_init(&rs->pp, out->sample_rate, rs->out_rate,
+            out->channels, rs->quality);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "[%s] Cannot resample %d Hz to %d Hz: %s, passing "
+                "it on as is", el->tag, out->sample_rate, rs->out_rate,
+                esp_err_to_name(ret));
+        return false;
+    }
+    out->sample_rate = rs->out_rate;
+    return true;
+}
+
+
+static size_t _resampler_frames_needed(audio_element_t *el,
+        size_t out_frames) {
+    resampler_t *rs = el->data;
+    return polyphase_frames_needed(&rs->pp, out_frames);
+}
+
+
+static size_t _resampler_convert(audio_element_t *el, const int32_t *in,
+        size_t in_frames, size_t *used, int32_t *out, size_t out_frames) {
+    resampler_t *rs = el->data;
+    return polyphase_process(&rs->pp, in, in_frames, used, out, out_frames);
+}
+
+
+static void _resampler_deinit(audio_element_t *el) {
+    resampler_t *rs = el->data;
+    polyphase_deinit(&rs->pp);
+}
+
+
+static const block_conv_ops_t s_resampler_ops = {
+    .format = _resampler_format,
+    .frames_needed = _resampler_frames_needed,
+    .process = _resampler_convert,
+    .deinit = _resampler_deinit,
+};
+
+
+audio_element_t *resampler_init(audio_element_cfg_t cfg, int out_rate,
+        polyphase_quality_t quality) {
+    if (out_rate <= 0) {
+        ESP_LOGE(TAG, "Invalid output rate: %d", out_rate);
+        return NULL;
+    }
+
+    resampler_t *rs = calloc(1, sizeof(resampler_t));
+    if (!rs) {
+        ESP_LOGE(TAG, "Could not allocate memory!");
+        return NULL;
+    }
+    rs->out_rate = out_rate;
+    rs->quality = quality;
+
+    cfg.tag = "resampler";
+
+    audio_element_t *el = block_conv_init(&cfg, &s_resampler_ops, &rs->bc);
+    if (!el)
+        free(rs);
+    return el;
+}
@@ -0,0 +1,40 @@
+/**
+ * Resampler: converts a stream to a fixed sample rate.
+ *
+ * Uses the polyphase windowed-sinc converter of polyphase.h, so any ratio
+ * up to POLYPHASE_MAX_PHASES phases works, e.g. 44.1 to 48 kHz, 32 to 48
+ * kHz, or 16 to 44.1 kHz. The filter state is kept between blocks, and the
+ * converter is set up again when the input format changes. An input that
+ * is at the output rate already is passed on as is.
+ *
+ * The output has the channels and bits of the input. Samples are converted
+ * through int32_t blocks, see block_conv.h.
+ */
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include "audio_element.h"
+#include "polyphase.h"
+
+
+/**
+ * Initialize the resampler
+ *
+ * The open, process and destroy fields of `cfg` are set by the resampler.
+ * `buf_len` is the max number of bytes read from the input per process
+ * call.
+ *
+ * @param cfg       A configured `audio_element_cfg_t` struct, linked to the
+ *                  element to resample
+ * @param out_rate  Sample rate of the output
+ * @param quality   Length of the filter, see polyphase.h
+ *
+ * @return
+ *      - audio_element_t if successful
+ *      - NULL otherwise
+ */
+audio_element_t *resampler_init(audio_element_cfg_t cfg, int out_rate,
+        polyphase_quality_t quality);
+
+#endif
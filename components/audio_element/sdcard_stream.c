@@ -4,18 +4,85 @@
 #include "sdcard_stream.h"
 #include "sdcard.h"
 
+#include <string.h>
+
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 static const char TAG[] = "SDCARD_STREAM";
 
+#define WAV_HEADER_SIZE 44
+#define PACK_SAMPLES 256    // 24 bit samples packed per fwrite
+
 
 typedef struct sdcard_stream {
     audio_stream_type_t type;
     FILE *file;
+
+    // Writer only
+    sdcard_clock_t clock;
+    audio_element_info_t info;  // Format of the data in the file
+    uint32_t data_bytes;
+    int64_t start;              // us, first write with SDCARD_CLOCK_REALTIME
+    uint64_t clock_bytes;       // Bytes written since 'start'
+    uint8_t carry[4];           // A 24 bit sample split by the input ring
+    size_t carry_len;
 } sdcard_stream_t;
 
 
+// In the stream, see mix.h
+static inline int _bytes_per_sample(audio_element_info_t *info) {
+    return info->bits > 16 ? 4 : info->bits/8;
+}
+
+// In the file, 24 bit samples are packed in three bytes
+static inline int _file_bytes_per_sample(audio_element_info_t *info) {
+    return info->bits/8;
+}
+
+static inline void _le16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static inline void _le32(uint8_t *p, uint32_t v) {
+    _le16(p, v);
+    _le16(p + 2, v >> 16);
+}
+
+// Write the RIFF header for 'data_bytes' bytes of data to the file start
+static esp_err_t _write_wav_header(sdcard_stream_t *stream) {
+    audio_element_info_t *info = &stream->info;
+    uint8_t header[WAV_HEADER_SIZE];
+    // 24 bit samples are packed, so every format is plain PCM
+    int bytes = _file_bytes_per_sample(info);
+    int block_align = bytes * info->channels;
+
+    memcpy(header, "RIFF", 4);
+    _le32(header + 4, WAV_HEADER_SIZE - 8 + stream->data_bytes);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    _le32(header + 16, 16);                 // fmt chunk size
+    _le16(header + 20, 1);                  // PCM
+    _le16(header + 22, info->channels);
+    _le32(header + 24, info->sample_rate);
+    _le32(header + 28, info->sample_rate * block_align);
+    _le16(header + 32, block_align);
+    _le16(header + 34, bytes * 8);
+    memcpy(header + 36, "data", 4);
+    _le32(header + 40, stream->data_bytes);
+
+    if (fseek(stream->file, 0, SEEK_SET) != 0
+            || fwrite(header, 1, WAV_HEADER_SIZE, stream->file)
+                != WAV_HEADER_SIZE)
+        return ESP_FAIL;
+    return ESP_OK;
+}
+
+
 
 static esp_err_t _sdcard_open(audio_element_t *el, void* pv) {
     sdcard_stream_t *stream = el->data;
@@ -50,9 +117,22 @@ static esp_err_t _sdcard_open(audio_element_t *el, void* pv) {
         fseek(stream->file, 0, SEEK_SET);
         ESP_LOGI(TAG, "[%s] File is %d bytes", el->tag, bytes);
     } else {
-        ESP_LOGE(TAG, "[%s] sdcard_stream only support AEL_STREAM_READER for now.",
-                el->tag);
-        return ESP_FAIL;
+        stream->file = fopen(uri, "w");
+        if (!stream->file) {
+            ESP_LOGE(TAG, "[%s] Could not open file", el->tag);
+            return ESP_FAIL;
+        }
+
+        // The header is written again with the real sizes on close
+        stream->info = audio_element_get_info(el->input);
+        stream->data_bytes = 0;
+        stream->clock_bytes = 0;
+        if (_write_wav_header(stream) != ESP_OK) {
+            ESP_LOGE(TAG, "[%s] Could not write header", el->tag);
+            fclose(stream->file);
+            stream->file = NULL;
+            return ESP_FAIL;
+        }
     }
 
     el->is_open = true;
@@ -66,7 +146,15 @@ static esp_err_t _sdcard_close(audio_element_t *el) {
 
     if (stream->file) {
         ESP_LOGI(TAG, "[%s] Closing", el->tag);
+        if (stream->type == AEL_STREAM_WRITER) {
+            ESP_LOGI(TAG, "[%s] Wrote %u bytes: %d Hz, %d bits, %d channels",
+                    el->tag, stream->data_bytes, stream->info.sample_rate,
+                    stream->info.bits, stream->info.channels);
+            if (_write_wav_header(stream) != ESP_OK)
+                ESP_LOGE(TAG, "[%s] Could not write header", el->tag);
+        }
         fclose(stream->file);
+        stream->file = NULL;
         el->is_open = false;
     }
 
@@ -98,6 +186,135 @@ static size_t _sdcard_read(io_t *io, char *buf, size_t len, void *pv) {
 }
 
 
+// With SDCARD_CLOCK_REALTIME, wait until 'len' more bytes would have been
+// played at the rate of the data
+static void _pace(sdcard_stream_t *stream, size_t len) {
+    audio_element_info_t *info = &stream->info;
+    int64_t rate = (int64_t)info->sample_rate * info->channels
+        * _bytes_per_sample(info);
+    int64_t ahead;
+
+    // No format known yet, nothing to pace by
+    if (rate <= 0)
+        return;
+
+    if (!stream->clock_bytes)
+        stream->start = esp_timer_get_time();
+    stream->clock_bytes += len;
+
+    ahead = stream->clock_bytes * 1000000 / rate
+        - (esp_timer_get_time() - stream->start);
+    if (ahead >= portTICK_PERIOD_MS * 1000)
+        vTaskDelay(ahead / 1000 / portTICK_PERIOD_MS);
+}
+
+
+// Append 24 bit samples, right aligned in 32 bit words, packed in three
+// bytes. Returns the bytes of 'data' written.
+static size_t _write_packed(FILE *file, const char *data, size_t len) {
+    const int32_t *src = (const int32_t*)data;
+    uint8_t buf[3 * PACK_SAMPLES];
+    size_t samples = len / 4, done = 0, n;
+
+    while (done < samples) {
+        n = samples - done < PACK_SAMPLES ? samples - done : PACK_SAMPLES;
+        for (size_t i = 0; i < n; i++) {
+            int32_t x = src[done + i];
+            buf[3*i] = x;
+            buf[3*i + 1] = x >> 8;
+            buf[3*i + 2] = x >> 16;
+        }
+        if (fwrite(buf, 1, 3 * n, file) != 3 * n)
+            break;
+        done += n;
+    }
+    return done * 4;
+}
+
+
+// Append 24 bit samples, see _write_packed. A sample split by the wrap of
+// the input ring has its first bytes kept in 'carry' until the rest is
+// there. Returns the bytes of 'data' taken.
+static size_t _write_24(sdcard_stream_t *stream, const char *data,
+        size_t len) {
+    size_t done = 0, whole, bytes;
+
+    if (stream->carry_len) {
+        done = 4 - stream->carry_len < len ? 4 - stream->carry_len : len;
+        memcpy(stream->carry + stream->carry_len, data, done);
+        stream->carry_len += done;
+        if (stream->carry_len < 4)
+            return done;
+        if (!_write_packed(stream->file, (char *)stream->carry, 4))
+            return 0;
+        stream->carry_len = 0;
+        stream->data_bytes += 3;
+    }
+
+    whole = (len - done) / 4 * 4;
+    bytes = _write_packed(stream->file, data + done, whole);
+    stream->data_bytes += bytes / 4 * 3;
+    done += bytes;
+    if (bytes == whole && done < len) {
+        memcpy(stream->carry, data + done, len - done);
+        stream->carry_len = len - done;
+        done = len;
+    }
+    return done;
+}
+
+
+// Borrow data from the input and append it to the file
+static size_t _sdcard_write_process(audio_element_t *el) {
+    sdcard_stream_t *stream = el->data;
+    audio_element_info_t info;
+    size_t len = el->buf_len;
+    size_t bytes;
+
+    char *data = io_acquire_read(el->input, &len, el);
+    if (!data)
+        return 0;
+
+    // A WAV file has a single format, only take it while nothing is written
+    if (audio_element_info_changed(el->input, stream->info.gen)) {
+        info = audio_element_get_info(el->input);
+        if (stream->data_bytes && (info.sample_rate != stream->info.sample_rate
+                    || info.bits != stream->info.bits
+                    || info.channels != stream->info.channels))
+            ESP_LOGW(TAG, "[%s] Format changed to %d Hz, %d bits, %d "
+                    "channels at byte %u, not in the header", el->tag,
+                    info.sample_rate, info.bits, info.channels,
+                    stream->data_bytes);
+        if (!stream->data_bytes)
+            stream->info = info;
+        stream->info.gen = info.gen;
+    }
+
+    if (stream->info.bits == 24) {
+        bytes = _write_24(stream, data, len);
+    } else {
+        bytes = fwrite(data, 1, len, stream->file);
+        stream->data_bytes += bytes;
+    }
+    io_release_read(el->input, bytes);
+    if (bytes != len) {
+        ESP_LOGE(TAG, "[%s] Could not write to file", el->tag);
+        return ESP_FAIL;
+    }
+
+    if (stream->clock == SDCARD_CLOCK_REALTIME)
+        _pace(stream, bytes);
+    return bytes;
+}
+
+
+void sdcard_stream_set_clock(audio_element_t *el, sdcard_clock_t clock) {
+    sdcard_stream_t *stream = el->data;
+    stream->clock = clock;
+    stream->clock_bytes = 0;
+}
+
+
 audio_element_t *sdcard_stream_init(audio_element_cfg_t cfg, audio_stream_type_t type) {
     sdcard_stream_t *stream = calloc(1, sizeof(sdcard_stream_t));
     if (!stream) {
@@ -117,16 +334,18 @@ audio_element_t *sdcard_stream_init(audio_element_cfg_t cfg, audio_stream_type_t
     if (type == AEL_STREAM_READER) {
         cfg.read = _sdcard_read;
     } else {
-        // TODO: Add support for file writing
-        // AEL_STREAM_WRITER;
-        ESP_LOGE(TAG, "AEL_STREAM_WRITER Not implemented yet.");
-        return NULL;
+        // Data leaves through the file, not through an output io_t
+        cfg.process = _sdcard_write_process;
+        cfg.output = IO_UNUSED;
+        stream->clock = SDCARD_CLOCK_FREE;
     }
 
     audio_element_t *el = audio_element_init(&cfg);
     if (!el) {
         ESP_LOGE(TAG, "[%s] Could not allocate memory for audio element.",
                 cfg.tag);
+        free(stream);
+        return NULL;
     }
     el->data = stream;
 
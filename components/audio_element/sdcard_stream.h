@@ -4,9 +4,23 @@
 #include "audio_element.h"
 
 
+/**
+ * What paces a writer
+ */
+typedef enum {
+    SDCARD_CLOCK_FREE,      // Nothing, write as fast as the data comes in
+    SDCARD_CLOCK_REALTIME,  // The sample rate, like an i2s sink would
+} sdcard_clock_t;
+
+
 /**
  * Initialize sdcard stream
  *
+ * A reader reads the raw bytes of a file. A writer writes its input to a
+ * WAV file, the RIFF header is completed when the element is closed. The
+ * header holds the format of the first data written. 24 bit samples are
+ * packed in three bytes in the file.
+ *
  * @param config    Pointer to a sdcard_stream_cfg struct
  *
  * @return 
@@ -15,4 +29,14 @@
  */
 audio_element_t *sdcard_stream_init(audio_element_cfg_t cfg, audio_stream_type_t type);
 
+/**
+ * Set the clock of a writer, SDCARD_CLOCK_FREE by default. Free running,
+ * a writer renders the pipeline as fast as it can. Use
+ * SDCARD_CLOCK_REALTIME to record a stream that is paced by nothing else.
+ *
+ * @param el        Pointer to sdcard stream writer
+ * @param clock     The clock
+ */
+void sdcard_stream_set_clock(audio_element_t *el, sdcard_clock_t clock);
+
 #endif
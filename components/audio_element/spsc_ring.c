@@ -0,0 +1,120 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "spsc_ring.h"
+
+
+static inline size_t _min(size_t a, size_t b) {
+    return a < b ? a : b;
+}
+
+// Split 'len' bytes starting at (masked) index 'pos' into two regions
+static void _regions(spsc_ring_t *ring, size_t pos, size_t len,
+        spsc_region_t regions[2]) {
+    size_t first = _min(len, ring->size - pos);
+
+    regions[0].data = ring->buf + pos;
+    regions[0].len = first;
+    regions[1].data = ring->buf;
+    regions[1].len = len - first;
+}
+
+spsc_ring_t *spsc_ring_create(size_t size) {
+    size_t pow2 = 1;
+    while (pow2 < size)
+        pow2 <<= 1;
+
+    spsc_ring_t *ring = calloc(1, sizeof(spsc_ring_t));
+    if (!ring)
+        return NULL;
+
+    ring->buf = malloc(pow2);
+    if (!ring->buf) {
+        free(ring);
+        return NULL;
+    }
+    ring->size = pow2;
+    ring->mask = pow2 - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+
+    return ring;
+}
+
+void spsc_ring_destroy(spsc_ring_t *ring) {
+    free(ring->buf);
+    free(ring);
+}
+
+size_t spsc_ring_fill(spsc_ring_t *ring) {
+    // Tail first, head can only have moved further by the time it is loaded
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    return head - tail;
+}
+
+size_t spsc_ring_space(spsc_ring_t *ring) {
+    return ring->size - spsc_ring_fill(ring);
+}
+
+size_t spsc_ring_committed(spsc_ring_t *ring) {
+    return atomic_load_explicit(&ring->head, memory_order_acquire);
+}
+
+size_t spsc_ring_write_regions(spsc_ring_t *ring, spsc_region_t regions[2]) {
+    // Own index can be read relaxed, the other side's needs acquire so the
+    // consumer is done with the bytes before they are overwritten
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t space = ring->size - (head - tail);
+
+    _regions(ring, head & ring->mask, space, regions);
+    return space;
+}
+
+void spsc_ring_commit(spsc_ring_t *ring, size_t len) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + len, memory_order_release);
+}
+
+size_t spsc_ring_read_regions(spsc_ring_t *ring, spsc_region_t regions[2]) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t fill = head - tail;
+
+    _regions(ring, tail & ring->mask, fill, regions);
+    return fill;
+}
+
+void spsc_ring_release(spsc_ring_t *ring, size_t len) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + len, memory_order_release);
+}
+
+size_t spsc_ring_write(spsc_ring_t *ring, const char *buf, size_t len) {
+    spsc_region_t regions[2];
+    size_t space = spsc_ring_write_regions(ring, regions);
+    size_t first;
+
+    len = _min(len, space);
+    first = _min(len, regions[0].len);
+    memcpy(regions[0].data, buf, first);
+    memcpy(regions[1].data, buf + first, len - first);
+
+    spsc_ring_commit(ring, len);
+    return len;
+}
+
+size_t spsc_ring_read(spsc_ring_t *ring, char *buf, size_t len) {
+    spsc_region_t regions[2];
+    size_t fill = spsc_ring_read_regions(ring, regions);
+    size_t first;
+
+    len = _min(len, fill);
+    first = _min(len, regions[0].len);
+    memcpy(buf, regions[0].data, first);
+    memcpy(buf + first, regions[1].data, len - first);
+
+    spsc_ring_release(ring, len);
+    return len;
+}
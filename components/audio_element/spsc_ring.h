@@ -0,0 +1,114 @@
+/**
+ * Lock-free single-producer/single-consumer byte ring.
+ *
+ * Only depends on C11 atomics, so it can be used on the host as well. One
+ * task may write, one (other) task may read, without any locking.
+ *
+ * The size is always a power of two; head and tail are free running
+ * counters that are masked on access. Free space and available data are
+ * returned as (up to) two regions, the second one starting at the beginning
+ * of the buffer when the data wraps. This way a complete view of the ring
+ * is available in a single call.
+ */
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+typedef struct {
+    char    *data;
+    size_t  len;
+} spsc_region_t;
+
+typedef struct {
+    char            *buf;
+    size_t          size;   // Power of two
+    size_t          mask;
+    atomic_size_t   head;   // Written by the producer only
+    atomic_size_t   tail;   // Written by the consumer only
+} spsc_ring_t;
+
+
+/**
+ * Create a new ring. The size is rounded up to the next power of two.
+ *
+ * @param size Minimal size of the ring in bytes
+ *
+ * @return
+ *      - spsc_ring_t pointer
+ *      - NULL if out of memory
+ */
+spsc_ring_t *spsc_ring_create(size_t size);
+
+/**
+ * Destroy and free a ring
+ *
+ * @param ring Pointer to ring
+ */
+void spsc_ring_destroy(spsc_ring_t *ring);
+
+/**
+ * Number of bytes that can be read
+ */
+size_t spsc_ring_fill(spsc_ring_t *ring);
+
+/**
+ * Number of bytes that can be written
+ */
+size_t spsc_ring_space(spsc_ring_t *ring);
+
+/**
+ * Number of bytes committed since the ring was created, wraps around. Can be
+ * called from any task, all data visible to it is included.
+ */
+size_t spsc_ring_committed(spsc_ring_t *ring);
+
+/**
+ * Producer: get the free space of the ring as two regions.
+ *
+ * @param ring Pointer to ring
+ * @param regions Filled with the free regions, regions[1].len is 0 if the
+ *                free space does not wrap
+ *
+ * @return Total number of free bytes
+ */
+size_t spsc_ring_write_regions(spsc_ring_t *ring, spsc_region_t regions[2]);
+
+/**
+ * Producer: publish `len` bytes written to the regions
+ */
+void spsc_ring_commit(spsc_ring_t *ring, size_t len);
+
+/**
+ * Consumer: get the readable data of the ring as two regions.
+ *
+ * @param ring Pointer to ring
+ * @param regions Filled with the readable regions, regions[1].len is 0 if
+ *                the data does not wrap
+ *
+ * @return Total number of readable bytes
+ */
+size_t spsc_ring_read_regions(spsc_ring_t *ring, spsc_region_t regions[2]);
+
+/**
+ * Consumer: free `len` bytes after they have been read
+ */
+void spsc_ring_release(spsc_ring_t *ring, size_t len);
+
+/**
+ * Producer: copy up to `len` bytes into the ring
+ *
+ * @return Number of bytes written
+ */
+size_t spsc_ring_write(spsc_ring_t *ring, const char *buf, size_t len);
+
+/**
+ * Consumer: copy up to `len` bytes out of the ring
+ *
+ * @return Number of bytes read
+ */
+size_t spsc_ring_read(spsc_ring_t *ring, char *buf, size_t len);
+
+#endif
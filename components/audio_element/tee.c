@@ -0,0 +1,122 @@
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+
+#include "tee.h"
+#include "audio_element.h"
+#include "bcast_ring.h"
+#include "io.h"
+
+#include "esp_log.h"
+
+static const char TAG[] = "TEE";
+
+typedef struct {
+    io_t     *outputs[TEE_MAX_OUTPUTS];
+    size_t   count;
+} tee_t;
+
+
+static esp_err_t _tee_open(audio_element_t *el, void* pv) {
+    ESP_LOGI(TAG, "[%s] Initialization done", el->tag);
+    el->is_open = true;
+    return ESP_OK;
+}
+
+
+static esp_err_t _tee_destroy(audio_element_t *el) {
+    tee_t *tee = el->data;
+
+    // The outputs are taps, destroyed by the elements reading them
+    ESP_LOGI(TAG, "Destroying Tee");
+    free(tee);
+
+    return ESP_OK;
+}
+
+
+audio_element_t *tee_init(audio_element_cfg_t cfg, bcast_lag_t policies[],
+        size_t count) {
+    int task_stack = cfg.task_stack;
+    size_t i;
+
+    if (!count || count > TEE_MAX_OUTPUTS) {
+        ESP_LOGE(TAG, "Invalid number of outputs: %d, a max of %d allowed",
+                count, TEE_MAX_OUTPUTS);
+        return NULL;
+    }
+
+    tee_t *tee = calloc(1, sizeof(tee_t));
+    if (!tee) {
+        ESP_LOGE(TAG, "Could not allocate memory!");
+        return NULL;
+    }
+
+    cfg.open = _tee_open;
+    cfg.destroy = _tee_destroy;
+
+    // The default process moves the input into the output, which is the
+    // shared ring
+    cfg.process = NULL;
+    cfg.output = NULL;
+    cfg.out_rb_backend = IO_BACKEND_BCAST;
+    if (!cfg.out_rb_size)
+        cfg.out_rb_size = DEFAULT_OUT_RB_SIZE;
+
+    cfg.tag = "tee";
+    // The task starts once the outputs are there, until then a failure
+    // can still take the element down
+    cfg.task_stack = 0;
+
+    audio_element_t *el = audio_element_init(&cfg);
+    if (!el) {
+        ESP_LOGE(TAG, "[%s] could not init audio element.", cfg.tag);
+        free(tee);
+        return NULL;
+    }
+    el->data = tee;
+
+    for (i = 0; i < count; i++) {
+        tee->outputs[i] = io_tap(el->output, policies[i]);
+        if (!tee->outputs[i]) {
+            ESP_LOGE(TAG, "[%s] could not create output %d", el->tag, i);
+            // The taps go before the ring they tap, with the element
+            while (i--)
+                io_destroy(tee->outputs[i]);
+            audio_element_deinit(el);
+            return NULL;
+        }
+    }
+    tee->count = count;
+
+    if (task_stack > 0 && audio_element_start_task(el, task_stack) != ESP_OK) {
+        for (i = 0; i < count; i++)
+            io_destroy(tee->outputs[i]);
+        audio_element_deinit(el);
+        return NULL;
+    }
+    return el;
+}
+
+
+io_t *tee_output(audio_element_t *el, size_t index) {
+    tee_t *tee = el->data;
+    return index < tee->count ? tee->outputs[index] : NULL;
+}
+
+
+void tee_reconnect(audio_element_t *el, size_t index) {
+    io_t *output = tee_output(el, index);
+    if (!output)
+        return;
+
+    ESP_LOGD(TAG, "[%s] Reconnecting output %d", el->tag, index);
+    output->rd_len = 0;
+    bcast_ring_reconnect(output->bcast, output->tap);
+}
+
+
+uint32_t tee_dropped(audio_element_t *el, size_t index) {
+    io_t *output = tee_output(el, index);
+    if (!output)
+        return 0;
+    return atomic_load(&output->bcast->readers[output->tap].dropped);
+}
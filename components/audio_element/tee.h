@@ -0,0 +1,76 @@
+/**
+ * Tee: send the output of one element to several elements.
+ *
+ * The tee writes its input once into a broadcast ring (IO_BACKEND_BCAST).
+ * Every output of the tee is a tap on that ring, so all of them read the
+ * same memory and no data is copied per output. A callback backed input is
+ * read straight into the ring, a ringbuffer input is copied into it once.
+ *
+ * What happens when one output falls behind the others is set per output,
+ * see bcast_lag_t. E.g. the i2s output blocks the tee, while a network
+ * output drops data instead of stalling the speaker.
+ *
+ * Link an element to an output by setting `cfg.input = tee_output(tee, i)`
+ * instead of using audio_element_cfg_link.
+ */
+
+#ifndef TEE_H
+#define TEE_H
+
+#include "audio_element.h"
+#include "bcast_ring.h"
+#include "io.h"
+
+#define TEE_MAX_OUTPUTS BCAST_MAX_READERS
+
+
+/**
+ * Initialize the tee
+ *
+ * The open, process and output fields of `cfg` are set by the tee.
+ * `out_rb_size` is the size of the shared ring.
+ *
+ * @param cfg       A configured `audio_element_cfg_t` struct, linked to the
+ *                  element to tee
+ * @param policies  Lag policy of every output
+ * @param count     Number of outputs, max TEE_MAX_OUTPUTS
+ *
+ * @return
+ *      - audio_element_t if successful
+ *      - NULL otherwise
+ */
+audio_element_t *tee_init(audio_element_cfg_t cfg, bcast_lag_t policies[],
+        size_t count);
+
+/**
+ * Get an output of the tee, to be used as input of another element
+ *
+ * @param el        Pointer to the tee
+ * @param index     Index of the output
+ *
+ * @return
+ *      - io_t pointer
+ *      - NULL if there is no such output
+ */
+io_t *tee_output(audio_element_t *el, size_t index);
+
+/**
+ * Reconnect an output disconnected by BCAST_LAG_DISCONNECT. It continues
+ * with the newest data. Has to be called by the task reading the output.
+ *
+ * @param el        Pointer to the tee
+ * @param index     Index of the output
+ */
+void tee_reconnect(audio_element_t *el, size_t index);
+
+/**
+ * Number of bytes an output missed because of BCAST_LAG_DROP
+ *
+ * @param el        Pointer to the tee
+ * @param index     Index of the output
+ *
+ * @return Bytes dropped, wraps around at 4 GiB
+ */
+uint32_t tee_dropped(audio_element_t *el, size_t index);
+
+#endif
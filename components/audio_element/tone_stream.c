@@ -0,0 +1,193 @@
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+
+#include "tone_stream.h"
+#include "audio_element.h"
+#include "io.h"
+#include "mix.h"
+#include "nco.h"
+
+#include <math.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+static const char TAG[] = "TONE_STREAM";
+
+typedef struct {
+    float    freq;
+    uint32_t frames;
+} tone_t;
+
+typedef struct {
+    tone_stream_cfg_t cfg;
+    nco_t    nco;
+    QueueHandle_t queue;            // Of tone_t, waiting to be played
+    uint32_t left;                  // Frames of the playing tone to go
+    atomic_bool stop;               // Set by tone_stream_stop
+    int32_t  buf[TONE_STREAM_BUF_LEN];
+} tone_stream_t;
+
+
+static size_t _tone_process(audio_element_t *el) {
+    tone_stream_t *ts = el->data;
+    int ch = ts->cfg.channels, bits = ts->cfg.bits;
+    size_t bytes_per_sample = mix_bytes_per_sample(bits),
+           frame_bytes = bytes_per_sample * ch, frames, done, n, j, out_len;
+    tone_t tone;
+    char *data;
+
+    // The output sets the pace, never generate more than it takes right
+    // away
+    frames = io_space(el->output) / frame_bytes;
+    if (frames > TONE_STREAM_BUF_LEN / ch)
+        frames = TONE_STREAM_BUF_LEN / ch;
+    if (frames > el->buf_len / frame_bytes)
+        frames = el->buf_len / frame_bytes;
+    if (!frames)
+        return 0;
+
+    if (atomic_exchange(&ts->stop, false)) {
+        ts->left = 0;
+        while (xQueueReceive(ts->queue, &tone, 0) == pdTRUE)
+            continue;
+    }
+
+    // Every tone starts on the frame after the one before it, silence
+    // while there is none
+    for (done = 0; done < frames; done += n) {
+        if (!ts->left && xQueueReceive(ts->queue, &tone, 0) == pdTRUE) {
+            nco_set_freq(&ts->nco, tone.freq, ts->cfg.sample_rate);
+            ts->nco.phase = 0;
+            ts->left = tone.frames;
+        }
+        n = frames - done;
+        if (ts->left) {
+            if (n > ts->left)
+                n = ts->left;
+            nco_run(&ts->nco, ts->buf + done * ch, n, ch);
+            ts->left -= n;
+        } else {
+            memset(ts->buf + done * ch, 0, n * ch * sizeof(int32_t));
+        }
+    }
+
+    // Store the block, in two regions if the output ring wraps
+    j = 0;
+    while (j < frames * ch) {
+        out_len = (frames * ch - j) * bytes_per_sample;
+        data = io_acquire_write(el->output, &out_len);
+        out_len -= out_len % bytes_per_sample;
+        if (!data || !out_len)
+            return j ? j * bytes_per_sample : IO_WRITE_ERROR;
+
+        mix_store(data, ts->buf + j, out_len / bytes_per_sample, bits);
+        j += out_len / bytes_per_sample;
+        if (io_commit_write(el->output, out_len, el) == IO_WRITE_ERROR)
+            return IO_WRITE_ERROR;
+    }
+
+    return frames * frame_bytes;
+}
+
+
+static esp_err_t _tone_open(audio_element_t *el, void* pv) {
+    tone_stream_t *ts = el->data;
+    audio_element_info_t info = {
+        .sample_rate = ts->cfg.sample_rate,
+        .channels = ts->cfg.channels,
+        .bits = ts->cfg.bits,
+    };
+
+    audio_element_set_info(el->output, info);
+    ESP_LOGI(TAG, "[%s] %d Hz, %d channels, %d bits", el->tag,
+            info.sample_rate, info.channels, info.bits);
+    el->is_open = true;
+    return ESP_OK;
+}
+
+
+static esp_err_t _tone_destroy(audio_element_t *el) {
+    tone_stream_t *ts = el->data;
+
+    ESP_LOGI(TAG, "Destroying Tone stream");
+    vQueueDelete(ts->queue);
+    free(ts);
+
+    return ESP_OK;
+}
+
+
+esp_err_t tone_stream_play(audio_element_t *el, float freq,
+        int duration_ms) {
+    tone_stream_t *ts = el->data;
+    tone_t tone = { .freq = freq };
+
+    if (freq < 0.f || freq >= ts->cfg.sample_rate / 2.f || duration_ms <= 0)
+        return ESP_ERR_INVALID_ARG;
+    tone.frames = ((int64_t)duration_ms * ts->cfg.sample_rate + 500) / 1000;
+
+    if (xQueueSend(ts->queue, &tone, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "[%s] Queue is full, dropping %.1f Hz", el->tag,
+                freq);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+
+void tone_stream_stop(audio_element_t *el) {
+    tone_stream_t *ts = el->data;
+    atomic_store(&ts->stop, true);
+}
+
+
+audio_element_t *tone_stream_init(audio_element_cfg_t cfg,
+        tone_stream_cfg_t tone_cfg) {
+    if (!mix_bytes_per_sample(tone_cfg.bits) || tone_cfg.sample_rate <= 0
+            || tone_cfg.channels <= 0 || tone_cfg.channels > MIX_MAX_CHANNELS
+            || tone_cfg.queue_len <= 0) {
+        ESP_LOGE(TAG, "Cannot generate %d Hz, %d channels, %d bits",
+                tone_cfg.sample_rate, tone_cfg.channels, tone_cfg.bits);
+        return NULL;
+    }
+
+    tone_stream_t *ts = calloc(1, sizeof(tone_stream_t));
+    if (!ts) {
+        ESP_LOGE(TAG, "Could not allocate memory!");
+        return NULL;
+    }
+    ts->cfg = tone_cfg;
+    ts->queue = xQueueCreate(tone_cfg.queue_len, sizeof(tone_t));
+    if (!ts->queue) {
+        ESP_LOGE(TAG, "Could not create queue");
+        free(ts);
+        return NULL;
+    }
+
+    // Full scale of the format, at most 0 dB
+    ts->nco.amp = lrint(((1u << (tone_cfg.bits - 1)) - 1)
+            * pow(10., fmin(tone_cfg.level_db, 0.f) / 20.));
+
+    cfg.open = _tone_open;
+    cfg.destroy = _tone_destroy;
+    cfg.process = _tone_process;
+    // Data comes from the oscillator, not through an input io_t
+    cfg.input = IO_UNUSED;
+
+    cfg.tag = "tone";
+
+    audio_element_t *el = audio_element_init(&cfg);
+    if (!el) {
+        ESP_LOGE(TAG, "[%s] could not init audio element.", cfg.tag);
+        vQueueDelete(ts->queue);
+        free(ts);
+        return NULL;
+    }
+    el->data = ts;
+
+    return el;
+}
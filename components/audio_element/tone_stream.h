@@ -0,0 +1,82 @@
+/**
+ * Tone generator: a source that plays queued sine tones, e.g. as an input
+ * of the mixer for beeps and prompts.
+ *
+ * Every tone comes from the oscillator of nco.h, so it is in tune at any
+ * frequency, and lasts its duration to the frame. The next tone starts on
+ * the frame after, at phase 0, in the middle of a block if need be. While
+ * no tone is queued the output is silence, so the tones keep their timing
+ * relative to the other inputs of the mixer. A tone starts once the
+ * silence before it is out of the output ring, keep that ring small.
+ *
+ * The output has the fixed format of tone_stream_cfg_t, with the same
+ * sample in every channel. Blocks of TONE_STREAM_BUF_LEN int32_t samples
+ * are generated in the element, and stored in that format.
+ */
+
+#ifndef TONE_STREAM_H
+#define TONE_STREAM_H
+
+#include "audio_element.h"
+
+#define TONE_STREAM_BUF_LEN 1024
+
+typedef struct tone_stream_cfg {
+    int     sample_rate;
+    int     channels;
+    int     bits;           // 8, 16, 24 or 32, see mix.h
+    float   level_db;       // Peak of the tones, relative to full scale
+    int     queue_len;      // Tones waiting to be played, at most
+} tone_stream_cfg_t;
+
+#define DEFAULT_TONE_STREAM_CFG() {     \
+    .sample_rate = 44100,               \
+    .channels = 1,                      \
+    .bits = 16,                         \
+    .level_db = -6.f,                   \
+    .queue_len = 8,                     \
+}
+
+
+/**
+ * Initialize the tone generator
+ *
+ * The open, process, destroy and input fields of `cfg` are set by the
+ * generator. `buf_len` is the max number of bytes written per process
+ * call.
+ *
+ * @param cfg       A configured `audio_element_cfg_t` struct
+ * @param tone_cfg  Output format, level and queue length
+ *
+ * @return
+ *      - audio_element_t if successful
+ *      - NULL if the format is not supported, or out of memory
+ */
+audio_element_t *tone_stream_init(audio_element_cfg_t cfg,
+        tone_stream_cfg_t tone_cfg);
+
+/**
+ * Queue a tone, it plays right after the tones queued before it. Can be
+ * called from any task.
+ *
+ * @param el            Pointer to tone generator
+ * @param freq          Frequency in Hz, 0 for silence of the same length
+ * @param duration_ms   Duration, rounded to the nearest frame
+ *
+ * @return
+ *      - ESP_OK if successful
+ *      - ESP_ERR_INVALID_ARG if the frequency is negative or not below half
+ *        the sample rate, or the duration is not positive
+ *      - ESP_ERR_NO_MEM if `queue_len` tones are waiting already
+ */
+esp_err_t tone_stream_play(audio_element_t *el, float freq, int duration_ms);
+
+/**
+ * Cut the tone that is playing, and drop the ones that are waiting, from
+ * the next block on. Can be called from any task.
+ *
+ * @param el        Pointer to tone generator
+ */
+void tone_stream_stop(audio_element_t *el);
+
+#endif
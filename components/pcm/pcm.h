@@ -12,8 +12,7 @@ typedef struct {
     uint8_t channels;
 } pcm_format_t;
 
-
-// TODO: Add functions to resample and change bit depth
-uint8_t *upsample(uint8_t *data, size_t data_len, size_t *out_len, pcm_format_t pcm, int to_rate);
+// Sample rates are converted by the resampler element, see resampler.h in
+// audio_element
 
 #endif
@@ -0,0 +1,213 @@
+/**
+ * Host benchmark: clock drift compensation of the ASRC element.
+ *
+ * A source writes a 44.1 kHz stereo tone into the ASRC's input ring at a
+ * clock that is off by some ppm, and a sink takes 10 ms blocks from its
+ * output at the nominal rate. Both run in simulated time, in the main task,
+ * so hours of drift take seconds. For every drift the time the loop took to
+ * settle is reported: to reach the target, plus settle_ms. After that, the
+ * mean correction, and how far the latency (averaged as the loop sees it)
+ * strayed from the target.
+ *
+ * Usage: asrc_bench [-m minutes] [-j ms] [-t ms] [-q quality] [-v]
+ *                   [ppm ...]
+ *      -m  Simulated time per drift (default 10)
+ *      -j  The source writes in bursts of this length, like A2DP packets
+ *          (default 10)
+ *      -t  Target latency, more than a burst (default 20)
+ *      -q  0, 1 or 2 for low, medium or high quality (default 1)
+ *      -v  Log the correction and the latency every simulated minute
+ *      ppm Drifts of the source clock (default 150 -80 0 450)
+ *
+ * Build with the host project, see host/CMakeLists.txt.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "audio_element.h"
+#include "asrc.h"
+
+#include "esp_log.h"
+
+#define RATE 44100
+#define CHANNELS 2
+#define FRAME_BYTES (CHANNELS * 2)
+#define TICK_FRAMES (RATE / 100)    // Taken by the sink every 10 ms
+#define IN_RB_SIZE 32768
+
+static const char TAG[] = "BENCH";
+
+static size_t _gen_read(io_t *io, char *buf, size_t len, void *pv) {
+    return 0;
+}
+
+
+// Write 'frames' frames of the tone to 'io', from frame 'pos' on
+static void _produce(io_t *io, uint64_t pos, size_t frames) {
+    size_t len;
+    int16_t *data;
+
+    while (frames) {
+        len = frames * FRAME_BYTES;
+        data = (int16_t *)io_acquire_write(io, &len);
+        len -= len % FRAME_BYTES;
+        if (!data || !len) {
+            ESP_LOGW(TAG, "Input overrun, %d frames lost", frames);
+            return;
+        }
+        for (size_t i = 0; i < len / FRAME_BYTES; i++, pos++) {
+            data[i * 2] = data[i * 2 + 1] = lrint(16000.
+                    * sin(2. * M_PI * 1000. / RATE * (pos % RATE)));
+        }
+        io_commit_write(io, len, NULL);
+        frames -= len / FRAME_BYTES;
+    }
+}
+
+
+// Take 'frames' frames from 'io', returns false if there were not enough
+static bool _consume(io_t *io, size_t frames) {
+    size_t len;
+    char *data;
+
+    if (io_fill(io) < frames * FRAME_BYTES)
+        return false;
+    while (frames) {
+        len = frames * FRAME_BYTES;
+        data = io_acquire_read(io, &len, NULL);
+        if (!data || !len)
+            return false;
+        io_release_read(io, len);
+        frames -= len / FRAME_BYTES;
+    }
+    return true;
+}
+
+
+static int _simulate(float ppm, int minutes, int burst_ms, int target_ms,
+        polyphase_quality_t quality) {
+    audio_element_cfg_t cfg;
+    asrc_cfg_t asrc_cfg = DEFAULT_ASRC_CFG();
+    audio_element_t *source, *asrc;
+    int64_t ticks = minutes * 6000ll, settled = -1, reached = -1;
+    double produced = 0., latency, min = INFINITY, max = -INFINITY,
+           correction = 0.;
+    size_t frames;
+    unsigned underruns = 0;
+
+    audio_element_cfg_clear(&cfg);
+    cfg.read = _gen_read;
+    cfg.task_stack = 0;
+    cfg.out_rb_size = IN_RB_SIZE;
+    cfg.out_rb_backend = IO_BACKEND_SPSC;
+    cfg.tag = "source";
+    source = audio_element_init(&cfg);
+    if (!source)
+        return 1;
+
+    audio_element_cfg_clear(&cfg);
+    cfg.task_stack = 0;
+    cfg.out_rb_size = TICK_FRAMES * FRAME_BYTES * 2;
+    audio_element_cfg_link(source, &cfg);
+    asrc_cfg.target_ms = target_ms;
+    asrc_cfg.quality = quality;
+    asrc = asrc_init(cfg, asrc_cfg);
+    if (!asrc)
+        return 1;
+    source->output->nonblocking = true;
+    asrc->output->nonblocking = true;
+    audio_element_open(asrc, NULL);
+
+    for (int64_t t = 0; t < ticks; t++) {
+        // The source writes a burst at its own clock
+        if (t % (burst_ms / 10) == 0) {
+            double due = (t + burst_ms / 10) * TICK_FRAMES * (1. + ppm * 1e-6);
+            frames = due - produced;
+            _produce(source->output, produced, frames);
+            produced += frames;
+        }
+
+        // The sink takes a block, after the ASRC had the chance to fill it
+        while (io_fill(asrc->output) < TICK_FRAMES * FRAME_BYTES
+                && audio_element_run(asrc) > 0)
+            ;
+        if (!_consume(asrc->output, TICK_FRAMES) && settled >= 0)
+            underruns++;
+
+        latency = asrc_get_latency(asrc);
+        if (reached < 0 && fabs(latency - target_ms) < 0.25)
+            reached = t;
+        if (reached >= 0 && settled < 0
+                && t >= reached + asrc_cfg.settle_ms / 10)
+            settled = t;
+        if (settled >= 0) {
+            correction += asrc_get_ppm(asrc);
+            min = latency < min ? latency : min;
+            max = latency > max ? latency : max;
+        }
+        if (t % 6000 == 0)
+            ESP_LOGI(TAG, "%+7.1f ppm, %3lld s: correction %+7.2f ppm, "
+                    "latency %5.2f ms", ppm, t / 100, asrc_get_ppm(asrc),
+                    asrc_get_latency(asrc));
+    }
+
+    if (settled < 0)
+        printf("%+8.1f ppm %9s\n", ppm, "never");
+    else
+        printf("%+8.1f ppm %7.1f s %+12.2f ppm %6.2f - %5.2f ms %10u\n", ppm,
+                settled / 100., correction / (ticks - settled), min, max,
+                underruns);
+
+    audio_element_deinit(asrc);
+    audio_element_deinit(source);
+    return 0;
+}
+
+
+static void _usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-m minutes] [-j ms] [-t ms] [-q quality] "
+            "[-v] [ppm ...]\n", name);
+    exit(1);
+}
+
+
+int main(int argc, char *argv[]) {
+    static const float s_drifts[] = { 150.f, -80.f, 0.f, 450.f };
+    int minutes = 10, burst_ms = 10, target_ms = 20,
+        quality = POLYPHASE_MEDIUM, opt;
+
+    esp_log_level_set("*", ESP_LOG_WARN);
+    while ((opt = getopt(argc, argv, "m:j:t:q:v")) != -1) {
+        switch (opt) {
+            case 'm': minutes = atoi(optarg); break;
+            case 'j': burst_ms = atoi(optarg); break;
+            case 't': target_ms = atoi(optarg); break;
+            case 'q': quality = atoi(optarg); break;
+            case 'v': esp_log_level_set("*", ESP_LOG_INFO); break;
+            default: _usage(argv[0]);
+        }
+    }
+    if (minutes <= 0 || burst_ms < 10 || target_ms <= 0 || quality < POLYPHASE_LOW
+            || quality > POLYPHASE_HIGH)
+        _usage(argv[0]);
+
+    printf("%12s %9s %15s %16s %10s\n", "drift", "settled", "correction",
+            "latency", "underruns");
+    if (optind < argc) {
+        for (int i = optind; i < argc; i++) {
+            if (_simulate(atof(argv[i]), minutes, burst_ms, target_ms,
+                        quality))
+                return 1;
+        }
+    } else {
+        for (size_t i = 0; i < sizeof(s_drifts) / sizeof(s_drifts[0]); i++) {
+            if (_simulate(s_drifts[i], minutes, burst_ms, target_ms,
+                        quality))
+                return 1;
+        }
+    }
+    return 0;
+}
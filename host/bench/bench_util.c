@@ -0,0 +1,48 @@
+#include "bench_util.h"
+
+#include <math.h>
+#include <time.h>
+
+#ifdef BENCH_CYCLES
+#include <x86intrin.h>
+#endif
+
+
+uint64_t bench_now(void) {
+#ifdef BENCH_CYCLES
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+
+void bench_fft(double *re, double *im, size_t len) {
+    for (size_t i = 1, j = 0; i < len; i++) {
+        size_t bit = len >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j |= bit;
+        if (i < j) {
+            double t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    for (size_t n = 2; n <= len; n <<= 1) {
+        double a = -2. * M_PI / n;
+        for (size_t i = 0; i < len; i += n) {
+            for (size_t k = 0; k < n / 2; k++) {
+                double wr = cos(a * k), wi = sin(a * k);
+                double *ur = re + i + k, *ui = im + i + k;
+                double *vr = ur + n / 2, *vi = ui + n / 2;
+                double tr = *vr * wr - *vi * wi, ti = *vr * wi + *vi * wr;
+                *vr = *ur - tr;
+                *vi = *ui - ti;
+                *ur += tr;
+                *ui += ti;
+            }
+        }
+    }
+}
@@ -0,0 +1,33 @@
+/**
+ * Helpers shared by the host benchmarks: a time stamp for the cost of a
+ * conversion, and an FFT for the spectra of its output.
+ */
+
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Times are in cycles on x86, where the time stamp counter is cheap to
+// read, in ns elsewhere
+#if defined(__x86_64__) || defined(__i386__)
+#define BENCH_CYCLES
+#endif
+
+
+/**
+ * Current time, see BENCH_CYCLES for the unit
+ */
+uint64_t bench_now(void);
+
+/**
+ * In place radix 2 FFT
+ *
+ * @param re    Real parts, `len` of them
+ * @param im    Imaginary parts, `len` of them
+ * @param len   Number of points, a power of two
+ */
+void bench_fft(double *re, double *im, size_t len);
+
+#endif
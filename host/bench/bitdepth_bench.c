@@ -0,0 +1,345 @@
+/**
+ * Host benchmark: cost and noise of the bit depth converter.
+ *
+ * A source writes a second of a 44.1 kHz stereo tone into the converter's
+ * input ring, in blocks, and the converter is run until it passed all of
+ * it on. The rings wrap at powers of two, so packed 24 bit samples are split
+ * by the wrap now and then, like they are in a pipeline.
+ *
+ * For every conversion the time per sample (one channel of one frame) is
+ * reported, in cycles on x86, where the time stamp counter is cheap to
+ * read, in ns elsewhere.
+ *
+ * For 32 to 16 bits the requantization error of a quiet 1 kHz tone (-80
+ * dBFS, some 3 LSB at 16 bits) is then taken apart, over the spectrum of
+ * the output minus the input: its total power, its power below 4 kHz and
+ * above 16 kHz, and the largest harmonic of the tone in it. All in dBFS.
+ * Rounding alone leaves harmonics, dither turns them into noise, and
+ * noise shaping moves that noise up in frequency.
+ *
+ * Usage: bitdepth_bench
+ *
+ * Build with the host project, see host/CMakeLists.txt.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_element.h"
+#include "bench_util.h"
+#include "bitdepth.h"
+
+#include "esp_log.h"
+
+#define RATE 44100
+#define CHANNELS 2
+#define FRAMES RATE                 // A second
+#define BLOCK_FRAMES 1024           // Written to the input at a time
+#define RB_SIZE 16384
+#define FFT_LEN 16384               // Frames analysed, a power of two
+#define TONE_BIN 372                // 1001.3 Hz, on a bin of the FFT
+#define HARMONICS 9
+
+typedef struct {
+    int     bits;
+    bool    packed;
+} format_t;
+
+static const struct {
+    format_t in;
+    format_t out;
+} s_pairs[] = {
+    { { 32, false }, { 16, false } },
+    { { 24, false }, { 16, false } },
+    { { 24, true }, { 16, false } },
+    { { 16, false }, { 32, false } },
+    { { 16, false }, { 24, true } },
+    { { 32, false }, { 24, true } },
+    { { 32, false }, { 8, false } },
+};
+
+static const char *s_shaping_names[] = { "none", "first", "second" };
+
+
+static size_t _bytes(format_t fmt) {
+    return fmt.packed ? 3 : fmt.bits == 24 ? 4 : fmt.bits / 8;
+}
+
+static const char *_name(format_t fmt) {
+    switch (fmt.bits) {
+        case 8:     return "u8";
+        case 16:    return "s16";
+        case 24:    return fmt.packed ? "s24p" : "s24";
+        default:    return "s32";
+    }
+}
+
+// Store 'v' (full scale at +-1) in the format, rounded and clipped
+static void _pack(uint8_t *p, format_t fmt, double v) {
+    double scale = ldexp(1., fmt.bits - 1);
+    int64_t x = llrint(v * scale);
+    x = x < -scale ? -scale : x > scale - 1 ? scale - 1 : x;
+
+    switch (fmt.bits) {
+        case 8:     *p = x + 128; break;
+        case 16:    *(int16_t *)p = x; break;
+        case 24:
+            if (fmt.packed) {
+                p[0] = x;
+                p[1] = x >> 8;
+                p[2] = x >> 16;
+            } else {
+                *(int32_t *)p = x;
+            }
+            break;
+        default:    *(int32_t *)p = x; break;
+    }
+}
+
+static double _unpack(const uint8_t *p, format_t fmt) {
+    int32_t x;
+
+    switch (fmt.bits) {
+        case 8:     x = *p - 128; break;
+        case 16:    x = *(const int16_t *)p; break;
+        case 24:
+            x = fmt.packed ? (int32_t)((uint32_t)p[0] << 8
+                    | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8
+                : *(const int32_t *)p;
+            break;
+        default:    x = *(const int32_t *)p; break;
+    }
+    return ldexp(x, 1 - fmt.bits);
+}
+
+
+static size_t _gen_read(io_t *io, char *buf, size_t len, void *pv) {
+    return 0;
+}
+
+// Write 'len' bytes to 'io', which has room for them
+static void _write(io_t *io, const uint8_t *buf, size_t len) {
+    size_t part;
+    char *data;
+
+    while (len) {
+        part = len;
+        data = io_acquire_write(io, &part);
+        if (!data || !part)
+            return;
+        memcpy(data, buf, part);
+        io_commit_write(io, part, NULL);
+        buf += part;
+        len -= part;
+    }
+}
+
+// Read all of 'io' to 'buf', returns the number of bytes read
+static size_t _read(io_t *io, uint8_t *buf) {
+    size_t len, done = 0;
+    char *data;
+
+    while (io_fill(io)) {
+        len = io_fill(io);
+        data = io_acquire_read(io, &len, NULL);
+        if (!data || !len)
+            break;
+        memcpy(buf + done, data, len);
+        io_release_read(io, len);
+        done += len;
+    }
+    return done;
+}
+
+
+/**
+ * Convert 'in' (FRAMES frames) to 'out' through a converter, returns the
+ * time per sample, or a negative value if it failed.
+ */
+static double _convert(format_t in_fmt, const uint8_t *in, format_t out_fmt,
+        uint8_t *out, bitdepth_cfg_t bd_cfg) {
+    audio_element_cfg_t cfg;
+    audio_element_t *source, *bd;
+    audio_element_info_t info;
+    size_t in_frame = _bytes(in_fmt) * CHANNELS, written = 0, read = 0, len;
+    uint64_t elapsed = 0, start;
+
+    audio_element_cfg_clear(&cfg);
+    cfg.read = _gen_read;
+    cfg.task_stack = 0;
+    cfg.out_rb_size = RB_SIZE;
+    cfg.out_rb_backend = IO_BACKEND_SPSC;
+    cfg.tag = "source";
+    source = audio_element_init(&cfg);
+    if (!source)
+        return -1.;
+    info = audio_element_get_info(source->output);
+    info.sample_rate = RATE;
+    info.channels = CHANNELS;
+    info.bits = in_fmt.bits;
+    audio_element_set_info(source->output, info);
+
+    audio_element_cfg_clear(&cfg);
+    cfg.task_stack = 0;
+    cfg.buf_len = BITDEPTH_BUF_LEN * 4;
+    cfg.out_rb_size = RB_SIZE;
+    cfg.out_rb_backend = IO_BACKEND_SPSC;
+    audio_element_cfg_link(source, &cfg);
+    bd_cfg.bits = out_fmt.bits;
+    bd_cfg.packed = out_fmt.packed;
+    bd_cfg.in_packed = in_fmt.packed;
+    bd = bitdepth_init(cfg, bd_cfg);
+    if (!bd) {
+        audio_element_deinit(source);
+        return -1.;
+    }
+    source->output->nonblocking = true;
+    bd->output->nonblocking = true;
+    audio_element_open(bd, NULL);
+
+    while (written < FRAMES * in_frame) {
+        len = FRAMES * in_frame - written;
+        if (len > BLOCK_FRAMES * in_frame)
+            len = BLOCK_FRAMES * in_frame;
+        _write(source->output, in + written, len);
+        written += len;
+
+        start = bench_now();
+        while (io_fill(source->output) && audio_element_run(bd) > 0)
+            ;
+        elapsed += bench_now() - start;
+        read += _read(bd->output, out + read);
+    }
+
+    audio_element_deinit(bd);
+    audio_element_deinit(source);
+    if (read != FRAMES * CHANNELS * _bytes(out_fmt))
+        return -1.;
+    return (double)elapsed / (FRAMES * CHANNELS);
+}
+
+
+static double _db(double power) {
+    return 10. * log10(power + 1e-30);
+}
+
+/**
+ * Print the spectrum of the error of the left channel of 'out' (16 bits),
+ * against the tone in 'in' (32 bits). The last FFT_LEN frames are taken,
+ * with a Hann window.
+ */
+static void _analyse(const char *name, const uint8_t *in, const uint8_t *out) {
+    static double re[FFT_LEN], im[FFT_LEN];
+    format_t in_fmt = { 32, false }, out_fmt = { 16, false };
+    size_t first = FRAMES - FFT_LEN, low = 4000. * FFT_LEN / RATE,
+           high = 16000. * FFT_LEN / RATE;
+    double norm = 0., w, p, total = 0., below = 0., above = 0.,
+           harmonic = 0.;
+    size_t k;
+
+    for (size_t i = 0; i < FFT_LEN; i++) {
+        w = 0.5 - 0.5 * cos(2. * M_PI * i / FFT_LEN);
+        norm += w * w;
+        re[i] = w * (_unpack(out + (first + i) * CHANNELS * 2, out_fmt)
+                - _unpack(in + (first + i) * CHANNELS * 4, in_fmt));
+        im[i] = 0.;
+    }
+    bench_fft(re, im, FFT_LEN);
+
+    // One sided, a full scale sine is at 0 dBFS
+    for (k = 1; k < FFT_LEN / 2; k++) {
+        re[k] = 4. * (re[k] * re[k] + im[k] * im[k]) / (norm * FFT_LEN);
+        total += re[k];
+        below += k < low ? re[k] : 0.;
+        above += k > high ? re[k] : 0.;
+    }
+    // The window spreads a harmonic over three bins
+    for (size_t h = 2; h <= HARMONICS; h++) {
+        k = h * TONE_BIN;
+        p = re[k - 1] + re[k] + re[k + 1];
+        harmonic = p > harmonic ? p : harmonic;
+    }
+    printf("%-20s %10.1f %10.1f %10.1f %10.1f\n", name, _db(total),
+            _db(below), _db(above), _db(harmonic));
+}
+
+
+int main(int argc, char *argv[]) {
+    static const double s_levels[] = { 0.5, 0.0001 };   // -6, -80 dBFS
+    uint8_t *in = malloc(FRAMES * CHANNELS * 4);
+    uint8_t *out = malloc(FRAMES * CHANNELS * 4);
+    bitdepth_cfg_t bd_cfg = DEFAULT_BITDEPTH_CFG();
+    format_t in_fmt, out_fmt;
+    char name[32];
+    double t;
+
+    if (!in || !out)
+        return 1;
+    esp_log_level_set("*", ESP_LOG_WARN);
+
+    printf("%-20s %10s %10s %10s\n", "conversion", "shaping",
+#ifdef BENCH_CYCLES
+            "cycles", "cycles"
+#else
+            "ns", "ns"
+#endif
+            );
+    printf("%-20s %10s %10s %10s\n", "", "", "plain", "dithered");
+    for (size_t i = 0; i < sizeof(s_pairs) / sizeof(s_pairs[0]); i++) {
+        in_fmt = s_pairs[i].in;
+        out_fmt = s_pairs[i].out;
+        for (size_t f = 0; f < FRAMES * CHANNELS; f++) {
+            _pack(in + f * _bytes(in_fmt), in_fmt, s_levels[0]
+                    * sin(2. * M_PI * TONE_BIN / FFT_LEN * (f / CHANNELS)));
+        }
+        snprintf(name, sizeof(name), "%s to %s", _name(in_fmt),
+                _name(out_fmt));
+        for (int s = BITDEPTH_SHAPE_NONE; s <= BITDEPTH_SHAPE_SECOND; s++) {
+            // Shaping only matters when the depth goes down
+            if (s != BITDEPTH_SHAPE_NONE && in_fmt.bits <= out_fmt.bits)
+                break;
+            bd_cfg.shaping = s;
+            bd_cfg.dither = false;
+            t = _convert(in_fmt, in, out_fmt, out, bd_cfg);
+            bd_cfg.dither = true;
+            double td = _convert(in_fmt, in, out_fmt, out, bd_cfg);
+            if (t < 0. || td < 0.) {
+                fprintf(stderr, "%s failed\n", name);
+                return 1;
+            }
+            printf("%-20s %10s %10.2f %10.2f\n", s ? "" : name,
+                    s_shaping_names[s], t, td);
+        }
+    }
+
+    printf("\n%-20s %10s %10s %10s %10s\n", "s32 to s16, -80 dBFS",
+            "total", "< 4 kHz", "> 16 kHz", "harmonic");
+    in_fmt = (format_t){ 32, false };
+    out_fmt = (format_t){ 16, false };
+    for (size_t f = 0; f < FRAMES * CHANNELS; f++) {
+        _pack(in + f * 4, in_fmt, s_levels[1]
+                * sin(2. * M_PI * TONE_BIN / FFT_LEN * (f / CHANNELS)));
+    }
+    for (int s = BITDEPTH_SHAPE_NONE; s <= BITDEPTH_SHAPE_SECOND; s++) {
+        for (int d = 0; d < 2; d++) {
+            // Shaping without dither is not worth a row
+            if (s != BITDEPTH_SHAPE_NONE && !d)
+                continue;
+            bd_cfg.shaping = s;
+            bd_cfg.dither = d;
+            if (_convert(in_fmt, in, out_fmt, out, bd_cfg) < 0.)
+                return 1;
+            snprintf(name, sizeof(name), "%s%s", d ? "tpdf" : "undithered",
+                    s ? s == BITDEPTH_SHAPE_FIRST ? ", first" : ", second"
+                    : "");
+            _analyse(name, in, out);
+        }
+    }
+
+    free(in);
+    free(out);
+    return 0;
+}
@@ -0,0 +1,272 @@
+/**
+ * Host benchmark: cost and aliasing of the decimator, next to the polyphase
+ * resampler doing the same.
+ *
+ * For a few down ratios and every quality, the multiplies per output sample
+ * (one channel of one frame) of the filters are reported. Then a second of
+ * stereo noise is converted in blocks, and the time per output sample is,
+ * in cycles on x86, where the time stamp counter is cheap to read, in ns
+ * elsewhere.
+ *
+ * The aliasing is measured with tones at the scale of 24 bit samples, over
+ * the spectrum of the output's passband:
+ *  - Tones in the passband must come out alone. Anything else in the
+ *    passband is distortion, or noise.
+ *  - Tones that fold back into it, from around multiples of the output
+ *    rate, must not come out there at all.
+ * The worst of these, relative to the tone, is reported. What folds back
+ * above the passband is not, the decimator leaves that to the sink.
+ *
+ * Usage: decimate_bench
+ *
+ * Build with the host project, see host/CMakeLists.txt.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench_util.h"
+#include "decimate.h"
+#include "fir.h"
+#include "polyphase.h"
+
+#include "esp_log.h"
+
+#define AMPLITUDE (1 << 22)     // Half of full scale, at 24 bits
+#define FFT_LEN 8192            // Output frames analysed
+#define KAISER_BETA 14.         // Of the analysis window
+#define TONE_BINS 8             // Around a tone, its main lobe
+
+static const struct {
+    int in_rate;
+    int out_rate;
+} s_ratios[] = {
+    { 48000, 16000 },
+    { 48000, 24000 },
+    { 44100, 22050 },
+    { 96000, 16000 },
+    { 48000, 8000 },
+    { 44100, 16000 },
+};
+
+static const char *s_quality_names[] = { "low", "medium", "high" };
+
+// End of the passband, of the output's Nyquist frequency, see decimate.h
+static const double s_passband[] = { 0.6, 0.7, 0.8 };
+
+
+/**
+ * Convert all of 'in', in blocks like an element would, with the decimator
+ * if 'dc' is set, with 'pp' if not. Returns the number of output frames,
+ * 'elapsed' is set to the time spent converting.
+ */
+static size_t _convert(decimate_t *dc, polyphase_t *pp, const int32_t *in,
+        size_t in_frames, int channels, int32_t *out, size_t out_frames,
+        uint64_t *elapsed) {
+    size_t taken = 0, done = 0, used, block;
+    uint64_t start = bench_now();
+
+    while (taken < in_frames) {
+        block = in_frames - taken;
+        if (dc) {
+            if (block > decimate_max_input(dc, out_frames - done))
+                block = decimate_max_input(dc, out_frames - done);
+            if (!block)
+                break;
+            done += decimate_process(dc, in + taken * channels, block,
+                    out + done * channels);
+            taken += block;
+        } else {
+            if (block > POLYPHASE_BLOCK)
+                block = POLYPHASE_BLOCK;
+            done += polyphase_process(pp, in + taken * channels, block,
+                    &used, out + done * channels, out_frames - done);
+            taken += used;
+            if (!used)
+                break;
+        }
+    }
+    *elapsed = bench_now() - start;
+    return done;
+}
+
+/**
+ * Power in the passband of 'y' (FFT_LEN frames at 'rate'), up to 'pass' Hz,
+ * but away from a tone at 'f' Hz, relative to the power of 'amplitude', in
+ * dB. A Kaiser window keeps the leakage of the tone some 130 dB down.
+ */
+static double _passband_db(const int32_t *y, int rate, double pass,
+        double f, double amplitude) {
+    static double re[FFT_LEN], im[FFT_LEN];
+    double norm = 0., w, r, e = 0., tone = f * FFT_LEN / rate;
+
+    for (size_t i = 0; i < FFT_LEN; i++) {
+        r = 2. * i / (FFT_LEN - 1) - 1.;
+        w = fir_bessel_i0(KAISER_BETA * sqrt(1. - r * r))
+            / fir_bessel_i0(KAISER_BETA);
+        norm += w * w;
+        re[i] = w * y[i];
+        im[i] = 0.;
+    }
+    bench_fft(re, im, FFT_LEN);
+
+    for (size_t k = 1; k <= pass * FFT_LEN / rate; k++) {
+        if (fabs(k - tone) > TONE_BINS)
+            e += re[k] * re[k] + im[k] * im[k];
+    }
+    // A sine of 'amplitude' has a power of amplitude^2 / 4 on either side
+    return 10. * log10(e / (norm * FFT_LEN * amplitude * amplitude / 4.)
+            + 1e-30);
+}
+
+static esp_err_t _init(bool decimator, decimate_t *dc, polyphase_t *pp,
+        int in_rate, int out_rate, int channels,
+        polyphase_quality_t quality) {
+    return decimator ? decimate_init(dc, in_rate, out_rate, channels, quality)
+        : polyphase_init(pp, in_rate, out_rate, channels, quality);
+}
+
+// Worst distortion or alias in the passband, in dB relative to the tone
+static double _rejection(bool decimator, int in_rate, int out_rate,
+        polyphase_quality_t quality) {
+    double pass = s_passband[quality] * out_rate / 2., worst = -INFINITY,
+           db, f;
+    size_t skip = 200, out_frames = FFT_LEN + 2 * skip,
+           in_frames = out_frames * (size_t)in_rate / out_rate, frames;
+    int32_t *in = malloc(in_frames * sizeof(int32_t));
+    int32_t *out = malloc(out_frames * sizeof(int32_t));
+    decimate_t dc = {0};
+    polyphase_t pp = {0};
+    uint64_t elapsed;
+
+    if (!in || !out) {
+        free(in);
+        free(out);
+        return NAN;
+    }
+
+    // Passband tones, then tones folding back into the passband, around
+    // every multiple of the output rate
+    for (int k = 1; ; k++) {
+        f = k * 0.05 * pass;
+        if (k > 20)
+            f = ((k - 21) / 9 + 1) * out_rate + ((k - 21) % 9 - 4) * 0.25
+                * pass;
+        if (f >= in_rate / 2. * 0.98)
+            break;
+
+        for (size_t i = 0; i < in_frames; i++) {
+            in[i] = lrint(AMPLITUDE * sin(2. * M_PI * f / in_rate * i));
+        }
+        if (_init(decimator, &dc, &pp, in_rate, out_rate, 1, quality)
+                != ESP_OK)
+            break;
+        // Past the start of the tone
+        frames = _convert(decimator ? &dc : NULL, &pp, in, in_frames, 1,
+                out, out_frames, &elapsed);
+        if (frames < FFT_LEN + skip)
+            break;
+
+        db = _passband_db(out + skip, out_rate, pass, k > 20 ? -1e9 : f,
+                AMPLITUDE);
+        worst = db > worst ? db : worst;
+    }
+
+    decimate_deinit(&dc);
+    polyphase_deinit(&pp);
+    free(in);
+    free(out);
+    return -worst;
+}
+
+// Multiplies per output sample, of the filters as designed
+static double _multiplies(bool decimator, int in_rate, int out_rate,
+        polyphase_quality_t quality) {
+    decimate_t dc = {0};
+    polyphase_t pp = {0};
+    double mults = 0., rate = in_rate;
+
+    if (_init(decimator, &dc, &pp, in_rate, out_rate, 1, quality) != ESP_OK)
+        return NAN;
+    // Every stage runs at its output rate
+    for (int i = 0; i < dc.count; i++) {
+        rate /= dc.stages[i].factor;
+        mults += dc.stages[i].half * rate / out_rate;
+    }
+    if (!decimator)
+        mults = pp.taps;
+    else if (dc.pp.coefs)
+        mults += dc.pp.taps;
+    decimate_deinit(&dc);
+    polyphase_deinit(&pp);
+    return mults;
+}
+
+static double _cost(bool decimator, int in_rate, int out_rate,
+        polyphase_quality_t quality) {
+    size_t in_frames = in_rate, out_frames = out_rate, frames = 0;
+    int32_t *in = malloc(in_frames * 2 * sizeof(int32_t));
+    int32_t *out = malloc(out_frames * 2 * sizeof(int32_t));
+    decimate_t dc = {0};
+    polyphase_t pp = {0};
+    uint64_t elapsed, best = UINT64_MAX;
+
+    if (!in || !out) {
+        free(in);
+        free(out);
+        return NAN;
+    }
+
+    srand(1);
+    for (size_t i = 0; i < in_frames * 2; i++) {
+        in[i] = rand() % 65536 - 32768;
+    }
+    // The first round warms up the caches and the clock, the best of the
+    // others is taken
+    for (int i = 0; i < 4; i++) {
+        if (_init(decimator, &dc, &pp, in_rate, out_rate, 2, quality)
+                != ESP_OK)
+            break;
+        frames = _convert(decimator ? &dc : NULL, &pp, in, in_frames, 2,
+                out, out_frames, &elapsed);
+        best = i && elapsed < best ? elapsed : best;
+    }
+
+    decimate_deinit(&dc);
+    polyphase_deinit(&pp);
+    free(in);
+    free(out);
+    return frames ? (double)best / (frames * 2) : NAN;
+}
+
+
+int main(int argc, char *argv[]) {
+    esp_log_level_set("*", ESP_LOG_WARN);
+
+    printf("%-23s %21s %21s %21s\n", "", "multiplies/sample",
+#ifdef BENCH_CYCLES
+            "cycles/sample",
+#else
+            "ns/sample",
+#endif
+            "passband rejection");
+    printf("%-15s %-7s %10s %10s %10s %10s %10s %10s\n", "ratio", "quality",
+            "decimator", "polyphase", "decimator", "polyphase", "decimator",
+            "polyphase");
+    for (size_t r = 0; r < sizeof(s_ratios) / sizeof(s_ratios[0]); r++) {
+        for (int q = POLYPHASE_LOW; q <= POLYPHASE_HIGH; q++) {
+            int in_rate = s_ratios[r].in_rate, out_rate = s_ratios[r].out_rate;
+            printf("%5d > %5d Hz %-7s %10.1f %10.1f %10.1f %10.1f %7.1f dB "
+                    "%7.1f dB\n", in_rate, out_rate, s_quality_names[q],
+                    _multiplies(true, in_rate, out_rate, q),
+                    _multiplies(false, in_rate, out_rate, q),
+                    _cost(true, in_rate, out_rate, q),
+                    _cost(false, in_rate, out_rate, q),
+                    _rejection(true, in_rate, out_rate, q),
+                    _rejection(false, in_rate, out_rate, q));
+        }
+    }
+    return 0;
+}
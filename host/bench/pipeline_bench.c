@@ -0,0 +1,370 @@
+/**
+ * Host benchmark: throughput of a source > mixer > i2s chain.
+ *
+ * The source is a generator (a read callback writing a 16 bit stereo saw)
+ * or, with -f, an sdcard_stream reading a raw PCM file. The i2s stand-in
+ * never waits for a sample clock, so the chain runs as fast as the host
+ * allows. Set SHOCK_I2S_OUT to a path to keep the output.
+ *
+ * With -o the sink is an sdcard_stream writer instead, and mixer and writer
+ * are rendered offline by pipeline_run in the main task.
+ *
+ * Usage: pipeline_bench [-f file] [-o wav] [-g dB] [-l] [-s Hz] [-R Hz]
+ *                       [-c ch] [-m] [-p ms] [-a n] [-d dB] [-w] [-n MiB]
+ *                       [-b bytes] [-r] [-t]
+ *      -f  Read from a file instead of the generator
+ *      -o  Render to a WAV file instead of i2s (-t is ignored)
+ *      -g  Ramp the gain of the input to this, in 100 ms
+ *      -l  Enable the look-ahead limiter on the mix bus
+ *      -s  Mixer output rate, the 44.1 kHz input is resampled to it
+ *      -R  Resample the input to this in a resampler element first, in a
+ *          task of its own. The mixer outputs at this rate too.
+ *      -c  Mixer output channels (default 2)
+ *      -m  The input is mono
+ *      -p  Mix in periods of this length, silence when the input is late
+ *      -a  Add and remove a chime input this many times while running
+ *      -d  Duck the input by this much while a chime plays
+ *      -w  Mix at 24 bits, and dither down to 16 bits (with second order
+ *          noise shaping) in a bitdepth element before the sink
+ *      -n  Stop after this many MiB reached the sink (default 256)
+ *      -b  buf_len and ring size of every element (default 2048)
+ *      -r  Use IO_BACKEND_RINGBUF instead of IO_BACKEND_SPSC
+ *      -t  One task per element, instead of mixer and i2s in a pipeline
+ *
+ * Build with the host project, see host/CMakeLists.txt.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "audio_element.h"
+#include "sdcard_stream.h"
+#include "i2s_stream.h"
+#include "mixer.h"
+#include "resampler.h"
+#include "bitdepth.h"
+#include "tone_stream.h"
+#include "pipeline.h"
+
+#include "driver/i2s.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char TAG[] = "BENCH";
+
+static uint64_t s_gen_left;
+
+
+static esp_err_t _gen_open(audio_element_t *el, void *pv) {
+    el->is_open = true;
+    return ESP_OK;
+}
+
+static esp_err_t _gen_close(audio_element_t *el) {
+    el->is_open = false;
+    return ESP_OK;
+}
+
+static size_t _gen_read(io_t *io, char *buf, size_t len, void *pv) {
+    static int16_t phase = 0;
+    int16_t *out = (int16_t*)buf;
+    size_t frames = len / 4;
+
+    if (frames * 4 > s_gen_left)
+        frames = s_gen_left / 4;
+    s_gen_left -= frames * 4;
+    if (!frames) {
+        _gen_close(pv);
+        return 0;
+    }
+
+    for (size_t i = 0; i < frames; i++) {
+        out[2*i] = phase;
+        out[2*i + 1] = -phase;
+        phase += 64;
+    }
+    return frames * 4;
+}
+
+// A short-lived input with a task of its own, a quiet tone
+static audio_element_t *_chime_start(int buf_len, io_backend_t backend) {
+    audio_element_cfg_t cfg;
+    tone_stream_cfg_t tone_cfg = DEFAULT_TONE_STREAM_CFG();
+
+    audio_element_cfg_clear(&cfg);
+    cfg.buf_len = buf_len;
+    cfg.out_rb_size = buf_len * 4;
+    cfg.out_rb_backend = backend;
+    cfg.task_stack = 2048;
+    tone_cfg.channels = 2;
+    tone_cfg.level_db = -30.f;
+    audio_element_t *chime = tone_stream_init(cfg, tone_cfg);
+    if (chime) {
+        tone_stream_play(chime, 880.f, 1000);
+        audio_element_open(chime, NULL);
+    }
+    return chime;
+}
+
+// The task deinits the element, and with it the output nobody reads now
+static void _chime_stop(audio_element_t *chime) {
+    chime->task_running = false;
+    audio_element_notify(chime, AEL_BIT_STATUS_CHANGED);
+}
+
+static void _usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-f file] [-o wav] [-g dB] [-l] "
+            "[-s Hz] [-R Hz] [-c ch] [-m] [-p ms] [-a n] [-d dB] [-w] [-n MiB] "
+            "[-b bytes] [-r] [-t]\n", name);
+    exit(1);
+}
+
+static void _dump(audio_element_t *elements[], size_t count) {
+    esp_log_level_set("*", ESP_LOG_INFO);
+    for (size_t i = 0; i < count; i++) {
+        if (elements[i])
+            audio_element_dump_stats(elements[i]);
+    }
+}
+
+static void _report(const char *mode, io_backend_t backend, int buf_len,
+        uint64_t bytes, int64_t elapsed) {
+    ESP_LOGI(TAG, "%s, %s, buf_len %d: %llu bytes in %lld us, %.1f MB/s",
+            backend == IO_BACKEND_SPSC ? "spsc" : "ringbuf", mode, buf_len,
+            (unsigned long long)bytes, (long long)elapsed,
+            (double)bytes / elapsed);
+}
+
+int main(int argc, char *argv[]) {
+    audio_element_cfg_t cfg;
+    audio_element_t *source;
+    io_backend_t backend = IO_BACKEND_SPSC;
+    const char *file = NULL;
+    const char *wav = NULL;
+    uint64_t target = 256ull << 20;
+    int buf_len = 2048;
+    int rate = MIXER_DEFAULT_RATE;
+    int resample = 0;
+    int channels = MIXER_DEFAULT_CHANNELS;
+    bool mono = false;
+    int period = MIXER_PERIOD_FREE;
+    int chimes = 0;
+    float gain = 0.f;
+    float duck = 0.f;
+    bool tasks = false;
+    bool limit = false;
+    bool wide = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:o:g:ls:R:c:mp:a:d:wn:b:rt")) != -1) {
+        switch (opt) {
+            case 'f': file = optarg; break;
+            case 'o': wav = optarg; tasks = false; break;
+            case 'g': gain = strtof(optarg, NULL); break;
+            case 'l': limit = true; break;
+            case 's': rate = atoi(optarg); break;
+            case 'R': rate = resample = atoi(optarg); break;
+            case 'c': channels = atoi(optarg); break;
+            case 'm': mono = true; break;
+            case 'p': period = atoi(optarg); break;
+            case 'a': chimes = atoi(optarg); break;
+            case 'd': duck = strtof(optarg, NULL); break;
+            case 'w': wide = true; break;
+            case 'n': target = strtoull(optarg, NULL, 0) << 20; break;
+            case 'b': buf_len = atoi(optarg); break;
+            case 'r': backend = IO_BACKEND_RINGBUF; break;
+            case 't': tasks = !wav; break;
+            default: _usage(argv[0]);
+        }
+    }
+    esp_log_level_set("*", ESP_LOG_WARN);
+
+    // Source, always in its own task
+    audio_element_cfg_clear(&cfg);
+    cfg.buf_len = buf_len;
+    cfg.out_rb_size = buf_len * 4;
+    cfg.out_rb_backend = backend;
+    if (file) {
+        source = sdcard_stream_init(cfg, AEL_STREAM_READER);
+    } else {
+        cfg.open = _gen_open;
+        cfg.close = _gen_close;
+        cfg.read = _gen_read;
+        cfg.tag = "gen";
+        source = audio_element_init(&cfg);
+        s_gen_left = target;
+    }
+    if (!source)
+        return 1;
+    if (mono) {
+        audio_element_info_t info = audio_element_get_info(source->output);
+        info.channels = 1;
+        audio_element_set_info(source->output, info);
+    }
+
+    audio_element_t *resampler = NULL;
+    if (resample) {
+        audio_element_cfg_clear(&cfg);
+        cfg.buf_len = buf_len;
+        cfg.out_rb_size = buf_len * 4;
+        cfg.out_rb_backend = backend;
+        audio_element_cfg_link(source, &cfg);
+        resampler = resampler_init(cfg, resample, POLYPHASE_HIGH);
+        if (!resampler)
+            return 1;
+    }
+
+    io_t *inputs[] = { resampler ? resampler->output : source->output };
+    audio_element_cfg_clear(&cfg);
+    cfg.buf_len = buf_len;
+    cfg.task_stack = tasks ? 2048 : 0;
+    cfg.out_rb_size = buf_len * 4;
+    cfg.out_rb_backend = backend;
+    audio_element_t *mixer = mixer_init(cfg, inputs, 1);
+
+    // With -w, the mixer output is dithered down to 16 bits on its way out
+    audio_element_t *bitdepth = NULL;
+    if (wide && mixer) {
+        bitdepth_cfg_t bd_cfg = DEFAULT_BITDEPTH_CFG();
+        bd_cfg.shaping = BITDEPTH_SHAPE_SECOND;
+        audio_element_cfg_clear(&cfg);
+        cfg.buf_len = buf_len;
+        cfg.task_stack = tasks ? 2048 : 0;
+        cfg.out_rb_size = buf_len * 4;
+        cfg.out_rb_backend = backend;
+        audio_element_cfg_link(mixer, &cfg);
+        bitdepth = bitdepth_init(cfg, bd_cfg);
+        if (!bitdepth)
+            return 1;
+        mixer_set_bits(mixer, 24);
+    }
+
+    audio_element_cfg_clear(&cfg);
+    cfg.buf_len = buf_len;
+    cfg.task_stack = tasks ? 2048 : 0;
+    audio_element_cfg_link(bitdepth ? bitdepth : mixer, &cfg);
+    audio_element_t *sink = wav ? sdcard_stream_init(cfg, AEL_STREAM_WRITER)
+        : i2s_stream_init(cfg, AEL_STREAM_WRITER);
+
+    if (!mixer || !sink)
+        return 1;
+    mixer_set_gain(mixer, 0, gain, 100);
+    mixer_set_rate(mixer, rate);
+    mixer_set_channels(mixer, channels);
+    mixer_set_period(mixer, period);
+    if (limit) {
+        limiter_cfg_t lim_cfg = DEFAULT_LIMITER_CFG();
+        mixer_set_limiter(mixer, lim_cfg);
+    }
+    if (duck < 0.f) {
+        mixer_duck_cfg_t duck_cfg = DEFAULT_MIXER_DUCK_CFG();
+        duck_cfg.depth_db = duck;
+        mixer_set_ducking(mixer, duck_cfg);
+    }
+
+    // The sink goes last in the chains, which hold the bitdepth element
+    // only with -w
+    audio_element_t *all[] = { source, mixer, sink, resampler, bitdepth };
+    audio_element_t *chain[] = { mixer, bitdepth ? bitdepth : sink, sink };
+    int chain_len = bitdepth ? 3 : 2;
+    if (wav) {
+        // Offline render, the elements are gone afterwards
+        audio_element_open(mixer, NULL);
+        if (resampler)
+            audio_element_open(resampler, NULL);
+        if (bitdepth)
+            audio_element_open(bitdepth, NULL);
+        if (audio_element_open(sink, (void*)wav) != ESP_OK
+                || audio_element_open(source, (void*)file) != ESP_OK)
+            return 1;
+
+        int64_t start = esp_timer_get_time();
+        pipeline_run(chain, chain_len, 100);
+        int64_t elapsed = esp_timer_get_time() - start - 100000;
+
+        struct stat st;
+        if (stat(wav, &st) != 0)
+            return 1;
+        uint64_t bytes = st.st_size - 44;  // Without the header
+        esp_log_level_set("*", ESP_LOG_INFO);
+        _report("offline", backend, buf_len, bytes, elapsed);
+        return 0;
+    }
+
+    if (!tasks) {
+        pipeline_cfg_t pl_cfg = DEFAULT_PIPELINE_CFG();
+        pipeline_init(&pl_cfg, chain, chain_len);
+    }
+
+    audio_element_open(sink, NULL);
+    audio_element_open(mixer, NULL);
+    if (resampler)
+        audio_element_open(resampler, NULL);
+    if (bitdepth)
+        audio_element_open(bitdepth, NULL);
+
+    int64_t start = esp_timer_get_time();
+    if (audio_element_open(source, (void*)file) != ESP_OK)
+        return 1;
+
+    // Poll until done, or until nothing moved for a second (end of file)
+    uint64_t bytes = 0, last = 0;
+    int64_t end = start;
+    int idle = 0;
+    audio_element_t *chime = NULL;
+    int64_t add_us = 0, remove_us = 0, t;
+    int added = 0, index;
+    while (bytes < target && idle < 100) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+
+        // Alternately add a chime, and fade it out and remove it
+        if (chime) {
+            t = esp_timer_get_time();
+            if (mixer_remove_input(mixer, chime->output, 5) == ESP_OK)
+                remove_us += esp_timer_get_time() - t;
+            _chime_stop(chime);
+            chime = NULL;
+        } else if (added < chimes) {
+            chime = _chime_start(buf_len, backend);
+            t = esp_timer_get_time();
+            if (chime && mixer_add_input(mixer, chime->output, &index)
+                    == ESP_OK) {
+                add_us += esp_timer_get_time() - t;
+                mixer_set_priority(mixer, index, 1);
+                added++;
+            }
+        }
+
+        bytes = i2s_host_bytes_written(0);
+        if (bytes != last) {
+            end = esp_timer_get_time();
+            idle = 0;
+        } else {
+            idle++;
+        }
+        last = bytes;
+    }
+    int64_t elapsed = end - start;
+
+    _dump(all, sizeof(all) / sizeof(all[0]));
+    ESP_LOGI(TAG, "Input underruns: %u", mixer_get_underruns(mixer, 0));
+    if (added)
+        ESP_LOGI(TAG, "%d chimes, add %lld us, remove %lld us on average",
+                added, (long long)(add_us / added),
+                (long long)(remove_us / added));
+    if (limit)
+        ESP_LOGI(TAG, "Gain reduction: %.1f dB",
+                mixer_get_gain_reduction(mixer));
+    _report(tasks ? "task per element" : "pipeline", backend, buf_len,
+            bytes, elapsed);
+
+    // The element tasks are still running, do not tear down under them.
+    // Only flush what i2s wrote to SHOCK_I2S_OUT.
+    fflush(NULL);
+    _exit(0);
+}
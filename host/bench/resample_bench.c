@@ -0,0 +1,204 @@
+/**
+ * Host benchmark: cost and stopband rejection of the polyphase resampler.
+ *
+ * For a few common ratios and every quality, a second of stereo noise is
+ * converted in blocks of POLYPHASE_BLOCK frames, and the time per output
+ * sample (one channel of one frame) is reported. In cycles on x86, where
+ * the time stamp counter is cheap to read, in ns elsewhere.
+ *
+ * The rejection is measured with tones at the scale of 24 bit samples:
+ *  - Tones in the passband must come out alone. What is left after fitting
+ *    a sine at the tone's frequency to the output are images and aliases.
+ *  - Tones above the output's Nyquist frequency (when downsampling) must
+ *    not come out at all.
+ * The worst of these, relative to the tone, is reported.
+ *
+ * Usage: resample_bench
+ *
+ * Build with the host project, see host/CMakeLists.txt.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench_util.h"
+#include "polyphase.h"
+
+#include "esp_log.h"
+
+#define AMPLITUDE (1 << 22)     // Half of full scale, at 24 bits
+
+static const struct {
+    int in_rate;
+    int out_rate;
+} s_ratios[] = {
+    { 44100, 48000 },
+    { 48000, 44100 },
+    { 32000, 48000 },
+    { 16000, 44100 },
+    { 48000, 16000 },
+};
+
+static const char *s_quality_names[] = { "low", "medium", "high" };
+
+// Highest passband tone tested, of the lower Nyquist frequency
+static const double s_passband[] = { 0.6, 0.7, 0.8 };
+
+
+/**
+ * Convert all of 'in', in blocks like an element would. Returns the number
+ * of output frames, 'elapsed' is set to the time spent converting.
+ */
+static size_t _convert(polyphase_t *pp, const int32_t *in, size_t in_frames,
+        int32_t *out, size_t out_frames, uint64_t *elapsed) {
+    size_t taken = 0, done = 0, used, block;
+    uint64_t start = bench_now();
+
+    while (done < out_frames) {
+        block = in_frames - taken;
+        if (block > POLYPHASE_BLOCK)
+            block = POLYPHASE_BLOCK;
+        done += polyphase_process(pp, in + taken * pp->channels, block,
+                &used, out + done * pp->channels, out_frames - done);
+        taken += used;
+        if (!used && taken == in_frames)
+            break;
+    }
+    *elapsed = bench_now() - start;
+    return done;
+}
+
+/**
+ * Power of what is left of 'y' after taking out the best fitting sine at
+ * 'f' (cycles per frame), relative to the power of 'amplitude', in dB
+ */
+static double _residual_db(const int32_t *y, size_t n, double f,
+        double amplitude) {
+    double cc = 0., ss = 0., cs = 0., yc = 0., ys = 0., det, a, b, e = 0.;
+
+    // Least squares: y ~ a cos + b sin
+    for (size_t i = 0; i < n; i++) {
+        double c = cos(2. * M_PI * f * i), s = sin(2. * M_PI * f * i);
+        cc += c * c;
+        ss += s * s;
+        cs += c * s;
+        yc += y[i] * c;
+        ys += y[i] * s;
+    }
+    det = cc * ss - cs * cs;
+    a = det != 0. ? (yc * ss - ys * cs) / det : 0.;
+    b = det != 0. ? (ys * cc - yc * cs) / det : 0.;
+
+    for (size_t i = 0; i < n; i++) {
+        double r = y[i] - a * cos(2. * M_PI * f * i)
+            - b * sin(2. * M_PI * f * i);
+        e += r * r;
+    }
+    return 10. * log10(e / n / (amplitude * amplitude / 2.) + 1e-30);
+}
+
+// Worst image or alias of a set of tones, in dB relative to the tone
+static double _rejection(int in_rate, int out_rate,
+        polyphase_quality_t quality) {
+    int low = in_rate < out_rate ? in_rate : out_rate;
+    size_t in_frames = in_rate, out_frames = out_rate, frames, skip;
+    int32_t *in = malloc(in_frames * sizeof(int32_t));
+    int32_t *out = malloc(out_frames * sizeof(int32_t));
+    double worst = -INFINITY, db, f;
+    polyphase_t pp = {0};
+    uint64_t elapsed;
+
+    if (!in || !out || polyphase_init(&pp, in_rate, out_rate, 1, quality)
+            != ESP_OK) {
+        free(in);
+        free(out);
+        return NAN;
+    }
+
+    // Passband tones first, then those above the lower Nyquist frequency,
+    // if the input has any
+    for (int k = 1; ; k++) {
+        f = k * 0.05 * low / 2.;
+        if (f > s_passband[quality] * low / 2.)
+            f += (1.02 - s_passband[quality]) * low / 2.;
+        if (f >= in_rate / 2. * 0.98)
+            break;
+
+        for (size_t i = 0; i < in_frames; i++) {
+            in[i] = lrint(AMPLITUDE * sin(2. * M_PI * f / in_rate * i));
+        }
+        polyphase_init(&pp, in_rate, out_rate, 1, quality);
+        frames = _convert(&pp, in, in_frames, out, out_frames, &elapsed);
+        // Past the start of the tone
+        skip = pp.taps * (size_t)out_rate / in_rate + 1;
+        if (frames <= 2 * skip)
+            break;
+
+        if (f < low / 2.)
+            db = _residual_db(out + skip, frames - 2 * skip,
+                    f / out_rate, AMPLITUDE);
+        else
+            db = _residual_db(out + skip, frames - 2 * skip, 0.,
+                    AMPLITUDE);
+        worst = db > worst ? db : worst;
+    }
+
+    polyphase_deinit(&pp);
+    free(in);
+    free(out);
+    return -worst;
+}
+
+static double _cost(int in_rate, int out_rate, polyphase_quality_t quality) {
+    size_t in_frames = in_rate, out_frames = out_rate, frames;
+    int32_t *in = malloc(in_frames * 2 * sizeof(int32_t));
+    int32_t *out = malloc(out_frames * 2 * sizeof(int32_t));
+    polyphase_t pp = {0};
+    uint64_t elapsed;
+
+    if (!in || !out || polyphase_init(&pp, in_rate, out_rate, 2, quality)
+            != ESP_OK) {
+        free(in);
+        free(out);
+        return NAN;
+    }
+
+    srand(1);
+    for (size_t i = 0; i < in_frames * 2; i++) {
+        in[i] = rand() % 65536 - 32768;
+    }
+    // The first round warms up the caches and the clock
+    for (int i = 0; i < 2; i++) {
+        polyphase_init(&pp, in_rate, out_rate, 2, quality);
+        frames = _convert(&pp, in, in_frames, out, out_frames, &elapsed);
+    }
+
+    polyphase_deinit(&pp);
+    free(in);
+    free(out);
+    return frames ? (double)elapsed / (frames * 2) : NAN;
+}
+
+
+int main(int argc, char *argv[]) {
+    esp_log_level_set("*", ESP_LOG_WARN);
+
+#ifdef BENCH_CYCLES
+    printf("%-15s %-7s %12s %11s\n", "ratio", "quality", "cycles/sample",
+            "rejection");
+#else
+    printf("%-15s %-7s %12s %11s\n", "ratio", "quality", "ns/sample",
+            "rejection");
+#endif
+    for (size_t r = 0; r < sizeof(s_ratios) / sizeof(s_ratios[0]); r++) {
+        for (int q = POLYPHASE_LOW; q <= POLYPHASE_HIGH; q++) {
+            int in_rate = s_ratios[r].in_rate, out_rate = s_ratios[r].out_rate;
+            printf("%5d > %5d Hz %-7s %12.1f %8.1f dB\n", in_rate, out_rate,
+                    s_quality_names[q], _cost(in_rate, out_rate, q),
+                    _rejection(in_rate, out_rate, q));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,227 @@
+/**
+ * Host benchmark: SPSC ring vs. a locked byte buffer.
+ *
+ * The locked byte buffer models the IO_BACKEND_RINGBUF path: every send and
+ * receive takes a lock, reads are split at the wrap point and _read_rb
+ * copies the received item out before returning it. The SPSC ring is used
+ * the way io.c uses it: in-place writes and borrowed reads.
+ *
+ * A producer thread writes fixed size chunks stamped with the time they
+ * were produced, a consumer thread reads them back. Reported are the
+ * throughput and the latency from produce to consume per chunk.
+ *
+ * Built with the host project, see host/CMakeLists.txt, or on its own:
+ *      gcc -O2 -std=gnu11 -pthread -I../../components/audio_element \
+ *          ring_bench.c ../../components/audio_element/spsc_ring.c \
+ *          -o ring_bench && ./ring_bench
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "spsc_ring.h"
+
+#define RING_SIZE 8192
+#define CHUNK_LEN 512
+#define TOTAL_BYTES (256UL * 1024 * 1024)
+#define CHUNK_COUNT (TOTAL_BYTES / CHUNK_LEN)
+
+typedef struct {
+    const char *name;
+    void *(*producer)(void *);
+    void *(*consumer)(void *);
+} backend_t;
+
+static uint64_t *s_latency;  // ns, per chunk
+
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void stamp(char *chunk) {
+    uint64_t t = now_ns();
+    memcpy(chunk, &t, sizeof(t));
+}
+
+static void record(const char *chunk, size_t i) {
+    uint64_t t;
+    memcpy(&t, chunk, sizeof(t));
+    s_latency[i] = now_ns() - t;
+}
+
+
+/**
+ * Locked byte buffer, modelled after RINGBUF_TYPE_BYTEBUF
+ */
+
+static struct {
+    pthread_spinlock_t lock;
+    char    buf[RING_SIZE];
+    size_t  head, tail, fill;
+    size_t  held;  // Bytes received but not yet returned
+} s_bb;
+
+static int bb_send(const char *data, size_t len) {
+    int ret = 0;
+    pthread_spin_lock(&s_bb.lock);
+    if (RING_SIZE - s_bb.fill - s_bb.held >= len) {
+        size_t first = RING_SIZE - s_bb.head < len ? RING_SIZE - s_bb.head : len;
+        memcpy(s_bb.buf + s_bb.head, data, first);
+        memcpy(s_bb.buf, data + first, len - first);
+        s_bb.head = (s_bb.head + len) % RING_SIZE;
+        s_bb.fill += len;
+        ret = 1;
+    }
+    pthread_spin_unlock(&s_bb.lock);
+    return ret;
+}
+
+static char *bb_receive_up_to(size_t *len, size_t max) {
+    char *item = NULL;
+    pthread_spin_lock(&s_bb.lock);
+    if (s_bb.fill) {
+        // Split at the wrap point
+        size_t n = RING_SIZE - s_bb.tail;
+        n = n < s_bb.fill ? n : s_bb.fill;
+        n = n < max ? n : max;
+        item = s_bb.buf + s_bb.tail;
+        s_bb.tail = (s_bb.tail + n) % RING_SIZE;
+        s_bb.fill -= n;
+        s_bb.held += n;
+        *len = n;
+    }
+    pthread_spin_unlock(&s_bb.lock);
+    return item;
+}
+
+static void bb_return_item(size_t len) {
+    pthread_spin_lock(&s_bb.lock);
+    s_bb.held -= len;
+    pthread_spin_unlock(&s_bb.lock);
+}
+
+static void *bb_producer(void *pv) {
+    char chunk[CHUNK_LEN] = { 0 };
+    for (size_t i = 0; i < CHUNK_COUNT; i++) {
+        stamp(chunk);
+        while (!bb_send(chunk, CHUNK_LEN))
+            sched_yield();
+    }
+    return NULL;
+}
+
+static void *bb_consumer(void *pv) {
+    char buf[CHUNK_LEN];
+    size_t got = 0, len;
+    char *item;
+
+    for (size_t i = 0; i < CHUNK_COUNT; ) {
+        item = bb_receive_up_to(&len, CHUNK_LEN - got);
+        if (!item) {
+            sched_yield();
+            continue;
+        }
+        // _read_rb copies the item out before returning it
+        memcpy(buf + got, item, len);
+        bb_return_item(len);
+
+        got += len;
+        if (got == CHUNK_LEN) {
+            record(buf, i++);
+            got = 0;
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * SPSC ring
+ */
+
+static spsc_ring_t *s_ring;
+
+static void *spsc_producer(void *pv) {
+    spsc_region_t regions[2];
+    for (size_t i = 0; i < CHUNK_COUNT; i++) {
+        // Chunks never straddle the wrap point, as RING_SIZE % CHUNK_LEN == 0
+        while (spsc_ring_write_regions(s_ring, regions) < CHUNK_LEN)
+            sched_yield();
+        stamp(regions[0].data);
+        spsc_ring_commit(s_ring, CHUNK_LEN);
+    }
+    return NULL;
+}
+
+static void *spsc_consumer(void *pv) {
+    spsc_region_t regions[2];
+    for (size_t i = 0; i < CHUNK_COUNT; i++) {
+        while (spsc_ring_read_regions(s_ring, regions) < CHUNK_LEN)
+            sched_yield();
+        record(regions[0].data, i);
+        spsc_ring_release(s_ring, CHUNK_LEN);
+    }
+    return NULL;
+}
+
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void run(const backend_t *backend) {
+    pthread_t prod, cons;
+    uint64_t start, elapsed, sum = 0;
+
+    start = now_ns();
+    pthread_create(&cons, NULL, backend->consumer, NULL);
+    pthread_create(&prod, NULL, backend->producer, NULL);
+    pthread_join(prod, NULL);
+    pthread_join(cons, NULL);
+    elapsed = now_ns() - start;
+
+    for (size_t i = 0; i < CHUNK_COUNT; i++)
+        sum += s_latency[i];
+    qsort(s_latency, CHUNK_COUNT, sizeof(uint64_t), cmp_u64);
+
+    printf("%-8s %9.1f MB/s   latency us: avg %8.2f  p50 %8.2f  "
+            "p99 %8.2f  max %9.2f\n", backend->name,
+            TOTAL_BYTES / (elapsed / 1e9) / 1e6,
+            sum / (double)CHUNK_COUNT / 1e3,
+            s_latency[CHUNK_COUNT / 2] / 1e3,
+            s_latency[CHUNK_COUNT * 99 / 100] / 1e3,
+            s_latency[CHUNK_COUNT - 1] / 1e3);
+}
+
+int main(void) {
+    const backend_t backends[] = {
+        { "ringbuf", bb_producer, bb_consumer },
+        { "spsc", spsc_producer, spsc_consumer },
+    };
+
+    s_latency = malloc(CHUNK_COUNT * sizeof(uint64_t));
+    s_ring = spsc_ring_create(RING_SIZE);
+    pthread_spin_init(&s_bb.lock, PTHREAD_PROCESS_PRIVATE);
+    if (!s_latency || !s_ring) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    printf("%lu MB in %d byte chunks through a %d byte ring\n",
+            TOTAL_BYTES >> 20, CHUNK_LEN, RING_SIZE);
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+        run(&backends[i]);
+
+    spsc_ring_destroy(s_ring);
+    free(s_latency);
+    return 0;
+}
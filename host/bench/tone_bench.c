@@ -0,0 +1,132 @@
+/**
+ * Host benchmark: cost, tuning and purity of the tone oscillator.
+ *
+ * For a few frequencies at 48 kHz, the frequency the oscillator plays is
+ * compared to the one asked for, next to what a period of a whole number
+ * of frames (what the old tone source looped) plays, in cents.
+ *
+ * A second of a full scale 16 bit stereo tone is then generated in blocks,
+ * and the time per sample (one channel of one frame) is reported, in
+ * cycles on x86, where the time stamp counter is cheap to read, in ns
+ * elsewhere. The same for a sin() per frame, for scale.
+ *
+ * Last, the SINAD of the 16 bit tone: the power of the tone, over that of
+ * everything else in its spectrum but DC. Rounding to 16 bits, once in the
+ * table and once more at the output, leaves some 95 dB.
+ *
+ * Usage: tone_bench
+ *
+ * Build with the host project, see host/CMakeLists.txt.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench_util.h"
+#include "fir.h"
+#include "nco.h"
+
+#include "esp_log.h"
+
+#define RATE 48000
+#define CHANNELS 2
+#define FRAMES RATE                 // A second
+#define BLOCK_FRAMES 480            // Generated at a time, 10 ms
+#define FFT_LEN 16384               // Frames analysed, a power of two
+#define KAISER_BETA 14.             // Of the analysis window
+#define TONE_BINS 8                 // Around the tone, its main lobe
+
+static const float s_freqs[] = {
+    440.f, 997.f, 1000.f, 3520.5f, 12345.678f, 19000.f,
+};
+
+
+// Detuning of what plays instead of 'freq', in cents
+static double _cents(double played, double freq) {
+    return 1200. * log2(played / freq);
+}
+
+// Time per sample of a second of the tone, the best of 3 after a warmup
+static double _cost(float freq, bool reference) {
+    int32_t *out = malloc(FRAMES * CHANNELS * sizeof(int32_t));
+    uint64_t start, elapsed, best = UINT64_MAX;
+    nco_t nco = { .amp = INT16_MAX };
+    double w = 2. * M_PI * freq / RATE;
+
+    if (!out)
+        return NAN;
+    nco_set_freq(&nco, freq, RATE);
+    for (int round = 0; round < 4; round++) {
+        start = bench_now();
+        for (size_t f = 0; f < FRAMES; f += BLOCK_FRAMES) {
+            if (!reference) {
+                nco_run(&nco, out + f * CHANNELS, BLOCK_FRAMES, CHANNELS);
+                continue;
+            }
+            for (size_t i = f; i < f + BLOCK_FRAMES; i++) {
+                out[i * CHANNELS] = out[i * CHANNELS + 1]
+                    = lrint(INT16_MAX * sin(w * i));
+            }
+        }
+        elapsed = bench_now() - start;
+        best = round && elapsed < best ? elapsed : best;
+    }
+    free(out);
+    return (double)best / (FRAMES * CHANNELS);
+}
+
+// Power of the tone over the rest, in dB
+static double _sinad(float freq) {
+    static double re[FFT_LEN], im[FFT_LEN];
+    static int32_t out[FFT_LEN];
+    nco_t nco = { .amp = INT16_MAX };
+    double r, w, tone = 0., rest = 0., bin = (double)freq * FFT_LEN / RATE;
+
+    nco_set_freq(&nco, freq, RATE);
+    nco_run(&nco, out, FFT_LEN, 1);
+    for (size_t i = 0; i < FFT_LEN; i++) {
+        r = 2. * i / (FFT_LEN - 1) - 1.;
+        w = fir_bessel_i0(KAISER_BETA * sqrt(1. - r * r))
+            / fir_bessel_i0(KAISER_BETA);
+        re[i] = w * out[i];
+        im[i] = 0.;
+    }
+    bench_fft(re, im, FFT_LEN);
+
+    for (size_t k = TONE_BINS; k < FFT_LEN / 2; k++) {
+        if (fabs(k - bin) > TONE_BINS)
+            rest += re[k] * re[k] + im[k] * im[k];
+        else
+            tone += re[k] * re[k] + im[k] * im[k];
+    }
+    return 10. * log10(tone / (rest + 1e-30));
+}
+
+
+int main(int argc, char *argv[]) {
+    esp_log_level_set("*", ESP_LOG_WARN);
+
+    printf("%-12s %21s %21s %10s\n", "", "detuning (cents)",
+#ifdef BENCH_CYCLES
+            "cycles/sample",
+#else
+            "ns/sample",
+#endif
+            "");
+    printf("%-12s %10s %10s %10s %10s %10s\n", "Hz", "nco", "period",
+            "nco", "sin()", "SINAD");
+    for (size_t i = 0; i < sizeof(s_freqs) / sizeof(s_freqs[0]); i++) {
+        float freq = s_freqs[i];
+        nco_t nco = {0};
+
+        nco_set_freq(&nco, freq, RATE);
+        printf("%12.3f %10.6f %10.3f %10.2f %10.2f %7.1f dB\n", freq,
+                _cents(nco.step * (double)RATE / 4294967296., freq),
+                _cents((double)RATE / (RATE / (int)freq), freq),
+                _cost(freq, false), _cost(freq, true), _sinad(freq));
+    }
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "esp_timer.h"
+
+
+struct esp_timer {
+    esp_timer_cb_t  callback;
+    void            *arg;
+    uint64_t        period;     // us
+    bool            running;
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;       // Signalled on stop
+};
+
+
+static void *_timer_main(void *pv) {
+    struct esp_timer *timer = pv;
+    struct timespec next;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    pthread_mutex_lock(&timer->lock);
+    while (timer->running) {
+        next.tv_sec += timer->period / 1000000;
+        next.tv_nsec += (timer->period % 1000000) * 1000;
+        if (next.tv_nsec >= 1000000000L) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000L;
+        }
+
+        if (pthread_cond_timedwait(&timer->cond, &timer->lock, &next)
+                != ETIMEDOUT)
+            continue;
+
+        pthread_mutex_unlock(&timer->lock);
+        timer->callback(timer->arg);
+        pthread_mutex_lock(&timer->lock);
+    }
+    pthread_mutex_unlock(&timer->lock);
+
+    return NULL;
+}
+
+int64_t esp_timer_get_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args,
+        esp_timer_handle_t *out_handle) {
+    pthread_condattr_t attr;
+
+    struct esp_timer *timer = calloc(1, sizeof(struct esp_timer));
+    if (!timer)
+        return ESP_ERR_NO_MEM;
+
+    timer->callback = args->callback;
+    timer->arg = args->arg;
+    pthread_mutex_init(&timer->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&timer->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer,
+        uint64_t period) {
+    if (timer->running)
+        return ESP_ERR_INVALID_STATE;
+
+    timer->period = period;
+    timer->running = true;
+    if (pthread_create(&timer->thread, NULL, _timer_main, timer) != 0) {
+        timer->running = false;
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    if (!timer->running)
+        return ESP_ERR_INVALID_STATE;
+
+    pthread_mutex_lock(&timer->lock);
+    timer->running = false;
+    pthread_cond_signal(&timer->cond);
+    pthread_mutex_unlock(&timer->lock);
+
+    // Stopped from its own callback, the thread ends by itself
+    if (pthread_equal(timer->thread, pthread_self()))
+        pthread_detach(timer->thread);
+    else
+        pthread_join(timer->thread, NULL);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    if (timer->running)
+        return ESP_ERR_INVALID_STATE;
+
+    pthread_cond_destroy(&timer->cond);
+    pthread_mutex_destroy(&timer->lock);
+    free(timer);
+    return ESP_OK;
+}
@@ -0,0 +1,475 @@
+/**
+ * FreeRTOS tasks, notifications, queues, mutexes and byte buffers on top of
+ * POSIX threads. Semantics follow FreeRTOS where the framework relies on
+ * them, everything else is left out.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/ringbuf.h"
+
+
+struct host_task {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    uint32_t        value;      // Notification value
+    bool            pending;    // Notification pending
+    TaskFunction_t  func;
+    void            *param;
+    char            name[16];
+};
+
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;       // Item received or sent
+    char            *buf;
+    size_t          item_size;
+    size_t          length;
+    size_t          head;
+    size_t          count;
+};
+
+struct host_semaphore {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    bool            taken;
+};
+
+struct host_ringbuf {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;       // Data sent or item returned
+    char            *buf;
+    size_t          size;
+    size_t          read;       // Index of the first unread byte
+    size_t          fill;       // Unread bytes
+    size_t          held;       // Bytes received, but not returned yet
+};
+
+static __thread struct host_task *s_current = NULL;
+static struct timespec s_start;
+static pthread_once_t s_start_once = PTHREAD_ONCE_INIT;
+
+
+static void _init_start(void) {
+    clock_gettime(CLOCK_MONOTONIC, &s_start);
+}
+
+static void _cond_init(pthread_cond_t *cond) {
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static struct timespec _deadline(TickType_t ticks) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += ticks / configTICK_RATE_HZ;
+    ts.tv_nsec += (long)(ticks % configTICK_RATE_HZ)
+        * (1000000000L / configTICK_RATE_HZ);
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+/**
+ * Wait on a condition, with the mutex held. Returns false on a timeout,
+ * portMAX_DELAY waits forever.
+ */
+static bool _wait(pthread_cond_t *cond, pthread_mutex_t *lock,
+        const struct timespec *deadline, TickType_t ticks) {
+    if (ticks == portMAX_DELAY)
+        return pthread_cond_wait(cond, lock) == 0;
+    if (ticks == 0)
+        return false;
+    return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+static struct host_task *_task_new(const char *name) {
+    struct host_task *task = calloc(1, sizeof(struct host_task));
+    if (!task)
+        return NULL;
+
+    pthread_mutex_init(&task->lock, NULL);
+    _cond_init(&task->cond);
+    strncpy(task->name, name ? name : "", sizeof(task->name) - 1);
+    return task;
+}
+
+static void *_task_main(void *arg) {
+    struct host_task *task = arg;
+
+    s_current = task;
+    task->func(task->param);
+
+    // Returning from a task function is not allowed in FreeRTOS either
+    vTaskDelete(NULL);
+    return NULL;
+}
+
+
+/*
+ * Tasks
+ */
+
+BaseType_t xTaskCreate(TaskFunction_t func, const char *name,
+        uint32_t stack_depth, void *param, UBaseType_t priority,
+        TaskHandle_t *created_task) {
+    struct host_task *task = _task_new(name);
+    if (!task)
+        return pdFAIL;
+
+    task->func = func;
+    task->param = param;
+
+    // Set before the thread starts, the task may use its own handle at once
+    if (created_task)
+        *created_task = task;
+
+    if (pthread_create(&task->thread, NULL, _task_main, task) != 0) {
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(task->thread);
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    // Only self deletion is supported. The handle itself is never freed, so
+    // late notifications to a deleted task are harmless.
+    if (task == NULL || task == s_current)
+        pthread_exit(NULL);
+    abort();
+}
+
+void vTaskDelay(TickType_t ticks) {
+    struct timespec ts = {
+        .tv_sec = ticks / configTICK_RATE_HZ,
+        .tv_nsec = (long)(ticks % configTICK_RATE_HZ)
+            * (1000000000L / configTICK_RATE_HZ),
+    };
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
+}
+
+TickType_t xTaskGetTickCount(void) {
+    struct timespec now;
+
+    pthread_once(&s_start_once, _init_start);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (TickType_t)((now.tv_sec - s_start.tv_sec) * configTICK_RATE_HZ
+            + (now.tv_nsec - s_start.tv_nsec)
+            / (1000000000L / configTICK_RATE_HZ));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    // Threads not created through xTaskCreate (e.g. main) get a handle on
+    // first use, so they can be notified too
+    if (!s_current) {
+        s_current = _task_new("main");
+        if (s_current)
+            s_current->thread = pthread_self();
+    }
+    return s_current;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    return 0;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value,
+        eNotifyAction action) {
+    BaseType_t ret = pdPASS;
+
+    pthread_mutex_lock(&task->lock);
+    switch (action) {
+        case eNoAction:
+            break;
+        case eSetBits:
+            task->value |= value;
+            break;
+        case eIncrement:
+            task->value++;
+            break;
+        case eSetValueWithOverwrite:
+            task->value = value;
+            break;
+    }
+    task->pending = true;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+
+    return ret;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit,
+        uint32_t *value, TickType_t ticks) {
+    struct host_task *task = xTaskGetCurrentTaskHandle();
+    struct timespec deadline = _deadline(ticks);
+    BaseType_t ret = pdTRUE;
+
+    pthread_mutex_lock(&task->lock);
+    if (!task->pending)
+        task->value &= ~clear_on_entry;
+
+    while (!task->pending) {
+        if (!_wait(&task->cond, &task->lock, &deadline, ticks)) {
+            ret = pdFALSE;
+            break;
+        }
+    }
+
+    if (value)
+        *value = task->value;
+    if (ret == pdTRUE) {
+        task->value &= ~clear_on_exit;
+        task->pending = false;
+    }
+    pthread_mutex_unlock(&task->lock);
+
+    return ret;
+}
+
+
+/*
+ * Queues
+ */
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    struct host_queue *queue = calloc(1, sizeof(struct host_queue));
+    if (!queue)
+        return NULL;
+
+    queue->buf = malloc(length * item_size);
+    if (!queue->buf) {
+        free(queue);
+        return NULL;
+    }
+    queue->length = length;
+    queue->item_size = item_size;
+    pthread_mutex_init(&queue->lock, NULL);
+    _cond_init(&queue->cond);
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    pthread_cond_destroy(&queue->cond);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->buf);
+    free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item,
+        TickType_t ticks) {
+    struct timespec deadline = _deadline(ticks);
+    size_t pos;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length) {
+        if (!_wait(&queue->cond, &queue->lock, &deadline, ticks)) {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFAIL;
+        }
+    }
+
+    pos = (queue->head + queue->count) % queue->length;
+    memcpy(queue->buf + pos * queue->item_size, item, queue->item_size);
+    queue->count++;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+    struct timespec deadline = _deadline(ticks);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0) {
+        if (!_wait(&queue->cond, &queue->lock, &deadline, ticks)) {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFALSE;
+        }
+    }
+
+    memcpy(item, queue->buf + queue->head * queue->item_size,
+            queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+
+    return pdTRUE;
+}
+
+
+/*
+ * Mutexes
+ */
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    struct host_semaphore *sem = calloc(1, sizeof(struct host_semaphore));
+    if (!sem)
+        return NULL;
+
+    pthread_mutex_init(&sem->lock, NULL);
+    _cond_init(&sem->cond);
+    return sem;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) {
+    pthread_cond_destroy(&sem->cond);
+    pthread_mutex_destroy(&sem->lock);
+    free(sem);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+    struct timespec deadline = _deadline(ticks);
+
+    pthread_mutex_lock(&sem->lock);
+    while (sem->taken) {
+        if (!_wait(&sem->cond, &sem->lock, &deadline, ticks)) {
+            pthread_mutex_unlock(&sem->lock);
+            return pdFALSE;
+        }
+    }
+    sem->taken = true;
+    pthread_mutex_unlock(&sem->lock);
+
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    pthread_mutex_lock(&sem->lock);
+    sem->taken = false;
+    pthread_cond_signal(&sem->cond);
+    pthread_mutex_unlock(&sem->lock);
+
+    return pdTRUE;
+}
+
+
+/*
+ * Byte buffers
+ *
+ * Like RINGBUF_TYPE_BYTEBUF: a single item can be received at a time, and
+ * its bytes only become free space again when it is returned.
+ */
+
+RingbufHandle_t xRingbufferCreate(size_t size, RingbufferType_t type) {
+    if (type != RINGBUF_TYPE_BYTEBUF)
+        return NULL;
+
+    struct host_ringbuf *rb = calloc(1, sizeof(struct host_ringbuf));
+    if (!rb)
+        return NULL;
+
+    rb->buf = malloc(size);
+    if (!rb->buf) {
+        free(rb);
+        return NULL;
+    }
+    rb->size = size;
+    pthread_mutex_init(&rb->lock, NULL);
+    _cond_init(&rb->cond);
+    return rb;
+}
+
+void vRingbufferDelete(RingbufHandle_t rb) {
+    pthread_cond_destroy(&rb->cond);
+    pthread_mutex_destroy(&rb->lock);
+    free(rb->buf);
+    free(rb);
+}
+
+BaseType_t xRingbufferSend(RingbufHandle_t rb, const void *data,
+        size_t size, TickType_t ticks) {
+    struct timespec deadline = _deadline(ticks);
+    size_t pos, first;
+
+    if (size > rb->size)
+        return pdFALSE;
+
+    // All or nothing, like the FreeRTOS byte buffer
+    pthread_mutex_lock(&rb->lock);
+    while (rb->size - rb->fill - rb->held < size) {
+        if (!_wait(&rb->cond, &rb->lock, &deadline, ticks)) {
+            pthread_mutex_unlock(&rb->lock);
+            return pdFALSE;
+        }
+    }
+
+    pos = (rb->read + rb->fill) % rb->size;
+    first = size < rb->size - pos ? size : rb->size - pos;
+    memcpy(rb->buf + pos, data, first);
+    memcpy(rb->buf, (const char*)data + first, size - first);
+    rb->fill += size;
+    pthread_cond_broadcast(&rb->cond);
+    pthread_mutex_unlock(&rb->lock);
+
+    return pdTRUE;
+}
+
+void *xRingbufferReceiveUpTo(RingbufHandle_t rb, size_t *item_size,
+        TickType_t ticks, size_t max_size) {
+    struct timespec deadline = _deadline(ticks);
+    void *item;
+    size_t len;
+
+    pthread_mutex_lock(&rb->lock);
+    while (rb->fill == 0 || rb->held) {
+        if (!_wait(&rb->cond, &rb->lock, &deadline, ticks)) {
+            pthread_mutex_unlock(&rb->lock);
+            return NULL;
+        }
+    }
+
+    // Items never wrap around, the rest is received with the next call
+    len = rb->size - rb->read;
+    if (len > rb->fill)
+        len = rb->fill;
+    if (len > max_size)
+        len = max_size;
+
+    item = rb->buf + rb->read;
+    rb->read = (rb->read + len) % rb->size;
+    rb->fill -= len;
+    rb->held = len;
+    *item_size = len;
+    pthread_mutex_unlock(&rb->lock);
+
+    return item;
+}
+
+void vRingbufferReturnItem(RingbufHandle_t rb, void *item) {
+    pthread_mutex_lock(&rb->lock);
+    rb->held = 0;
+    pthread_cond_broadcast(&rb->cond);
+    pthread_mutex_unlock(&rb->lock);
+}
+
+size_t xRingbufferGetMaxItemSize(RingbufHandle_t rb) {
+    return rb->size;
+}
+
+size_t xRingbufferGetCurFreeSize(RingbufHandle_t rb) {
+    size_t free_size;
+
+    pthread_mutex_lock(&rb->lock);
+    free_size = rb->size - rb->fill - rb->held;
+    pthread_mutex_unlock(&rb->lock);
+
+    return free_size;
+}
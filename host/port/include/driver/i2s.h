@@ -0,0 +1,79 @@
+/**
+ * Host stand-in for the ESP-IDF i2s driver.
+ *
+ * Written samples go to the file named by the SHOCK_I2S_OUT environment
+ * variable, or are discarded if it is not set. i2s_write never waits for a
+ * sample clock, so a pipeline runs as fast as the host allows.
+ */
+
+#ifndef DRIVER_I2S_H
+#define DRIVER_I2S_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef int i2s_port_t;
+
+typedef enum {
+    I2S_BITS_PER_SAMPLE_8BIT = 8,
+    I2S_BITS_PER_SAMPLE_16BIT = 16,
+    I2S_BITS_PER_SAMPLE_24BIT = 24,
+    I2S_BITS_PER_SAMPLE_32BIT = 32,
+} i2s_bits_per_sample_t;
+
+typedef enum {
+    I2S_CHANNEL_MONO = 1,
+    I2S_CHANNEL_STEREO = 2,
+} i2s_channel_t;
+
+#define I2S_NUM_MAX 2
+
+#define I2S_MODE_MASTER 1
+#define I2S_MODE_SLAVE  2
+#define I2S_MODE_TX     4
+#define I2S_MODE_RX     8
+
+#define I2S_CHANNEL_FMT_RIGHT_LEFT  0
+#define I2S_COMM_FORMAT_I2S         1
+#define I2S_COMM_FORMAT_I2S_MSB     2
+#define I2S_COMM_FORMAT_I2S_LSB     4
+#define ESP_INTR_FLAG_LEVEL1        2
+#define I2S_PIN_NO_CHANGE           -1
+
+typedef struct {
+    int                     mode;
+    int                     sample_rate;
+    i2s_bits_per_sample_t   bits_per_sample;
+    int                     channel_format;
+    int                     communication_format;
+    int                     intr_alloc_flags;
+    int                     dma_buf_count;
+    int                     dma_buf_len;
+    bool                    use_apll;
+    bool                    tx_desc_auto_clear;
+} i2s_config_t;
+
+typedef struct {
+    int bck_io_num;
+    int ws_io_num;
+    int data_out_num;
+    int data_in_num;
+} i2s_pin_config_t;
+
+esp_err_t i2s_driver_install(i2s_port_t num, const i2s_config_t *config,
+        int queue_size, void *queue);
+esp_err_t i2s_driver_uninstall(i2s_port_t num);
+esp_err_t i2s_set_pin(i2s_port_t num, const i2s_pin_config_t *pin);
+esp_err_t i2s_set_clk(i2s_port_t num, uint32_t rate,
+        i2s_bits_per_sample_t bits, i2s_channel_t ch);
+esp_err_t i2s_write(i2s_port_t num, const void *src, size_t size,
+        size_t *bytes_written, TickType_t ticks_to_wait);
+
+// Host only: total number of bytes written to a port
+uint64_t i2s_host_bytes_written(i2s_port_t num);
+
+#endif
@@ -0,0 +1,51 @@
+/**
+ * Host stand-in for ESP-IDF's esp_log.h
+ *
+ * Same format as on the target, written to stderr. LOG_LOCAL_LEVEL is
+ * respected at compile time, esp_log_level_set at runtime (for all tags).
+ */
+
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+#ifndef LOG_LOCAL_LEVEL
+#define LOG_LOCAL_LEVEL ESP_LOG_INFO
+#endif
+
+extern esp_log_level_t esp_log_level;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+void esp_log_write(esp_log_level_t level, const char *tag,
+        const char *format, ...) __attribute__((format(printf, 3, 4)));
+uint32_t esp_log_timestamp(void);
+
+#define ESP_LOG_LEVEL_LOCAL(level, tag, letter, format, ...) do {       \
+        if (LOG_LOCAL_LEVEL >= (level) && esp_log_level >= (level))     \
+            esp_log_write((level), (tag), letter " (%u) %s: " format    \
+                    "\n", esp_log_timestamp(), (tag), ##__VA_ARGS__);   \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) \
+    ESP_LOG_LEVEL_LOCAL(ESP_LOG_ERROR, tag, "E", format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) \
+    ESP_LOG_LEVEL_LOCAL(ESP_LOG_WARN, tag, "W", format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) \
+    ESP_LOG_LEVEL_LOCAL(ESP_LOG_INFO, tag, "I", format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) \
+    ESP_LOG_LEVEL_LOCAL(ESP_LOG_DEBUG, tag, "D", format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) \
+    ESP_LOG_LEVEL_LOCAL(ESP_LOG_VERBOSE, tag, "V", format, ##__VA_ARGS__)
+
+#endif
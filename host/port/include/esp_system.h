@@ -0,0 +1,16 @@
+/**
+ * Host stand-in for ESP-IDF's esp_system.h
+ */
+
+#ifndef ESP_SYSTEM_H
+#define ESP_SYSTEM_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// There is no fixed heap on the host, both return 0
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+
+#endif
@@ -0,0 +1,53 @@
+/**
+ * Host stand-in for FreeRTOS, on top of POSIX threads.
+ *
+ * Only the parts used by the audio_element framework are implemented. A
+ * tick is a millisecond, priorities and stack sizes are ignored.
+ */
+
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#define pdTRUE  1
+#define pdFALSE 0
+#define pdPASS  pdTRUE
+#define pdFAIL  pdFALSE
+
+#define configTICK_RATE_HZ      1000
+#define configMAX_PRIORITIES    25
+#define portMAX_DELAY           (TickType_t)0xffffffffUL
+#define portTICK_PERIOD_MS      (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) \
+    ((TickType_t)(((TickType_t)(ms) * configTICK_RATE_HZ) / 1000))
+
+typedef struct host_task *TaskHandle_t;
+typedef struct host_queue *QueueHandle_t;
+typedef struct host_semaphore *SemaphoreHandle_t;
+
+// Legacy names
+typedef TaskHandle_t xTaskHandle;
+typedef QueueHandle_t xQueueHandle;
+typedef SemaphoreHandle_t xSemaphoreHandle;
+
+// Critical sections are a mutex per portMUX_TYPE, they do not nest
+typedef struct {
+    pthread_mutex_t mutex;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED \
+    { PTHREAD_MUTEX_INITIALIZER }
+
+#define portENTER_CRITICAL(mux) pthread_mutex_lock(&(mux)->mutex)
+#define portEXIT_CRITICAL(mux)  pthread_mutex_unlock(&(mux)->mutex)
+
+#endif
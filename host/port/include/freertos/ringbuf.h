@@ -0,0 +1,25 @@
+#ifndef FREERTOS_RINGBUF_H
+#define FREERTOS_RINGBUF_H
+
+#include "FreeRTOS.h"
+
+typedef struct host_ringbuf *RingbufHandle_t;
+
+// Only RINGBUF_TYPE_BYTEBUF is implemented
+typedef enum {
+    RINGBUF_TYPE_NOSPLIT,
+    RINGBUF_TYPE_ALLOWSPLIT,
+    RINGBUF_TYPE_BYTEBUF,
+} RingbufferType_t;
+
+RingbufHandle_t xRingbufferCreate(size_t size, RingbufferType_t type);
+void vRingbufferDelete(RingbufHandle_t rb);
+BaseType_t xRingbufferSend(RingbufHandle_t rb, const void *data,
+        size_t size, TickType_t ticks);
+void *xRingbufferReceiveUpTo(RingbufHandle_t rb, size_t *item_size,
+        TickType_t ticks, size_t max_size);
+void vRingbufferReturnItem(RingbufHandle_t rb, void *item);
+size_t xRingbufferGetMaxItemSize(RingbufHandle_t rb);
+size_t xRingbufferGetCurFreeSize(RingbufHandle_t rb);
+
+#endif
@@ -0,0 +1,15 @@
+/**
+ * There is no card to mount on the host, sdcard_stream opens its uri as a
+ * path on the host filesystem.
+ */
+
+#include "sdcard.h"
+
+
+esp_err_t sdcard_init(char *mountpoint, int max_files) {
+    return ESP_OK;
+}
+
+esp_err_t sdcard_destroy() {
+    return ESP_OK;
+}
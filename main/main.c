@@ -2,7 +2,13 @@
 #include "sdcard_stream.h"
 #include "i2s_stream.h"
 #include "a2dp_stream.h"
+#include "asrc.h"
+#include "bitdepth.h"
+#include "decimator.h"
 #include "mixer.h"
+#include "pipeline.h"
+#include "tee.h"
+#include "tone_stream.h"
 
 #include "esp_err.h"
 #include "esp_log.h"
@@ -11,6 +17,7 @@
 #include "freertos/task.h"
 
 #include "io.h"
+#include "io_trace.h"
 
 static const char TAG[] = "MAIN";
 
@@ -22,29 +29,112 @@ esp_err_t app_main(void) {
     /* cfg.out_rb_size = 8192*2; */
     /* cfg.task_stack = 2048; */
     /* audio_element_t *sdcard = sdcard_stream_init(cfg, AEL_STREAM_READER); */
-    /* sdcard->open(sdcard, "/sdcard/strobe.wav"); */
+    /* audio_element_open(sdcard, "/sdcard/strobe.wav"); */
 
     audio_element_cfg_clear(&cfg);
     cfg.buf_len = 0;
     cfg.task_stack = 2048;
-    cfg.out_rb_size = 8192;
+    cfg.out_rb_size = 16384;
+    cfg.out_rb_backend = IO_BACKEND_SPSC;
     audio_element_t *a2dp = a2dp_stream_init(cfg, AEL_STREAM_READER);
-    a2dp->open(a2dp, "ShockSpeaker");
+    audio_element_open(a2dp, "ShockSpeaker");
 
 
-    io_t *inputs[] = { a2dp->output };
+    // The asrc keeps the a2dp ring at its target, whatever the phone's
+    // clock. It runs inline with i2s, which sets the pace.
+    asrc_cfg_t asrc_cfg = DEFAULT_ASRC_CFG();
+    asrc_cfg.target_ms = 40;
+    audio_element_cfg_clear(&cfg);
+    cfg.buf_len = 2048;
+    cfg.task_stack = 0;
+    cfg.out_rb_size = 2048;
+    cfg.out_rb_backend = IO_BACKEND_SPSC;
+    audio_element_cfg_link(a2dp, &cfg);
+    audio_element_t *asrc = asrc_init(cfg, asrc_cfg);
+    audio_element_open(asrc, NULL);
+
+
+    // Asrc, mixer, bitdepth and i2s run inline, in a single pipeline task.
+    // The mix is at 24 bits, which leaves the int32_t bus 8 bits of
+    // headroom, and is dithered down to 16 only for the DAC.
+    io_t *inputs[] = { asrc->output };
     /* io_t *inputs[] = { a2dp->output, sdcard->output }; */
-    audio_element_t *mixer = mixer_init(inputs, 1);
-    mixer->open(mixer, NULL);
+    audio_element_cfg_clear(&cfg);
+    cfg.buf_len = 2048;
+    cfg.task_stack = 0;
+    cfg.out_rb_size = 4096;
+    cfg.out_rb_backend = IO_BACKEND_SPSC;
+    audio_element_t *mixer = mixer_init(cfg, inputs, 1);
+    mixer_set_bits(mixer, 24);
+    audio_element_open(mixer, NULL);
+
+    // Beeps and prompts come from a tone generator, an extra mixer input
+    // that ducks the music while it plays
+    /* tone_stream_cfg_t tone_cfg = DEFAULT_TONE_STREAM_CFG(); */
+    /* audio_element_cfg_clear(&cfg); */
+    /* cfg.buf_len = 1024; */
+    /* cfg.task_stack = 2048; */
+    /* cfg.out_rb_size = 1024; */
+    /* audio_element_t *tone = tone_stream_init(cfg, tone_cfg); */
+    /* audio_element_open(tone, NULL); */
+    /* int tone_input; */
+    /* mixer_add_input(mixer, tone->output, &tone_input); */
+    /* mixer_set_priority(mixer, tone_input, 1); */
+    /* tone_stream_play(tone, 880.f, 150); */
 
 
+    bitdepth_cfg_t bd_cfg = DEFAULT_BITDEPTH_CFG();
+    bd_cfg.shaping = BITDEPTH_SHAPE_SECOND;
+    audio_element_cfg_clear(&cfg);
+    cfg.buf_len = 4096;
+    cfg.task_stack = 0;
+    cfg.out_rb_size = 2048;
+    cfg.out_rb_backend = IO_BACKEND_SPSC;
+    audio_element_cfg_link(mixer, &cfg);
+    audio_element_t *bitdepth = bitdepth_init(cfg, bd_cfg);
+    audio_element_open(bitdepth, NULL);
+
+
+    // To also send the output elsewhere, tee it and link i2s to tee output 0
+    /* bcast_lag_t policies[] = { BCAST_LAG_BLOCK, BCAST_LAG_DROP }; */
+    /* audio_element_cfg_clear(&cfg); */
+    /* cfg.task_stack = 0; */
+    /* cfg.out_rb_size = 4096; */
+    /* audio_element_cfg_link(bitdepth, &cfg); */
+    /* audio_element_t *tee = tee_init(cfg, policies, 2); */
+    /* audio_element_open(tee, NULL); */
+
+    // Tee output 1 can feed a 16 kHz voice or network sink. A decimator in
+    // its own task takes it down, off the path to i2s.
+    /* audio_element_cfg_clear(&cfg); */
+    /* cfg.buf_len = 2048; */
+    /* cfg.task_stack = 2048; */
+    /* cfg.out_rb_size = 2048; */
+    /* cfg.input = tee_output(tee, 1); */
+    /* audio_element_t *voice = decimator_init(cfg, 16000, */
+    /*         POLYPHASE_MEDIUM); */
+    /* audio_element_open(voice, NULL); */
+
     audio_element_cfg_clear(&cfg);
     cfg.buf_len = 2048;
-    cfg.task_stack = 2048;
+    cfg.task_stack = 0;
     cfg.out_rb_size = 0;
-    audio_element_cfg_link(mixer, &cfg);
+    audio_element_cfg_link(bitdepth, &cfg);
+    /* cfg.input = tee_output(tee, 0); */
     audio_element_t *i2s = i2s_stream_init(cfg, AEL_STREAM_WRITER);
-    i2s->open(i2s, NULL);
+    audio_element_open(i2s, NULL);
+
+    pipeline_cfg_t pl_cfg = DEFAULT_PIPELINE_CFG();
+    audio_element_t *chain[] = { asrc, mixer, bitdepth, i2s };
+    pipeline_init(&pl_cfg, chain, 4);
+
+    // Measure the latency from a2dp to i2s, 10 tags per second
+    io_t *path[] = { a2dp->output, asrc->output, mixer->output,
+        bitdepth->output };
+    io_trace_start(path, 4, 100);
+
+    // Log the stats of every element, and the latencies, every 10 seconds
+    audio_element_stats_start(10000);
 
     ESP_LOGI(TAG, "Everything started");
     